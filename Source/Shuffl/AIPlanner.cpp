@@ -0,0 +1,417 @@
+// Copyright (C) 2020 Valentin Galea
+//
+// This program is free software : you can redistribute it and /or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#include "AIPlanner.h"
+
+#include "Async/Async.h"
+#include "Async/ParallelFor.h"
+#include "HAL/PlatformTime.h"
+#include "Hash/CityHash.h"
+#include "Math/RandomStream.h"
+#include "Misc/ScopeLock.h"
+
+#include "Puck.h"
+#include "ThrowTable.h"
+
+static constexpr int BatchSize = 16; // tables per simulation run, keeps the budget checks frequent
+static constexpr int MaxCacheEntries = 1 << 16;
+static constexpr float HashQuantum = 1.f; // cm, closer than this counts as the same spot
+static constexpr int ReservedCores = 2; // left to the game and render threads while planning
+
+enum class EAIThrowKind : uint8
+{
+	Straight,
+	Angled, // slingshot like
+	Spin,
+	Num
+};
+
+static FAIMove RandomMove(const FAIPlanRequest& req, FRandomStream& rand)
+{
+	FAIMove move;
+	FPuckThrow& t = move.Throw;
+	t.Start = FMath::Lerp(req.LineStart, req.LineEnd, rand.FRand());
+
+	const float force = rand.FRandRange(.1f, 1.f) * req.ForceMax;
+	switch (EAIThrowKind(rand.RandHelper(int(EAIThrowKind::Num)))) {
+	case EAIThrowKind::Straight:
+		t.Force = FVector2D(force, 0.f);
+		break;
+	case EAIThrowKind::Angled: {
+		const float angle = rand.FRandRange(-PI / 4.f, PI / 4.f); // same cone as the slingshot
+		t.Force = FVector2D(FMath::Cos(angle), FMath::Sin(angle)) * force;
+		break;
+	}
+	case EAIThrowKind::Spin:
+		t.Force = FVector2D(force, 0.f);
+		t.SpinAngle = rand.FRandRange(-PI / 2.f, PI / 2.f);
+		t.SpinVelocity = rand.FRandRange(.1f, 1.f) * req.SpinVelocityMax;
+		t.SpinDelay = req.SpinDelay;
+		move.bSpin = true;
+		break;
+	default:
+		break;
+	}
+
+	return move;
+}
+
+static FAIMove Refine(const FAIPlanRequest& req, const FAIMove& best, float radius, FRandomStream& rand)
+{
+	FAIMove move = best;
+	FPuckThrow& t = move.Throw;
+
+	auto Jitter = [&](float v, float range, float lo, float hi) {
+		return FMath::Clamp(v + rand.FRandRange(-radius, radius) * range, lo, hi);
+	};
+
+	const float lineLen = (req.LineEnd - req.LineStart).Size();
+	const FVector2D lineDir = lineLen > 0.f ? (req.LineEnd - req.LineStart) / lineLen : FVector2D::ZeroVector;
+	const float along = Jitter(FVector2D::DotProduct(t.Start - req.LineStart, lineDir), lineLen, 0.f, lineLen);
+	t.Start = req.LineStart + lineDir * along;
+
+	t.Force.X = Jitter(t.Force.X, req.ForceMax, 0.f, req.ForceMax);
+	if (!move.bSpin && t.Force.Y != 0.f) {
+		t.Force.Y = Jitter(t.Force.Y, req.ForceMax, -t.Force.X, t.Force.X);
+	}
+	if (move.bSpin) {
+		t.SpinAngle = Jitter(t.SpinAngle, PI, -PI / 2.f, PI / 2.f);
+		t.SpinVelocity = Jitter(t.SpinVelocity, req.SpinVelocityMax, 0.f, req.SpinVelocityMax);
+	}
+
+	move.Value = -MAX_FLT;
+	return move;
+}
+
+// the table between two throws: pucks resting on it (in slot order) and whose throw is next
+struct FAIState
+{
+	TArray<TPair<FVector2D, EPuckColor>, TInlineAllocator<ERound::TotalThrows>> Pucks;
+	EPuckColor ToPlay = EPuckColor::Red;
+	int ThrowsLeft = 0;
+
+	uint64 Hash(int depth) const
+	{
+		// order independent so the same layout reached in a different order hits too
+		uint64 hash = 0;
+		for (const auto& p : Pucks) {
+			const int32 key[] = {
+				FMath::RoundToInt(p.Key.X / HashQuantum),
+				FMath::RoundToInt(p.Key.Y / HashQuantum),
+				int32(p.Value) };
+			hash += CityHash64(reinterpret_cast<const char*>(key), sizeof(key));
+		}
+		const int32 tail[] = { int32(ToPlay), ThrowsLeft, depth };
+		return CityHash64WithSeed(reinterpret_cast<const char*>(tail), sizeof(tail), hash);
+	}
+};
+
+// the game mode's scoring of a table, from the player's point of view
+static float Evaluate(const FAIPlanRequest& req, const FAIState& state)
+{
+	struct FEntry
+	{
+		float X;
+		int Points;
+		EPuckColor Color;
+	};
+	FEntry ranked[ERound::TotalThrows];
+	int num = 0;
+	int ownPoints = 0;
+
+	for (const auto& p : state.Pucks) {
+		const int points = req.Zones.GetPoints(FVector(p.Key, req.PuckZ));
+		if (p.Value == req.Color) {
+			ownPoints += points;
+		}
+
+		int at = num++;
+		while (at > 0 && ranked[at - 1].X < p.Key.X) {
+			ranked[at] = ranked[at - 1];
+			at--;
+		}
+		ranked[at] = { p.Key.X, points, p.Value };
+	}
+
+	FRoundScore score;
+	for (int i = 0; i < num; ++i) {
+		if (!score.Add(ranked[i].Color, ranked[i].Points)) break;
+	}
+
+	float value = score.HasWinner() ? (score.Winner == req.Color ? score.Points : -score.Points) : 0.f;
+	value += .01f * ownPoints; // between equals prefer more pucks in (blocked or not)
+	return value;
+}
+
+class FAICache
+{
+public:
+	bool Find(uint64 key, float& value)
+	{
+		FScopeLock lock(&Lock);
+		if (const float* v = Values.Find(key)) {
+			value = *v;
+			return true;
+		}
+		return false;
+	}
+
+	void Add(uint64 key, float value)
+	{
+		FScopeLock lock(&Lock);
+		if (Values.Num() >= MaxCacheEntries) {
+			Values.Reset(); // simplest bound, the current iteration refills what it needs
+		}
+		Values.Add(key, value);
+	}
+
+private:
+	FCriticalSection Lock;
+	TMap<uint64, float> Values;
+};
+
+//
+// Expectimax over the remaining throws: max on our throws, average over a sampled
+// opponent (aimed guesses with some noise and random ones) on theirs
+//
+struct FAISearch
+{
+	FAISearch(const FAIPlanRequest& req, const TAtomic<bool>& cancel)
+		: Req(req), Cancel(cancel), Deadline(FPlatformTime::Seconds() + req.Budget)
+	{
+	}
+
+	const FAIPlanRequest& Req;
+	const TAtomic<bool>& Cancel;
+	const double Deadline;
+
+	FAICache Cache;
+	TAtomic<bool> bExpired { false };
+	TAtomic<int32> Evaluated { 0 };
+
+	bool Expired()
+	{
+		if (!bExpired && (Cancel || FPlatformTime::Seconds() > Deadline)) {
+			bExpired = true;
+		}
+		return bExpired;
+	}
+
+	// plays each move on a copy of the table, all in as few simulation runs as possible
+	void Expand(FPuckBatchSim& sim, const FAIState& state, const FAIMove* moves, int num, FAIState* children)
+	{
+		const int thrownSlot = FMath::Min(state.Pucks.Num(), FPuckBatchSim::MaxPucks - 1);
+		const EPuckColor next = OppositePuckColor(state.ToPlay);
+
+		for (int first = 0; first < num; first += BatchSize) {
+			const int count = FMath::Min(BatchSize, num - first);
+			sim.Reset(count);
+			for (int table = 0; table < count; ++table) {
+				for (int slot = 0; slot < thrownSlot; ++slot) {
+					sim.SetPuck(table, slot, state.Pucks[slot].Key);
+				}
+				sim.Throw(table, thrownSlot, moves[first + table].Throw);
+			}
+			sim.Run();
+
+			for (int table = 0; table < count; ++table) {
+				FAIState& child = children[first + table];
+				child.Pucks.Reset();
+				child.ToPlay = next;
+				child.ThrowsLeft = state.ThrowsLeft - 1;
+				for (int slot = 0; slot <= thrownSlot; ++slot) {
+					if (!sim.IsAlive(table, slot)) continue;
+					child.Pucks.Emplace(sim.GetPosition(table, slot),
+						slot == thrownSlot ? state.ToPlay : state.Pucks[slot].Value);
+				}
+			}
+		}
+
+		Evaluated += num;
+	}
+
+	float Value(const FAIState& state, int depth, FPuckBatchSim& sim)
+	{
+		if (depth == 0 || state.ThrowsLeft == 0) return Evaluate(Req, state);
+		if (Expired()) return 0.f; // the whole iteration gets thrown away
+
+		const uint64 key = state.Hash(depth);
+		float value;
+		if (Cache.Find(key, value)) return value;
+
+		// candidates only depend on the state so revisits (and deeper iterations) agree
+		FRandomStream rand(int32(key ^ (key >> 32)));
+		const bool ours = state.ToPlay == Req.Color;
+		const int num = ours ? Req.SearchWidth : Req.OpponentSamples;
+
+		TArray<FAIMove, TInlineAllocator<32>> moves;
+		TArray<FAIState, TInlineAllocator<32>> children;
+		moves.SetNum(num);
+		children.SetNum(num);
+		for (int i = 0; i < num; ++i) {
+			if (ours) {
+				moves[i] = i < Req.Seeds.Num() ? Req.Seeds[i] : RandomMove(Req, rand);
+			} else if (Req.Seeds.Num() && i % 2 == 0) {
+				moves[i] = Refine(Req, Req.Seeds[rand.RandHelper(Req.Seeds.Num())], .1f, rand);
+			} else {
+				moves[i] = RandomMove(Req, rand);
+			}
+		}
+		Expand(sim, state, moves.GetData(), num, children.GetData());
+
+		if (ours) {
+			value = -MAX_FLT;
+			for (const auto& child : children) {
+				value = FMath::Max(value, Value(child, depth - 1, sim));
+			}
+		} else {
+			value = 0.f;
+			for (const auto& child : children) {
+				value += Value(child, depth - 1, sim);
+			}
+			value /= num;
+		}
+
+		if (Expired()) return 0.f;
+		Cache.Add(key, value);
+		return value;
+	}
+};
+
+void FAIPlanRequest::AddZoneSeeds(const FThrowTable& table)
+{
+	for (int zone = 0; zone < Zones.Num(); ++zone) {
+		const FVector2D target(Zones.GetBox(zone).GetCenter());
+		for (float along : { .25f, .5f, .75f }) {
+			FAIMove seed;
+			seed.Throw.Start = FMath::Lerp(LineStart, LineEnd, along);
+			if (table.FindForce(seed.Throw.Start, target, seed.Throw.Force)) {
+				Seeds.Add(seed);
+			}
+		}
+	}
+}
+
+FAIMove FAIPlanner::Plan(const FAIPlanRequest& req, const TAtomic<bool>& cancel)
+{
+	FAISearch search(req, cancel);
+	FPuckBatchSim sim(req.Params, req.Layout);
+	FRandomStream rand(req.Seed);
+
+	FAIState root;
+	root.Pucks = req.Pucks;
+	root.ToPlay = req.Color;
+	root.ThrowsLeft = FMath::Max(req.ThrowsLeft, 1);
+
+	// the root moves are fixed for all the iterations so their values compare
+	const int numRoot = FMath::Max(req.RootWidth, req.Seeds.Num());
+	TArray<FAIMove> moves;
+	TArray<FAIState> children;
+	moves.SetNum(numRoot);
+	children.SetNum(numRoot);
+	for (int i = 0; i < numRoot; ++i) {
+		moves[i] = i < req.Seeds.Num() ? req.Seeds[i] : RandomMove(req, rand);
+	}
+	search.Expand(sim, root, moves.GetData(), numRoot, children.GetData());
+
+	// sibling branches are shared out to a few workers as they free up, each worker keeps
+	// one simulator for every branch and depth (the first one is the caller's)
+	const int numWorkers = FMath::Clamp(FPlatformMisc::NumberOfCores() - ReservedCores, 1, numRoot);
+	TArray<TUniquePtr<FPuckBatchSim>, TInlineAllocator<8>> workerSims;
+	for (int worker = 1; worker < numWorkers; ++worker) {
+		workerSims.Add(MakeUnique<FPuckBatchSim>(req.Params, req.Layout));
+	}
+
+	// iterative deepening, one more throw of look ahead each time the budget allows
+	FAIMove best = moves[0];
+	TArray<float> values;
+	values.SetNumZeroed(numRoot);
+	const int maxDepth = FMath::Min(root.ThrowsLeft, req.MaxDepth);
+	for (int depth = 1; depth <= maxDepth; ++depth) {
+		TAtomic<int32> next { 0 };
+		ParallelFor(numWorkers, [&](int32 worker) {
+			FPuckBatchSim& workerSim = worker ? *workerSims[worker - 1] : sim;
+			for (int32 i = next++; i < numRoot; i = next++) {
+				values[i] = depth == 1 ? Evaluate(req, children[i])
+					: search.Value(children[i], depth - 1, workerSim);
+			}
+		});
+		if (depth > 1 && search.Expired()) break; // incomplete, keep the previous depth
+
+		int bestIndex = 0;
+		for (int i = 1; i < numRoot; ++i) {
+			if (values[i] > values[bestIndex]) {
+				bestIndex = i;
+			}
+		}
+		best = moves[bestIndex];
+		best.Value = values[bestIndex];
+		best.Depth = depth;
+	}
+
+	// last throw of the round, nothing to look ahead to: spend what's left refining
+	if (maxDepth == 1) {
+		FAIMove batch[BatchSize];
+		FAIState batchChildren[BatchSize];
+		float radius = .25f;
+		while (!search.Expired()) {
+			for (int i = 0; i < BatchSize; ++i) {
+				batch[i] = i % 2 ? RandomMove(req, rand) : Refine(req, best, radius, rand);
+			}
+			search.Expand(sim, root, batch, BatchSize, batchChildren);
+
+			for (int i = 0; i < BatchSize; ++i) {
+				const float value = Evaluate(req, batchChildren[i]);
+				if (value > best.Value) {
+					best = batch[i];
+					best.Value = value;
+				}
+			}
+			radius = FMath::Max(radius * .9f, .02f);
+		}
+	}
+
+	best.Evaluated = search.Evaluated;
+	return best;
+}
+
+void FAIPlanner::Start(FAIPlanRequest request)
+{
+	Cancel();
+
+	State = MakeShared<FState, ESPMode::ThreadSafe>();
+	Async(EAsyncExecution::ThreadPool,
+		[state = State, request = MoveTemp(request)]() {
+			state->Result = Plan(request, state->bCancel);
+			state->bDone = true;
+		});
+}
+
+void FAIPlanner::Cancel()
+{
+	if (State.IsValid()) {
+		State->bCancel = true;
+		State.Reset(); // the worker keeps its own reference until it's done
+	}
+}
+
+bool FAIPlanner::Poll(FAIMove& out)
+{
+	if (!State.IsValid() || !State->bDone) return false;
+
+	out = State->Result;
+	State.Reset();
+	return true;
+}
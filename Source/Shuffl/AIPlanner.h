@@ -0,0 +1,108 @@
+// Copyright (C) 2020 Valentin Galea
+//
+// This program is free software : you can redistribute it and /or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "Def.h"
+#include "PuckSim.h"
+#include "ScoringVolume.h"
+
+//
+// Throw planner for the AI player
+//
+// Candidate moves (placement on the start line + straight, angled or spin throw) are
+// played out in batches with `FPuckBatchSim` against a snapshot of the table and rated
+// with the round scoring rules. The remaining throws of the round are searched with
+// expectimax (our best reply vs. a sampled opponent), iteratively deepened until the wall
+// clock budget runs out; positions reached by different throw orders share a quantized
+// transposition cache. On the last throw the leftover budget refines the best move.
+// Runs on a pool thread (siblings spread on all but a couple of cores, one simulator per
+// worker), the game thread only polls.
+//
+
+struct FAIMove
+{
+	FPuckThrow Throw; // `Start` is the placement
+	bool bSpin = false;
+	float Value = -MAX_FLT; // round points from the player's point of view
+	int Depth = 0; // throws looked ahead (1: just this one)
+	int Evaluated = 0; // candidates played out
+};
+
+/** everything the planner needs, captured on the game thread */
+struct FAIPlanRequest
+{
+	FPuckSimParams Params;
+	FPuckTableLayout Layout;
+	FScoringZones Zones;
+	float PuckZ = 0.f; // pivot height of a resting puck, for the zone tests
+
+	/** pucks resting on the table in throw order */
+	TArray<TPair<FVector2D, EPuckColor>, TInlineAllocator<ERound::TotalThrows>> Pucks;
+	EPuckColor Color = EPuckColor::Red; // the one to play
+
+	FVector2D LineStart = FVector2D::ZeroVector; // allowed placements
+	FVector2D LineEnd = FVector2D::ZeroVector;
+	float ForceMax = 0.f;
+	float SpinVelocityMax = 0.f;
+	float SpinDelay = .1f; // sec after the throw the spin goes in
+
+	/** aimed guesses tried first (e.g. from the throw table) */
+	TArray<FAIMove, TInlineAllocator<8>> Seeds;
+
+	int ThrowsLeft = 1; // in the round, this one included
+
+	// search shape, the budget decides how deep it gets
+	int RootWidth = 32;
+	int SearchWidth = 8; // our candidates at deeper levels
+	int OpponentSamples = 6;
+	int MaxDepth = ERound::TotalThrows;
+
+	float Budget = .5f; // sec (wall clock)
+	int32 Seed = 0;
+
+	/** aims straight at the middle of each zone from a few spots on the line */
+	void AddZoneSeeds(const class FThrowTable&);
+};
+
+
+class FAIPlanner
+{
+public:
+	~FAIPlanner() { Cancel(); }
+
+	/** abandons any plan in progress and starts a new one in the background */
+	void Start(FAIPlanRequest);
+	void Cancel(); // doesn't wait, the worker notices on its own
+
+	bool IsRunning() const { return State.IsValid(); }
+
+	/** never blocks, true (once) when the budget ran out and `out` holds the best move */
+	bool Poll(FAIMove& out);
+
+	/** the actual search, exposed for tools - any thread */
+	static FAIMove Plan(const FAIPlanRequest&, const TAtomic<bool>& cancel);
+
+private:
+	struct FState
+	{
+		TAtomic<bool> bCancel { false };
+		TAtomic<bool> bDone { false };
+		FAIMove Result;
+	};
+	TSharedPtr<FState, ESPMode::ThreadSafe> State;
+};
@@ -0,0 +1,144 @@
+// Copyright (C) 2020 Valentin Galea
+//
+// This program is free software : you can redistribute it and /or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#include "AimPredictor.h"
+
+#include "Async/Async.h"
+#include "Misc/ScopeLock.h"
+
+#include "Shuffl.h"
+
+void FAimPredictor::Begin(UWorld* world, EPuckColor color)
+{
+	Stop();
+
+	Shared = MakeShared<FShared, ESPMode::ThreadSafe>();
+	Shared->Table = ShadowScene::Capture(world);
+	Shared->Table.Geometry.Reset(); // not running PhysX, no need to hold on to the meshes
+	Shared->Color = color;
+	Shown = 0;
+}
+
+void FAimPredictor::Request(const FPuckThrow& t)
+{
+	if (!Shared.IsValid()) return;
+
+	bool start = false;
+	{
+		FScopeLock lock(&Shared->Lock);
+		Shared->Pending = t;
+		Shared->PendingGeneration = NextGeneration++;
+		start = !Shared->bWorking;
+		Shared->bWorking = true;
+	}
+
+	if (start) {
+		FSharedRef shared = Shared.ToSharedRef();
+		Async(EAsyncExecution::ThreadPool, [shared]() { Work(shared); });
+	}
+}
+
+bool FAimPredictor::Poll(FAimPrediction& out)
+{
+	if (!Shared.IsValid()) return false;
+
+	FScopeLock lock(&Shared->Lock);
+	if (Shared->Latest.Generation <= Shown) return false;
+
+	out = Shared->Latest;
+	Shown = out.Generation;
+	return true;
+}
+
+void FAimPredictor::Clear()
+{
+	if (!Shared.IsValid()) return;
+
+	FScopeLock lock(&Shared->Lock);
+	Shared->Pending.Reset();
+	Shown = NextGeneration - 1;
+}
+
+void FAimPredictor::Stop()
+{
+	if (!Shared.IsValid()) return;
+
+	{
+		FScopeLock lock(&Shared->Lock);
+		Shared->bStopped = true;
+		Shared->Pending.Reset();
+	}
+	Shared.Reset(); // the task keeps its own reference
+}
+
+// pool thread, until no request is left
+void FAimPredictor::Work(FSharedRef shared)
+{
+	FPuckBatchSim sim(shared->Table.Params, shared->Table.Layout);
+
+	for (;;) {
+		FPuckThrow t;
+		uint32 generation;
+		{
+			FScopeLock lock(&shared->Lock);
+			if (shared->bStopped || !shared->Pending.IsSet()) {
+				shared->bWorking = false;
+				return;
+			}
+			t = shared->Pending.GetValue();
+			generation = shared->PendingGeneration;
+			shared->Pending.Reset();
+		}
+
+		FAimPrediction result = Predict(*shared, sim, t);
+		result.Generation = generation;
+
+		FScopeLock lock(&shared->Lock);
+		if (generation > shared->Latest.Generation) {
+			shared->Latest = result;
+		}
+	}
+}
+
+FAimPrediction FAimPredictor::Predict(const FShared& shared, FPuckBatchSim& sim, const FPuckThrow& t)
+{
+	const FShadowTable& table = shared.Table;
+	const int thrownSlot = FMath::Min(table.Pucks.Num(), FPuckBatchSim::MaxPucks - 1);
+
+	sim.Reset(1);
+	for (int slot = 0; slot < thrownSlot; ++slot) {
+		sim.SetPuck(0, slot, FVector2D(table.Pucks[slot].Transform.GetLocation()));
+	}
+	sim.Throw(0, thrownSlot, t);
+	sim.Run();
+
+	FAimPrediction out;
+	out.bOnTable = sim.IsAlive(0, thrownSlot);
+	out.Position = FVector(sim.GetPosition(0, thrownSlot), table.PuckZ);
+	out.Points = out.bOnTable ? table.Zones.GetPoints(out.Position) : 0;
+
+	// the round scoring, closest to the edge first
+	TArray<TPair<FVector2D, EPuckColor>, TInlineAllocator<ERound::TotalThrows>> ranked;
+	for (int slot = 0; slot <= thrownSlot; ++slot) {
+		if (!sim.IsAlive(0, slot)) continue;
+		ranked.Emplace(sim.GetPosition(0, slot), slot == thrownSlot ? shared.Color : table.Pucks[slot].Color);
+	}
+	ranked.Sort([](const auto& a, const auto& b) { return a.Key.X > b.Key.X; });
+	for (const auto& p : ranked) {
+		if (!out.Round.Add(p.Value, table.Zones.GetPoints(FVector(p.Key, table.PuckZ)))) break;
+	}
+
+	return out;
+}
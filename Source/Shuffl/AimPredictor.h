@@ -0,0 +1,88 @@
+// Copyright (C) 2020 Valentin Galea
+//
+// This program is free software : you can redistribute it and /or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/CriticalSection.h"
+#include "Misc/Optional.h"
+
+#include "Def.h"
+#include "PuckSim.h"
+#include "ShadowScene.h"
+
+//
+// Where the puck would end up if released now, kept up to date while aiming
+//
+// The table is captured once when aiming starts, every touch move then asks for the
+// current throw. A single pool task works through the requests: whatever was asked
+// while it was busy is coalesced into the newest one (stale throws are never simulated)
+// and results are generation stamped so the game thread only ever shows the latest.
+// A prediction is one `FPuckBatchSim` run against the resting pucks, tens of µs.
+//
+
+struct FAimPrediction
+{
+	FVector Position = FVector::ZeroVector; // where the ghost goes
+	bool bOnTable = false; // false if it falls off or gets removed
+	int Points = 0; // of the zone it stops in
+	FRoundScore Round; // standings with it there (other pucks knocked around included)
+	uint32 Generation = 0;
+};
+
+class FAimPredictor
+{
+public:
+	~FAimPredictor() { Stop(); }
+
+	/** snapshot of the table to aim at - game thread */
+	void Begin(class UWorld*, EPuckColor);
+
+	/** replaces any request not started yet */
+	void Request(const FPuckThrow&);
+
+	/** true if a result newer than the last one returned is in, never blocks */
+	bool Poll(FAimPrediction& out);
+
+	/** results of the requests so far won't be returned anymore (e.g. gesture became invalid) */
+	void Clear();
+
+	/** drops the pending request, a running one finishes on its own and is ignored */
+	void Stop();
+
+	bool IsActive() const { return Shared.IsValid(); }
+
+private:
+	struct FShared
+	{
+		FShadowTable Table;
+		EPuckColor Color = EPuckColor::Red;
+
+		FCriticalSection Lock;
+		TOptional<FPuckThrow> Pending;
+		uint32 PendingGeneration = 0;
+		bool bWorking = false;
+		bool bStopped = false;
+		FAimPrediction Latest;
+	};
+	using FSharedRef = TSharedRef<FShared, ESPMode::ThreadSafe>;
+
+	static void Work(FSharedRef);
+	static FAimPrediction Predict(const FShared&, FPuckBatchSim&, const FPuckThrow&);
+
+	TSharedPtr<FShared, ESPMode::ThreadSafe> Shared;
+	uint32 NextGeneration = 1;
+	uint32 Shown = 0;
+};
@@ -0,0 +1,218 @@
+// Copyright (C) 2020 Valentin Galea
+//
+// This program is free software : you can redistribute it and /or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#include "ChatCommand.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/MemoryBase.h"
+#include "HAL/PlatformTime.h"
+#include "HAL/PlatformTLS.h"
+
+#include "Shuffl.h"
+#include "XMPP.h"
+#include "XMPPMessage.h"
+#include "XMPPReliable.h"
+
+const FChatToken FChatTokens::Empty;
+
+bool FChatToken::Equals(const TCHAR* literal) const
+{
+	for (int32 i = 0; i < Len; ++i) {
+		if (literal[i] != Data[i]) return false; // also stops at the literal's end
+	}
+	return literal[Len] == 0;
+}
+
+FChatTokens::FChatTokens(const FString& msg)
+{
+	const TCHAR* c = *msg;
+	while (*c) {
+		while (FChar::IsWhitespace(*c)) ++c;
+		if (!*c) break;
+
+		const TCHAR* start = c;
+		while (*c && !FChar::IsWhitespace(*c)) ++c;
+
+		if (NumTokens == MaxTokens) {
+			bOverflow = true;
+			break;
+		}
+		Tokens[NumTokens++] = { start, int32(c - start) };
+	}
+}
+
+bool FChatTokens::Int(int i, int32& out) const
+{
+	const FChatToken& t = (*this)[i];
+	int32 pos = 0;
+	const bool negative = t.Len > 1 && t.Data[0] == '-';
+	pos += negative;
+	if (pos == t.Len || t.Len > 11) return false; // sign and 10 digits at most
+
+	int64 value = 0;
+	for (; pos < t.Len; ++pos) {
+		if (!FChar::IsDigit(t.Data[pos])) return false;
+		value = value * 10 + (t.Data[pos] - '0');
+	}
+	value = negative ? -value : value;
+	if (value < MIN_int32 || value > MAX_int32) return false;
+
+	out = int32(value);
+	return true;
+}
+
+#if !UE_BUILD_SHIPPING
+
+// forwards to the real allocator, counting what the benchmark thread asks for
+class FCountingMalloc final : public FMalloc
+{
+public:
+	FMalloc* Inner = nullptr;
+	uint32 ThreadId = 0;
+	int64 Allocs = 0;
+
+	virtual void* Malloc(SIZE_T size, uint32 alignment) override
+	{
+		Count();
+		return Inner->Malloc(size, alignment);
+	}
+	virtual void* Realloc(void* ptr, SIZE_T size, uint32 alignment) override
+	{
+		Count();
+		return Inner->Realloc(ptr, size, alignment);
+	}
+	virtual void Free(void* ptr) override { Inner->Free(ptr); }
+	virtual SIZE_T QuantizeSize(SIZE_T size, uint32 alignment) override { return Inner->QuantizeSize(size, alignment); }
+	virtual bool GetAllocationSize(void* ptr, SIZE_T& size) override { return Inner->GetAllocationSize(ptr, size); }
+	virtual void Trim(bool trimThreadCaches) override { Inner->Trim(trimThreadCaches); }
+	virtual void SetupTLSCachesOnCurrentThread() override { Inner->SetupTLSCachesOnCurrentThread(); }
+	virtual void ClearAndDisableTLSCachesOnCurrentThread() override { Inner->ClearAndDisableTLSCachesOnCurrentThread(); }
+	virtual bool IsInternallyThreadSafe() const override { return Inner->IsInternallyThreadSafe(); }
+	virtual bool ValidateHeap() override { return Inner->ValidateHeap(); }
+	virtual const TCHAR* GetDescriptiveName() override { return Inner->GetDescriptiveName(); }
+
+private:
+	void Count()
+	{
+		if (FPlatformTLS::GetCurrentThreadId() == ThreadId) {
+			Allocs++;
+		}
+	}
+};
+
+struct FChatBenchResult
+{
+	double Seconds = 0.;
+	int64 Allocs = 0;
+	int32 Check = 0; // so nothing gets optimized out
+};
+
+template<class F>
+static FChatBenchResult MeasureChat(const TArray<FString>& corpus, int iterations, F&& parse)
+{
+	// other threads keep going through it after it's swapped back, so it's never freed
+	static FCountingMalloc* counting = new FCountingMalloc();
+
+	FChatBenchResult result;
+	counting->Inner = GMalloc;
+	counting->ThreadId = FPlatformTLS::GetCurrentThreadId();
+	counting->Allocs = 0;
+	GMalloc = counting;
+
+	const double start = FPlatformTime::Seconds();
+	for (int i = 0; i < iterations; ++i) {
+		for (const FString& msg : corpus) {
+			result.Check += parse(msg);
+		}
+	}
+	result.Seconds = FPlatformTime::Seconds() - start;
+
+	GMalloc = counting->Inner;
+	result.Allocs = counting->Allocs;
+	return result;
+}
+
+static void RunChatBench(const TArray<FString>& params)
+{
+	const int iterations = params.Num() ? FMath::Max(FCString::Atoi(*params[0]), 1) : 20000;
+
+	// what a match sends: the text and plain binary commands, the same framed as protocol 5
+	// and 6 send them (in sequence), the handshake and the score
+	TArray<FString> corpus;
+	FXMPPReliableChannel sender;
+	FXMPPMessage msg;
+	auto AddAll = [&]() {
+		corpus.Add(msg.Encode(XMPPWire::Text));
+		corpus.Add(msg.Encode(XMPPWire::Binary));
+		corpus.Add(sender.Wrap(msg.Encode(XMPPWire::Reliable), 0., XMPPWire::Reliable));
+		corpus.Add(sender.Wrap(msg.Encode(XMPPWire::Compact), 0., XMPPWire::Compact));
+	};
+	msg.TurnId = 5;
+	msg.Type = EXMPPMsg::NextTurn;
+	AddAll();
+	msg.Type = EXMPPMsg::Move;
+	msg.Move.Location = FVector(-120.5f, 3.25f, 80.f);
+	msg.Move.Position = FIntPoint(0, 208);
+	AddAll();
+	msg.Type = EXMPPMsg::Throw;
+	msg.Throw.Force = FVector2D(95.f, -2.5f);
+	AddAll();
+	msg.Type = EXMPPMsg::Sync;
+	for (int i = 0; i < FXMPPSync::MaxPucks; ++i) {
+		msg.Sync.Pucks.Add({ i, FVector(100.f + i * 7.5f, -10.f + i, 80.f) });
+	}
+	AddAll();
+	msg.Type = EXMPPMsg::ScoreSync;
+	msg.ScoreSync.Winner = EPuckColor::Blue;
+	msg.ScoreSync.Points = 3;
+	AddAll();
+	corpus.Add(FString::Printf(TEXT("%s %i"), ChatCmd::Protocol, XMPPWire::Latest));
+
+	// what the receivers did before: split into strings then Atoi the arguments
+	const auto before = MeasureChat(corpus, iterations, [](const FString& body) {
+		TArray<FString> args;
+		body.ParseIntoArrayWS(args);
+		int32 sum = 0;
+		for (int i = 1; i < args.Num(); ++i) {
+			sum += FCString::Atoi(*args[i]);
+		}
+		return sum;
+	});
+
+	// the real receiving end on a service of its own (not logged in, nothing listens), the
+	// frames are taken in again every pass
+	FShufflXMPPService service;
+	int received = 0;
+	const auto after = MeasureChat(corpus, iterations, [&](const FString& body) {
+		if (received++ % corpus.Num() == 0) {
+			service.Channel.Reset();
+		}
+		service.ReceiveChat(body);
+		return 1;
+	});
+
+	const double messages = double(corpus.Num()) * iterations;
+	ShufflLog(TEXT("chat receive, %i messages x %i: ParseIntoArrayWS %.0f msg/s %.2f allocs/msg | ReceiveChat %.0f msg/s %.2f allocs/msg"),
+		corpus.Num(), iterations,
+		messages / before.Seconds, before.Allocs / messages,
+		messages / after.Seconds, after.Allocs / messages);
+	UE_LOG(LogShuffl, Verbose, TEXT("checks %i %i"), before.Check, after.Check);
+}
+
+static FAutoConsoleCommand ChatBenchCommand(
+	TEXT("Shuffl.ChatBench"),
+	TEXT("Chat receiving: messages per second and heap allocations per message. Optional: iterations"),
+	FConsoleCommandWithArgsDelegate::CreateStatic(&RunChatBench));
+
+#endif // !UE_BUILD_SHIPPING
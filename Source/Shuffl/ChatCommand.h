@@ -0,0 +1,97 @@
+// Copyright (C) 2020 Valentin Galea
+//
+// This program is free software : you can redistribute it and /or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+//
+// Allocation free parsing of the XMPP chat commands
+//
+// `FChatTokens` splits a message on whitespace into views of the original string (which
+// has to outlive it) so nothing gets copied, and every access is bounds checked: a missing
+// argument is an empty token and `Int` fails on anything that isn't a whole int32.
+// Commands are looked up in static `TChatCommand` tables that also carry the accepted
+// number of arguments, so handlers only deal with well formed input.
+//
+// `Shuffl.ChatBench [iterations]` (console, not in shipping) measures messages per second
+// and heap allocations per message through `FShufflXMPPService::ReceiveChat` (handshake,
+// text, binary and framed commands) against `FString::ParseIntoArrayWS`.
+//
+
+struct FChatToken
+{
+	const TCHAR* Data = nullptr; // not null terminated
+	int32 Len = 0;
+
+	bool Equals(const TCHAR* literal) const;
+	bool IsEmpty() const { return Len == 0; }
+};
+
+class FChatTokens
+{
+public:
+	static constexpr int MaxTokens = 34; // a full text `/sync`: command, count, 4 per puck
+
+	explicit FChatTokens(const FString&);
+
+	int Num() const { return NumTokens; }
+
+	/** more tokens than `MaxTokens`, the message is garbage */
+	bool IsOverflow() const { return bOverflow; }
+
+	const FChatToken& operator[](int i) const { return i >= 0 && i < NumTokens ? Tokens[i] : Empty; }
+
+	/** false if missing or not a decimal int32 */
+	bool Int(int i, int32& out) const;
+
+private:
+	static const FChatToken Empty;
+
+	FChatToken Tokens[MaxTokens];
+	int NumTokens = 0;
+	bool bOverflow = false;
+};
+
+enum class EChatDispatch : uint8
+{
+	Unknown, // not in the table
+	Handled,
+	Malformed // wrong argument count or the handler rejected them
+};
+
+template<class T>
+struct TChatCommand
+{
+	const TCHAR* Name;
+	int MinArgs; // after the command itself
+	int MaxArgs;
+	bool (T::*Handler)(const FChatTokens&); // false if the arguments don't make sense
+};
+
+template<class T, int N>
+EChatDispatch DispatchChat(T& target, const TChatCommand<T> (&table)[N], const FChatTokens& args)
+{
+	if (!args.Num()) return EChatDispatch::Unknown;
+
+	for (const TChatCommand<T>& cmd : table) {
+		if (!args[0].Equals(cmd.Name)) continue;
+
+		const int num = args.Num() - 1;
+		if (args.IsOverflow() || num < cmd.MinArgs || num > cmd.MaxArgs) return EChatDispatch::Malformed;
+		return (target.*cmd.Handler)(args) ? EChatDispatch::Handled : EChatDispatch::Malformed;
+	}
+	return EChatDispatch::Unknown;
+}
@@ -0,0 +1,75 @@
+// Copyright (C) 2020 Valentin Galea
+//
+// This program is free software : you can redistribute it and /or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#include "Commandlets.h"
+
+#include "EngineUtils.h"
+#include "Engine/World.h"
+#include "UObject/Package.h"
+
+#include "Shuffl.h"
+#include "PlayerCtrl.h"
+#include "SceneProps.h"
+
+UWorld* ShufflCommandlet::LoadTable(const FString& mapName, APuck*& outPuck, FVector& outStartingPoint)
+{
+	outPuck = nullptr;
+
+	UPackage* package = LoadPackage(nullptr, *mapName, LOAD_None);
+	UWorld* world = package ? UWorld::FindWorldInPackage(package) : nullptr;
+	if (!world) {
+		UE_LOG(LogShuffl, Error, TEXT("can't load map %s"), *mapName);
+		return nullptr;
+	}
+	world->WorldType = EWorldType::Editor;
+	world->AddToRoot();
+	if (!world->bIsWorldInitialized) {
+		world->InitWorld(UWorld::InitializationValues()
+			.InitializeScenes(false)
+			.AllowAudioPlayback(false)
+			.RequiresHitProxies(false)
+			.CreatePhysicsScene(true) // for the puck's mass
+			.CreateNavigation(false)
+			.CreateAISystem(false)
+			.ShouldSimulatePhysics(false)
+			.SetTransactional(false)
+			.CreateFXSystem(false));
+	}
+	world->UpdateWorldComponents(true, false);
+
+	auto props = TActorIterator<ASceneProps>(world);
+	const auto* ctrl = GetDefault<APlayerCtrl>();
+	if (!*props || !props->StartingPoint || !ctrl->PawnClass) {
+		UE_LOG(LogShuffl, Error, TEXT("%s has no scene props or starting point"), *mapName);
+		UnloadTable(world);
+		return nullptr;
+	}
+	outStartingPoint = props->StartingPoint->GetActorLocation();
+	outPuck = world->SpawnActor<APuck>(ctrl->PawnClass, outStartingPoint, FRotator::ZeroRotator);
+	if (!outPuck) {
+		UE_LOG(LogShuffl, Error, TEXT("can't spawn %s"), *ctrl->PawnClass->GetName());
+		UnloadTable(world);
+		return nullptr;
+	}
+
+	return world;
+}
+
+void ShufflCommandlet::UnloadTable(UWorld* world)
+{
+	if (!world) return;
+	world->DestroyWorld(false);
+	world->RemoveFromRoot();
+}
@@ -0,0 +1,149 @@
+// Copyright (C) 2020 Valentin Galea
+//
+// This program is free software : you can redistribute it and /or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+
+#include "Commandlets.generated.h"
+
+namespace ShufflCommandlet
+{
+	/** loads a level with the table and spawns a puck on its starting point (for its physics) */
+	class UWorld* LoadTable(const FString& mapName, class APuck*& outPuck, FVector& outStartingPoint);
+	void UnloadTable(class UWorld*);
+}
+
+//
+// Headless AI vs AI matches for balancing, e.g.
+//   UE4Editor-Cmd Shuffl -run=Tournament -Entrants=search:0,search:.05,policy:0:/Game/AI/Policy.Policy -Matches=200
+//
+// Each entrant is `search:<budget>` or `policy:<budget>:<asset>` (the budget is only used
+// if the search has to stand in for the policy), every ordered pair plays `-Matches` full
+// matches to `ERound::WinningScore` (so each side plays both colors). The table is taken
+// from `-Map` once; the matches themselves don't need a world: throws are resolved with
+// `FPuckBatchSim` and scored with the game rules, so nothing waits on timers or on the
+// pucks' rest thresholds. Matches run in parallel on all cores.
+//
+// `-Noise` is the execution error (fraction of the force and of the line) added to every
+// throw, without it the same pairing replays the same match. Search budgets are wall clock
+// and the cores are shared, so keep them small or use `-Threads` to leave room.
+// `-Dataset[=dir]` records every throw, see `FThrowDatasetWriter`.
+//
+UCLASS()
+class UTournamentCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UTournamentCommandlet();
+
+	virtual int32 Main(const FString& params) override;
+};
+
+UENUM()
+enum class EThrowGesture : uint8
+{
+	Flick, // magnitude: finger velocity in pixels per sec
+	Slingshot // magnitude: pull back distance in cm
+};
+
+/** a straight throw of this strength should stop in the middle of a zone worth `Points` */
+USTRUCT()
+struct FThrowTuningTarget
+{
+	GENERATED_BODY()
+
+	UPROPERTY(Config)
+	EThrowGesture Gesture = EThrowGesture::Flick;
+
+	UPROPERTY(Config)
+	float Magnitude = 0.f;
+
+	UPROPERTY(Config)
+	int Points = 1;
+};
+
+//
+// Fits the throw tuning of `APlayerCtrl` (and the puck friction) to target outcomes, e.g.
+//   UE4Editor-Cmd Shuffl -run=ThrowTuning -Output=Saved/Tuning/ThrowTuning.ini
+//
+// Besides the `Targets` (a flick or slingshot of a given strength lands in a given zone):
+// - the strongest throw (`ThrowForceMax`) stops right at the end of the table
+// - the weakest flick that counts (`EscapeVelocity`) reaches the scoring area
+// - a `SlideTime` flick takes that long to stop, which is what pins down the friction
+//   (otherwise force and friction just trade off against each other)
+//
+// Candidates are swept in parallel, each one resolving every target throw with
+// `PuckSim::PredictRest`, the search box then shrinks around the best one. The fitted
+// values go to an ini fragment to paste into DefaultGame.ini; `-SaveMaterial` writes the
+// friction into the puck's physical material too. The report includes where a population
+// of flicks and slingshots (log-normal strengths around the median) ends up.
+//
+UCLASS(Config = Game)
+class UThrowTuningCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	UThrowTuningCommandlet();
+
+	UPROPERTY(Config)
+	TArray<FThrowTuningTarget> Targets;
+
+	/** sec for the median flick to come to rest */
+	UPROPERTY(Config)
+	float SlideTime = 2.5f;
+
+	/** typical gestures, for the outcome report */
+	UPROPERTY(Config)
+	float FlickMedian = 2000.f;
+
+	UPROPERTY(Config)
+	float SlingshotMedian = 10.f;
+
+	UPROPERTY(Config)
+	float GestureSpread = .35f; // sigma of the log-normal strength
+
+	/** cm, error scale of the table end and escape rules (targets use their zone's half length) */
+	UPROPERTY(Config)
+	float Tolerance = 10.f;
+
+	/** random candidates in the first sweep, each refinement round then uses a quarter */
+	UPROPERTY(Config)
+	int Candidates = 8192;
+
+	UPROPERTY(Config)
+	int RefineRounds = 12;
+
+	virtual int32 Main(const FString& params) override;
+};
+
+//
+// Loads trained weights into a policy asset for the `Policy` AI brain and saves it, e.g.
+//   UE4Editor-Cmd Shuffl -run=ThrowPolicyImport -Input=policy.bin -Asset=/Game/AI/Policy.Policy
+//
+// The file format is described in ThrowPolicy.h. The asset is created if it doesn't
+// exist; an existing one keeps its network if the file doesn't make a valid one.
+//
+UCLASS()
+class UThrowPolicyImportCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	virtual int32 Main(const FString& params) override;
+};
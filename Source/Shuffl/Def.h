@@ -48,6 +48,13 @@ enum class EPlayerCtrlMode : uint8
 	Observe
 };
 
+UENUM(BlueprintType)
+enum class EAIBrain : uint8
+{
+	Search, // expectimax over simulated throws
+	Policy // trained network, see `FThrowPolicy`
+};
+
 namespace ERound
 {
 	static constexpr int PucksPerPlayer = 4;
@@ -16,17 +16,15 @@
 #include "GameModes.h"
 
 #include "EngineMinimal.h"
-#include "EngineUtils.h"
 #include "Engine/Player.h"
 #include "Math/UnrealMathUtility.h"
 #include "Net/UnrealNetwork.h"
 #include "Kismet/GameplayStatics.h"
-#include "Algo/Sort.h"
 
 #include "Shuffl.h"
 #include "Puck.h"
+#include "PuckManager.h"
 #include "PlayerCtrl.h"
-#include "ScoringVolume.h"
 #include "GameSubSys.h"
 #include "XMPP.h"
 
@@ -54,15 +52,46 @@ void AShufflGameState::GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& Out
 	DOREPLIFETIME(AShufflGameState, GlobalTurnCounter);
 }
 
+void AShufflCommonGameMode::InitGameState()
+{
+	Super::InitGameState();
+
+	FActorSpawnParameters params;
+	params.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+	auto* manager = GetWorld()->SpawnActor<APuckManager>(params);
+	manager->OnPucksRested.AddUObject(this, &AShufflCommonGameMode::OnPucksRested);
+	GetGameState<AShufflGameState>()->PuckManager = manager;
+}
+
+void AShufflCommonGameMode::HandleMatchHasStarted()
+{
+	Super::HandleMatchHasStarted();
+
+	// all the pucks of a round up front, so no spawning hitches while playing
+	const auto* ctrl = GetDefault<APlayerCtrl>();
+	APuckManager::Get(this)->Prewarm(ctrl->PawnClass, 2 * ERound::PucksPerPlayer);
+}
+
+void AShufflCommonGameMode::OnPucksRested(int turnId)
+{
+	// abort if next turn already happened
+	auto* gameState = GetGameState<AShufflGameState>();
+	if (turnId < gameState->GlobalTurnCounter) return;
+	// abort if we're showing the end of round results - next one needs to be manual
+	if (GetMatchState() == MatchState::Round_End ||
+		GetMatchState() == MatchState::Round_WinnerDeclared) return;
+
+	// otherwise force next turn/throw
+	NextTurn();
+}
+
 void AShufflCommonGameMode::SetupRound()
 {
-	// clean prev pucks when restarting round
-	TArray<APuck*, TInlineAllocator<32>> pucks;
-	for (auto i = TActorIterator<APuck>(GetWorld()); i; ++i) {
-		pucks.Add(*i);
-	}
+	// clean prev pucks when restarting round (back to the pool)
+	auto* manager = APuckManager::Get(this);
+	TArray<APuck*, TInlineAllocator<ERound::TotalThrows>> pucks(manager->GetPucks());
 	for (auto* i : pucks) {
-		GetWorld()->DestroyActor(i);
+		manager->Release(i);
 	}
 
 	// reset scores after a winning round
@@ -81,54 +110,14 @@ void AShufflCommonGameMode::SetupRound()
 
 void AShufflCommonGameMode::CalculateRoundScore(EPuckColor &winnerColor, int &totalScore)
 {
-	// get a list of the scoring areas
-	TArray<AScoringVolume*, TInlineAllocator<4>> volumes;
-	for (auto i = TActorIterator<AScoringVolume>(GetWorld()); i; ++i) {
-		volumes.Add(*i);
-	}
-
-	// get the pucks and sort them by closest to edge (by furthest X position)
-	TArray<APuck*, TInlineAllocator<32>> pucks;
-	for (auto i = TActorIterator<APuck>(GetWorld()); i; ++i) {
-		pucks.Add(*i);
-	}
-	Algo::Sort(pucks, [](APuck* p1, APuck* p2) {
-		return p1->GetActorLocation().X > p2->GetActorLocation().X;
-	});
-
-	auto GetPointsForPuck = [&volumes](APuck* p) {
-		for (AScoringVolume* vol : volumes) {
-			FBox scoreVol = vol->GetBounds().GetBox();
-			if (scoreVol.IsInside(p->GetActorLocation())) {
-				return vol->PointsAwarded;
-			}
-		}
-		return int(0);
-	};
-
-	// iterate on pucks and get their score
-	totalScore = 0;
-	bool foundWinner = false;
-	winnerColor = EPuckColor::Red; // choose a default, BP will handle it properly
-	for (APuck* p : pucks) {
-		int score = GetPointsForPuck(p);
-
-		if (score > 0 && !foundWinner) {
-			foundWinner = true;
-			winnerColor = p->Color;
-			totalScore = score;
-			continue;
-		}
-
-		// only count the color of the winner if unobstructed by the other color pucks 
-		if (score > 0 && foundWinner) {
-			if (p->Color == winnerColor) {
-				totalScore += score;
-			} else {
-				break;
-			}
-		}
+	// kept up to date by the manager as pucks come to rest
+	auto* manager = APuckManager::Get(this);
+	if (manager->HasPucksInPlay()) {
+		manager->RankAll(); // turn got skipped before everything settled
 	}
+	const FRoundScore& score = manager->GetRoundScore();
+	winnerColor = score.Winner;
+	totalScore = score.Points;
 }
 
 void AShufflPracticeGameMode::HandleMatchHasStarted()
@@ -221,6 +210,7 @@ void AShuffl2PlayersGameMode::NextTurn()
 		EPuckColor winner_color;
 		int round_score;
 		CalculateRoundScore(winner_color, round_score);
+		APuckManager::Get(this)->EndRound();
 		AShufflPlayerState* winner_player = winner_color == curr_player_state->Color ?
 			curr_player_state : next_player_state;
 		winner_player->SetScore(winner_player->GetScore() + round_score);
@@ -304,7 +294,7 @@ void AShufflXMPPGameMode::HandleMatchIsWaitingToStart()
 
 	auto sys = UGameSubSys::Get(this);
 	make_sure(sys);
-	sys->OnXMPPChatReceived.AddUObject(this, &AShufflXMPPGameMode::OnReceiveChat);
+	sys->XMPP.OnScoreSync.AddUObject(this, &AShufflXMPPGameMode::ReceiveScoreSync);
 }
 
 void AShufflXMPPGameMode::NextTurn()
@@ -319,9 +309,12 @@ void AShufflXMPPGameMode::NextTurn()
 			CalculateRoundScore(winner_color, round_score);
 
 			SyncPuck(-1); // send across all puck positions
-			auto sys = UGameSubSys::Get(this);
-			sys->XMPP.SendChat(FString::Printf(TEXT("/score-sync %s %i"), 
-				PuckColorToString(winner_color), round_score));
+			FXMPPMessage msg;
+			msg.Type = EXMPPMsg::ScoreSync;
+			msg.TurnId = GetGameState<AShufflGameState>()->GlobalTurnCounter;
+			msg.ScoreSync.Winner = winner_color;
+			msg.ScoreSync.Points = round_score;
+			UGameSubSys::Get(this)->XMPP.SendMessage(msg);
 		}
 	} else {
 		if (GetMatchState() == MatchState::Round_XMPPSync) {
@@ -342,38 +335,34 @@ void AShufflXMPPGameMode::NextTurn()
 	}
 }
 
-void AShufflXMPPGameMode::OnReceiveChat(FString msg)
+void AShufflXMPPGameMode::ReceiveScoreSync(int /*turnId*/, const FXMPPScoreSync& score)
 {
-	if (msg.Contains("/score-sync")) {
-		if (UGameplayStatics::HasOption(OptionsString, XMPPGameMode::Option_Invitee)) {
-			ensure(GetMatchState() == MatchState::Round_XMPPSync);
-
-			TArray<FString> args;
-			msg.ParseIntoArrayWS(args);
-			EPuckColor winner_color = StringToPuckColor(*args[1]);
-			int round_score = FCString::Atoi(*args[2]);
-
-			AShufflPlayerState* winner_player = nullptr;
-			for (auto* i : PlayOrder) {
-				auto* ps = i->GetPlayerState<AShufflPlayerState>();
-				if (ps->Color == winner_color) {
-					winner_player = ps;
-				}
-				ps->PucksToPlay = ERound::PucksPerPlayer;
-			}
-
-			winner_player->SetScore(winner_player->GetScore() + round_score);
-			if (winner_player->GetScore() >= UGameSubSys::ShufflGetWinningScore()) {
-				SetMatchState(MatchState::Round_WinnerDeclared);
-			}
-			else {
-				SetMatchState(MatchState::Round_End);
-			}
-
-			auto* pc = Cast<APlayerCtrl>(RealPlayer->PlayerController);
-			pc->HandleScoreCounting(winner_color, winner_player->GetScore(), round_score);
+	if (!UGameplayStatics::HasOption(OptionsString, XMPPGameMode::Option_Invitee)) return;
+	ensure(GetMatchState() == MatchState::Round_XMPPSync);
+
+	const EPuckColor winner_color = score.Winner;
+	const int round_score = score.Points;
+
+	AShufflPlayerState* winner_player = nullptr;
+	for (auto* i : PlayOrder) {
+		auto* ps = i->GetPlayerState<AShufflPlayerState>();
+		if (ps->Color == winner_color) {
+			winner_player = ps;
 		}
+		ps->PucksToPlay = ERound::PucksPerPlayer;
+	}
+
+	winner_player->SetScore(winner_player->GetScore() + round_score);
+	APuckManager::Get(this)->EndRound(); // the pucks got synced just before
+	if (winner_player->GetScore() >= UGameSubSys::ShufflGetWinningScore()) {
+		SetMatchState(MatchState::Round_WinnerDeclared);
+	}
+	else {
+		SetMatchState(MatchState::Round_End);
 	}
+
+	auto* pc = Cast<APlayerCtrl>(RealPlayer->PlayerController);
+	pc->HandleScoreCounting(winner_color, winner_player->GetScore(), round_score);
 }
 
 void AShufflXMPPGameMode::SyncPuck(int turnId)
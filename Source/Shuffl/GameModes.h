@@ -64,6 +64,9 @@ public:
 	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = Shuffl)
 	int ActiveLocalPlayerCtrlIndex = 0;
 
+	UPROPERTY(Transient)
+	class APuckManager* PuckManager = nullptr;
+
 	virtual void GetLifetimeReplicatedProps(TArray<FLifetimeProperty> &) const override;
 };
 
@@ -76,10 +79,14 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Shuffl)
 	bool AutoTurnStart = true;
 
+	virtual void InitGameState() override;
+	virtual void HandleMatchHasStarted() override;
+
 	void SetupRound();
 	void CalculateRoundScore(EPuckColor &, int &);
 
 	virtual void NextTurn() { /*interface*/ }
+	void OnPucksRested(int turnId);
 
 	class APlayerController* PlayOrder[2] = { nullptr, nullptr };
 	class UPlayer* RealPlayer = nullptr;
@@ -126,6 +133,6 @@ public:
 	virtual void HandleMatchIsWaitingToStart() override;
 	virtual void NextTurn() override;
 	
-	void OnReceiveChat(FString);
+	void ReceiveScoreSync(int turnId, const struct FXMPPScoreSync&);
 	void SyncPuck(int turnId);
 };
@@ -17,10 +17,12 @@
 #include "Engine/Engine.h"
 #include "Engine/GameInstance.h"
 #include "Misc/ConfigCacheIni.h"
+#include "Misc/CommandLine.h"
 #include "CoreGlobals.h"
 
 #include "Shuffl.h"
 #include "GameModes.h"
+#include "ThrowDataset.h"
 
 UGameSubSys* UGameSubSys::Get(const UObject* ContextObject)
 {
@@ -83,11 +85,20 @@ FString UGameSubSys::ShufflGenerateFriendCode()
 void UGameSubSys::Initialize(FSubsystemCollectionBase& Collection)
 {
 	ShufflLog(TEXT("%s"), *FPlatformMisc::GetDeviceId());
+
+	// opt in: -ThrowDataset or -ThrowDataset=<dir>
+	FString datasetDir;
+	if (FParse::Value(FCommandLine::Get(), TEXT("ThrowDataset="), datasetDir)) {
+		ThrowDataset = MakeShared<FThrowDatasetWriter>(datasetDir);
+	} else if (FParse::Param(FCommandLine::Get(), TEXT("ThrowDataset"))) {
+		ThrowDataset = MakeShared<FThrowDatasetWriter>(FThrowDatasetWriter::DefaultDirectory());
+	}
 }
 
 void UGameSubSys::Deinitialize()
 {
 	XMPP.Logout();
+	ThrowDataset.Reset(); // flushes
 }
 
 EXMPPState UGameSubSys::XMPPGetState(const UObject* context)
@@ -29,9 +29,10 @@ DECLARE_DYNAMIC_MULTICAST_DELEGATE_ThreeParams(FEvent_ScoreChanged,
 							int, WinnerRoundScore);
 DECLARE_DYNAMIC_MULTICAST_DELEGATE_OneParam(FEvent_PlayersChangeTurn,
 							EPuckColor, NewColor);
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_TwoParams(FEvent_ProvisionalScoreChanged,
+							EPuckColor, LeaderColor,
+							int, LeaderRoundScore);
 
-DECLARE_MULTICAST_DELEGATE_OneParam(FEvent_XMPPChatReceived,
-							FString);
 DECLARE_DYNAMIC_MULTICAST_DELEGATE_OneParam(FEvent_XMPPStateChange,
 							EXMPPState, NewState);
 
@@ -60,6 +61,10 @@ public:
 	UPROPERTY(BlueprintAssignable)
 	FEvent_PlayersChangeTurn PlayersChangeTurn;
 
+	/** live standings of the current round, fires whenever a rest changes them */
+	UPROPERTY(BlueprintAssignable)
+	FEvent_ProvisionalScoreChanged ProvisionalScoreChanged;
+
 	UFUNCTION(BlueprintPure, meta = (WorldContext = "WorldContextObject", UnsafeDuringActorConstruction = "true"))
 	static class APlayerController* ShufflGetActivePlayerCtrl(const UObject* WorldContextObject);
 
@@ -72,6 +77,9 @@ public:
 	UFUNCTION(BlueprintPure)
 	static FString ShufflGenerateFriendCode();
 
+	/** recording of every throw, only when enabled on the command line */
+	TSharedPtr<class FThrowDatasetWriter> ThrowDataset;
+
 //
 // XMPP multiplayer chat
 //
@@ -91,9 +99,7 @@ public:
 	static void XMPPStartGame(const UObject* WorldContextObject);
 
 	UPROPERTY()
-	FShufflXMPPService XMPP;
-
-	FEvent_XMPPChatReceived OnXMPPChatReceived;
+	FShufflXMPPService XMPP; // game commands are received through its events
 
 	UPROPERTY(BlueprintAssignable)
 	FEvent_XMPPStateChange OnXMPPStateChange;
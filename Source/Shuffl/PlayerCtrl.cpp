@@ -31,6 +31,9 @@
 #include "GameModes.h"
 #include "ScoringVolume.h"
 #include "SceneProps.h"
+#include "PuckManager.h"
+#include "ThrowTable.h"
+#include "ThrowPolicy.h"
 #include "UI.h"
 
 //#define PRINT_THROW
@@ -98,21 +101,11 @@ void APlayerCtrl::HandleNewThrow()
 			GetComponentByClass(UArrowComponent::StaticClass()))->GetComponentLocation();
 	}
 	const FVector location = StartingPoint;
-	APuck* new_puck = static_cast<APuck*>(GetWorld()->SpawnActor(PawnClass, &location));
-	if (!new_puck) { // if null most probably there is a previous one in the way
-		TArray<APuck*, TInlineAllocator<32>> pucks;
-		for (auto i = TActorIterator<APuck>(GetWorld()); i; ++i) {
-			pucks.Add(*i);
-		}
-		FBox killVol = SceneProps->KillingVolume->GetBounds().GetBox();
-		for (auto* i : pucks) {
-			FBox puckVol = i->GetBoundingBox();
-			if (killVol.Intersect(puckVol)) {
-				GetWorld()->DestroyActor(i);
-			}
-		}
-		new_puck = static_cast<APuck*>(GetWorld()->SpawnActor(PawnClass, &location));
-	}
+	auto* manager = APuckManager::Get(this);
+	make_sure(manager);
+
+	manager->ClearStartArea(); // any previous one left in the way
+	APuck* new_puck = manager->Acquire(PawnClass, location);
 	make_sure(new_puck);
 
 	new_puck->SetColor(GetPlayerState<AShufflPlayerState>()->Color);
@@ -164,6 +157,10 @@ void APlayerCtrl::ConsumeTouchOn(const ETouchIndex::Type fingerIndex, const FVec
 	ThrowStartPoint = FVector2D(location);
 	TouchStartHitResult = ProjectScreenPoint(this, ThrowStartPoint);
 
+	if (IsAimGhostEnabled()) {
+		AimPredictor.Begin(GetWorld(), GetPuck()->Color);
+	}
+
 #ifdef TOUCH_HISTORY
 	TouchHistory.Reset();
 	TouchHistory.Add(ThrowStartPoint);
@@ -196,6 +193,7 @@ void APlayerCtrl::ConsumeTouchRepeat(const ETouchIndex::Type fingerIndex, const
 	} else {
 		PlayMode = EPlayerCtrlMode::Throw;
 	}
+	UpdateAimGhost(location);
 
 #ifdef TOUCH_HISTORY
 	TouchHistory.Add(FVector2D(location));
@@ -207,68 +205,82 @@ void APlayerCtrl::ConsumeTouchOff(const ETouchIndex::Type fingerIndex, const FVe
 	if (ProhibitFurtherTouch) return;
 
 	if (fingerIndex != ETouchIndex::Touch1) return;
+	StopAimGhost();
 	if (PlayMode == EPlayerCtrlMode::Observe) return;
 
 	// make sure a TouchOff is paired with a TouchOn, as UI presses can still trigger us
 	if (ThrowStartTime == 0.f) return;
 
-	float deltaTime = GetWorld()->GetRealTimeSeconds() - ThrowStartTime;
-	FVector2D gestureEndPoint = FVector2D(location);
-	FVector2D gestureVector = gestureEndPoint - ThrowStartPoint;
-	float distance = gestureVector.Size();
-	float velocity = distance / deltaTime;
-	float angle = FMath::Atan2(-gestureVector.X, -gestureVector.Y) + PI / 2.f;
-		// need to rotate otherwise it's 0 when drawing straight throw (screen lenghtwise)
+	const FGesture gesture = MeasureGesture(location);
 
 	// reset for next cycle of checks
 	ON_SCOPE_EXIT{ ThrowStartTime = 0.f; };
 
 	if (PlayMode == EPlayerCtrlMode::Spin) {
 		CalculateSpin(location);
-		ExitSpinMode(velocity);
+		ExitSpinMode(gesture.Velocity);
 		return;
 	}
 
 	GetPuck()->HideSlingshotPreview();
 	if (PlayMode == EPlayerCtrlMode::Slingshot 
-			&& (deltaTime > .1f/*sec*/)
+			&& (gesture.Time > .1f/*sec*/)
 			&& (SlingshotDir.Size() > GetPuck()->Radius)){
 		DoSlingshot();
 		PlayMode = EPlayerCtrlMode::Observe;
 		return;
 	}
 
-	if (velocity < EscapeVelocity ||
-		angle < 0.349f/*20 deg*/ || angle > 2.793f/*160 deg*/) {
-		MovePuckOnTouchPosition(gestureEndPoint);
+	if (!IsFlick(gesture)) {
+		MovePuckOnTouchPosition(FVector2D(location));
 		PlayMode = EPlayerCtrlMode::Setup;
 	} else {
-		ThrowPuck(gestureVector, velocity);
+		ThrowPuck(gesture.Vector, gesture.Velocity);
 		PlayMode = GetPuck()->ThrowMode == EPuckThrowMode::Simple ?
 			EPlayerCtrlMode::Observe : EPlayerCtrlMode::Spin;
 	}
 }
 
-FVector2D APlayerCtrl::ThrowPuck(FVector2D gestureVector, float velocity)
+APlayerCtrl::FGesture APlayerCtrl::MeasureGesture(FVector location) const
 {
-	gestureVector.Normalize();
-	gestureVector *= velocity / (50.f - ThrowForceScaling);
-		//TODO: HACK: inverted it so it makes more sense: low scale -> slow flick push
+	FGesture gesture;
+	gesture.Time = GetWorld()->GetRealTimeSeconds() - ThrowStartTime;
+	gesture.Vector = FVector2D(location) - ThrowStartPoint;
+	gesture.Velocity = gesture.Vector.Size() / FMath::Max(gesture.Time, KINDA_SMALL_NUMBER);
+	gesture.Angle = FMath::Atan2(-gesture.Vector.X, -gesture.Vector.Y) + PI / 2.f;
+		// need to rotate otherwise it's 0 when drawing straight throw (screen lenghtwise)
+	return gesture;
+}
+
+bool APlayerCtrl::IsFlick(const FGesture& gesture) const
+{
+	return gesture.Velocity >= EscapeVelocity &&
+		gesture.Angle >= 0.349f/*20 deg*/ && gesture.Angle <= 2.793f/*160 deg*/;
+}
+
+FVector2D APlayerCtrl::CalculateThrowForce(FVector2D gestureVector, float velocity) const
+{
+	FVector2D force = FThrowTableTuning::FromCtrl(this).FlickForce(gestureVector, velocity);
+	if (GetPawn<APuck>()->ThrowMode == EPuckThrowMode::WithSpin) {
+		force.Y = 0.f;
+	}
+	return force;
+}
 
-	auto X = FMath::Clamp(FMath::Abs(gestureVector.Y), 0.f, ThrowForceMax);
-	auto Y = FMath::Clamp(gestureVector.X, -ThrowForceMax, ThrowForceMax);
+FVector2D APlayerCtrl::ThrowPuck(FVector2D gestureVector, float velocity)
+{
+	const FVector2D force = CalculateThrowForce(gestureVector, velocity);
 	if (GetPuck()->ThrowMode == EPuckThrowMode::WithSpin) {
-		Y = 0.f;
 		GetWorldTimerManager().SetTimer(SpinTimer, this, &APlayerCtrl::EnterSpinMode,
 			1.f / 60.f, false);
 	}
 	
-	GetPuck()->ApplyThrow(FVector2D(X, Y));
+	GetPuck()->ApplyThrow(force);
 #ifdef PRINT_THROW
-	ShufflLog(TEXT("Vel %4.2f px/sec -- (%3.1f, %3.1f)"), velocity, X, Y);
+	ShufflLog(TEXT("Vel %4.2f px/sec -- (%3.1f, %3.1f)"), velocity, force.X, force.Y);
 #endif
 
-	return FVector2D(X, Y);
+	return force;
 }
 
 float APlayerCtrl::CalculateSpin(FVector touchLocation)
@@ -321,12 +333,14 @@ void APlayerCtrl::PreviewSlingshot(FVector touchLocation)
 	}
 }
 
+FVector2D APlayerCtrl::CalculateSlingshotForce() const
+{
+	return FThrowTableTuning::FromCtrl(this).SlingshotForce(FVector2D(SlingshotDir));
+}
+
 FVector2D APlayerCtrl::DoSlingshot()
 {
-	auto f = FVector2D(SlingshotDir) * SlingshotForceScaling;
-	auto len = f.Size();
-	f.Normalize();
-	f *= FMath::Min(len, ThrowForceMax);
+	const auto f = CalculateSlingshotForce();
 	
 	GetPuck()->ApplyThrow(f);
 #ifdef PRINT_THROW
@@ -357,6 +371,48 @@ FVector APlayerCtrl::MovePuckOnTouchPosition(FVector2D touchLocation)
 	}
 }
 
+bool APlayerCtrl::IsAimGhostEnabled() const
+{
+	return ShowAimGhost && GetWorld()->GetAuthGameMode<AShufflPracticeGameMode>();
+}
+
+void APlayerCtrl::UpdateAimGhost(FVector location)
+{
+	if (!AimPredictor.IsActive()) return;
+
+	FPuckThrow t;
+	t.Start = FVector2D(GetPuck()->GetActorLocation());
+	if (PlayMode == EPlayerCtrlMode::Slingshot) {
+		t.Force = SlingshotDir.Size() > GetPuck()->Radius ? CalculateSlingshotForce() : FVector2D::ZeroVector;
+	} else {
+		const FGesture gesture = MeasureGesture(location);
+		t.Force = IsFlick(gesture) ? CalculateThrowForce(gesture.Vector, gesture.Velocity) : FVector2D::ZeroVector;
+	}
+
+	if (t.Force.IsZero()) { // letting go now wouldn't throw
+		AimPredictor.Clear();
+		AimGhost.Reset();
+	} else {
+		AimPredictor.Request(t);
+	}
+}
+
+void APlayerCtrl::StopAimGhost()
+{
+	AimPredictor.Stop();
+	AimGhost.Reset();
+}
+
+void APlayerCtrl::PlayerTick(float deltaTime)
+{
+	Super::PlayerTick(deltaTime);
+
+	FAimPrediction prediction;
+	if (AimPredictor.Poll(prediction)) {
+		AimGhost = prediction;
+	}
+}
+
 void APlayerCtrl::SwitchToDetailView()
 {
 	if (!SceneProps.IsValid()) return;
@@ -435,20 +491,102 @@ void AAIPlayerCtrl::HandleNewThrow()
 {
 	Super::HandleNewThrow();
 
-	static FTimerHandle MoveTimer;
-	GetWorldTimerManager().SetTimer(MoveTimer, 
-		[this]() {
-			FVector p = StartingPoint - StartingLine / 2.f;
-			p.Y += FMath::RandRange(0.f, StartingLine.Y);
-			GetPuck()->MoveTo(p);
-		},
-		1.f/*sec*/, false);
+	auto* manager = APuckManager::Get(this);
+	make_sure(manager);
+
+	FAIPlanRequest req;
+	req.Params = FPuckSimParams::FromPuck(GetPuck());
+	req.Layout = FPuckTableLayout::FromWorld(GetWorld());
+	req.Zones = manager->GetZones();
+	req.PuckZ = StartingPoint.Z;
+	for (APuck* p : manager->GetPucks()) {
+		if (p->GetState() == EPuckState::Setup) continue;
+		req.Pucks.Emplace(FVector2D(p->GetActorLocation()), p->Color);
+	}
+	req.Color = GetPuck()->Color;
+	// same placement range as `MovePuckOnTouchPosition`
+	const FVector lineStart = StartingPoint - StartingLine / 2.f;
+	req.LineStart = FVector2D(lineStart);
+	req.LineEnd = FVector2D(lineStart + FVector(0, StartingLine.Y, 0));
+	req.ForceMax = ThrowForceMax;
+	req.SpinVelocityMax = EscapeVelocity;
+	if (auto table = FThrowTable::Get(GetPuck())) {
+		req.AddZoneSeeds(*table);
+	}
+	// this one plus what both sides still have (already counted down for this turn)
+	req.ThrowsLeft = 1;
+	int ownScore = 0, opponentScore = 0;
+	for (APlayerState* ps : GetWorld()->GetGameState()->PlayerArray) {
+		if (auto* sps = Cast<AShufflPlayerState>(ps)) {
+			req.ThrowsLeft += sps->PucksToPlay;
+			(sps->Color == req.Color ? ownScore : opponentScore) = sps->GetScore();
+		}
+	}
+	req.MaxDepth = MaxSearchDepth;
+	req.Budget = PlanningBudget;
+	req.Seed = FMath::Rand();
+
+	PlanTurnId = GetPuck()->TurnId;
+	PlanStartTime = GetWorld()->GetTimeSeconds();
+	GetWorldTimerManager().ClearTimer(ActionTimer);
+
+	if (Brain == EAIBrain::Policy) {
+		const FThrowPolicy policy(Policy);
+		FAIMove move;
+		if (policy.Decide(req, ownScore, opponentScore, move)) {
+			PerformMove(move);
+			return;
+		}
+		ShufflErr(TEXT("AI policy missing or invalid, falling back to search"));
+	}
+
+	Planner.Start(MoveTemp(req));
+	GetWorldTimerManager().SetTimer(PlanTimer, this, &AAIPlayerCtrl::PollPlan, .1f/*sec*/, true);
+}
+
+void AAIPlayerCtrl::PollPlan()
+{
+	FAIMove move;
+	if (!Planner.Poll(move)) return; // keep waiting, never block the game thread
+	GetWorldTimerManager().ClearTimer(PlanTimer);
+
+	// turn got skipped in the meantime
+	if (!GetPawn() || GetPuck()->TurnId != PlanTurnId) return;
 
-	static FTimerHandle ThrowTimer;
-	GetWorldTimerManager().SetTimer(ThrowTimer,
-		[this]() {
-			float force = ThrowForceMax / FMath::RandRange(1.f, 5.f);
-			GetPuck()->ApplyThrow(FVector2D(force, 0.f));
+#ifdef PRINT_THROW
+	ShufflLog(TEXT("AI %3.1f %3.1f spin %3.2f value %3.2f (depth %i, %i moves)"), move.Throw.Force.X,
+		move.Throw.Force.Y, move.Throw.SpinAngle, move.Value, move.Depth, move.Evaluated);
+#endif
+
+	PerformMove(move);
+}
+
+void AAIPlayerCtrl::PerformMove(const FAIMove& move)
+{
+	const float elapsed = GetWorld()->GetTimeSeconds() - PlanStartTime;
+	const float moveDelay = FMath::Max(MinThinkTime - elapsed, .01f);
+	GetWorldTimerManager().SetTimer(ActionTimer,
+		[this, move]() {
+			if (!GetPawn() || GetPuck()->TurnId != PlanTurnId) return;
+			GetPuck()->MoveTo(FVector(move.Throw.Start, StartingPoint.Z));
+
+			GetWorldTimerManager().SetTimer(ActionTimer,
+				[this, move]() {
+					if (!GetPawn() || GetPuck()->TurnId != PlanTurnId) return;
+					GetPuck()->ApplyThrow(move.Throw.Force);
+					PlayMode = EPlayerCtrlMode::Observe;
+					if (move.bSpin) {
+						// counted in physics steps, a timer would land on whichever frame comes next
+						GetPuck()->ApplySpin(move.Throw.SpinAngle, move.Throw.SpinVelocity, move.Throw.SpinDelay);
+					}
+				},
+				1.f/*sec*/, false);
 		},
-		2.f/*sec*/, false);
+		moveDelay, false);
+}
+
+void AAIPlayerCtrl::EndPlay(const EEndPlayReason::Type reason)
+{
+	Planner.Cancel();
+	Super::EndPlay(reason);
 }
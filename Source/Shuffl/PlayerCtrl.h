@@ -20,6 +20,10 @@
 #include "GameFramework/PlayerController.h"
 
 #include "Puck.h"
+#include "AIPlanner.h"
+#include "AimPredictor.h"
+#include "XMPPMessage.h"
+#include "PuckSync.h"
 
 #include "PlayerCtrl.generated.h"
 
@@ -68,6 +72,13 @@ public:
 	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = Slingshot)
 	float SlingshotForceScaling;
 
+	/** practice mode aid: ghost puck where the throw would stop if released now */
+	UPROPERTY(Config, EditAnywhere, BlueprintReadWrite, Category = Practice)
+	bool ShowAimGhost = false;
+
+	/** latest prediction while aiming (nullptr if nothing to show) */
+	const FAimPrediction* GetAimGhost() const { return AimGhost.GetPtrOrNull(); }
+
 	UFUNCTION(BlueprintCallable)
 	virtual void RequestNewThrow();
 
@@ -90,6 +101,7 @@ public:
 protected:
 	virtual void BeginPlay() override;
 	virtual void SetupInputComponent() override;
+	virtual void PlayerTick(float) override;
 
 	APuck* GetPuck();
 	virtual FVector MovePuckOnTouchPosition(FVector2D);
@@ -108,6 +120,16 @@ protected:
 //
 // Flick mode
 //
+	struct FGesture
+	{
+		FVector2D Vector;
+		float Time; // sec since touch on
+		float Velocity; // pixels per sec
+		float Angle; // 0 to PI, PI/2 is straight up the screen
+	};
+	FGesture MeasureGesture(FVector) const;
+	bool IsFlick(const FGesture&) const;
+	FVector2D CalculateThrowForce(FVector2D, float) const;
 	virtual FVector2D ThrowPuck(FVector2D, float);
 	float ThrowStartTime = 0.f;
 	FVector2D ThrowStartPoint = FVector2D::ZeroVector;
@@ -127,8 +149,18 @@ protected:
 //
 	FVector SlingshotDir = FVector::ZeroVector;
 	void PreviewSlingshot(FVector);
+	FVector2D CalculateSlingshotForce() const;
 	virtual FVector2D DoSlingshot();
 
+//
+// Aim ghost
+//
+	bool IsAimGhostEnabled() const;
+	void UpdateAimGhost(FVector);
+	void StopAimGhost();
+	FAimPredictor AimPredictor;
+	TOptional<FAimPrediction> AimGhost;
+
 	virtual void HandleTutorial(bool show = true);
 };
 
@@ -144,8 +176,40 @@ class AAIPlayerCtrl : public APlayerCtrl
 	GENERATED_BODY()
 
 public:
+	/** wall clock seconds the planner gets per turn (runs in the background) */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = AI)
+	float PlanningBudget = .5f;
+
+	/** throws to look ahead at most (ours and the opponent's), the budget usually stops it first */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = AI)
+	int MaxSearchDepth = ERound::TotalThrows;
+
+	/** seconds after the turn starts before the puck is placed, for pacing */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = AI)
+	float MinThinkTime = 1.f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = AI)
+	EAIBrain Brain = EAIBrain::Search;
+
+	/** weights for the `Policy` brain */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = AI)
+	class UThrowPolicyAsset* Policy = nullptr;
+
 	virtual void SetupInputComponent() override;
 	virtual void HandleNewThrow() override;
+
+protected:
+	virtual void EndPlay(const EEndPlayReason::Type) override;
+
+private:
+	void PollPlan();
+	void PerformMove(const FAIMove&);
+
+	FAIPlanner Planner;
+	FTimerHandle PlanTimer;
+	FTimerHandle ActionTimer;
+	float PlanStartTime = 0.f;
+	int PlanTurnId = 0;
 };
 
 UCLASS()
@@ -166,7 +230,11 @@ public:
 	void SendSync(int); //turnId: negative means all, other send only that puck
 
 private:
+	void SendThrow(FVector2D force);
+	void ReceiveSyncAck(int turnId, const FXMPPSyncAck&);
+
 	struct FShufflXMPPService* XMPP;
+	FPuckSyncSender SyncSender;
 };
 
 UCLASS()
@@ -181,8 +249,17 @@ public:
 	virtual void RequestNewThrow() override;
 	virtual void HandleTutorial(bool /*show*/) override;
 
-	void OnReceiveChat(FString);
-
 private:
+	// see `FShufflXMPPService` events
+	void ReceiveNextTurn(int turnId);
+	void ReceiveMove(int turnId, const FXMPPMove&);
+	void ReceiveThrow(int turnId, const FXMPPThrow&);
+	void ReceiveBowl(int turnId);
+	void ReceiveSync(int turnId, const FXMPPSync&);
+	void ReceiveSyncDelta(int turnId, const FXMPPSyncDelta&);
+	bool IsCurrentTurn(EXMPPMsg, int turnId) const;
+	void SnapPuck(class APuck*, FVector location);
+
 	struct FShufflXMPPService* XMPP;
+	FPuckSyncReceiver SyncReceiver;
 };
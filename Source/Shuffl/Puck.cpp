@@ -15,7 +15,6 @@
 
 #include "Puck.h"
 
-#include "EngineUtils.h"
 #include "Camera/CameraComponent.h"
 #include "Camera/CameraActor.h"
 #include "GameFramework/SpringArmComponent.h"
@@ -25,8 +24,36 @@
 
 #include "Shuffl.h"
 #include "GameModes.h"
-#include "ScoringVolume.h"
-#include "SceneProps.h"
+#include "PuckSim.h"
+#include "PuckManager.h"
+
+//#define VALIDATE_PUCK_SIM // compare every rested throw against `FPuckBatchSim`
+
+#ifdef VALIDATE_PUCK_SIM
+// the other pucks on the table at the time of the throw (only one throw is in flight)
+static TArray<FVector2D, TInlineAllocator<ERound::TotalThrows>> ValidationTable;
+
+static void ValidateAgainstBatchSim(APuck* puck)
+{
+	FPuckBatchSim sim(FPuckSimParams::FromPuck(puck), FPuckTableLayout::FromWorld(puck->GetWorld()));
+	sim.Reset(1);
+
+	int slot = 0;
+	for (const auto& p : ValidationTable) {
+		if (slot == FPuckBatchSim::MaxPucks - 1) break;
+		sim.SetPuck(0, slot++, p);
+	}
+
+	const FPuckRest predicted = puck->PredictRest();
+	sim.Throw(0, slot, puck->GetThrow());
+	sim.Run();
+
+	const FVector2D actual = FVector2D(puck->GetActorLocation());
+	const float diff = (sim.GetPosition(0, slot) - actual).Size();
+	ShufflLog(TEXT("sim diff by %3.2f (analytic %3.2f, integration bound %3.2f)"),
+		diff, (predicted.Position - actual).Size(), predicted.IntegrationError);
+}
+#endif
 
 APuck::APuck()
 {
@@ -52,7 +79,10 @@ APuck::APuck()
 	// disable so the PC will spawn us, but this is a good shortcut for tests
 	AutoPossessPlayer = EAutoReceiveInput::Disabled;
 
-	PrimaryActorTick.bCanEverTick = true;
+	// updated in bulk by `APuckManager`
+	PrimaryActorTick.bCanEverTick = false;
+
+	OnSubstepPhysics.BindUObject(this, &APuck::SubstepPhysics);
 }
 
 UStaticMeshComponent* APuck::GetPuck()
@@ -60,62 +90,84 @@ UStaticMeshComponent* APuck::GetPuck()
 	return static_cast<UStaticMeshComponent*>(GetRootComponent());
 }
 
-void APuck::Tick(float deltaTime)
+void APuck::BeginPlay()
 {
-	if (State == EPuckState::Setup) return;
+	Super::BeginPlay();
 
-	Lifetime += deltaTime;
-	FVector vel = GetPuck()->GetPhysicsLinearVelocity();
+	// rest detection is event based, needs the body to report sleep/wake transitions
+	auto* body = GetPuck();
+	if (!body->BodyInstance.bGenerateWakeEvents) {
+		body->BodyInstance.bGenerateWakeEvents = true;
+		body->RecreatePhysicsState();
+	}
+	body->OnComponentSleep.AddDynamic(this, &APuck::OnBodySleep);
+	body->OnComponentWake.AddDynamic(this, &APuck::OnBodyWake);
 
-	if (State == EPuckState::Traveling_WithSpin) {
-		const auto spin_angle = Impulse.Y;
-		const auto spin_vel = Impulse.Z;
+	if (auto* manager = APuckManager::Get(this)) {
+		manager->Register(this);
+	}
+}
 
-		if (SpinAccumulator <= FMath::Abs(spin_angle * Radius)) {
-			auto s = spin_vel * deltaTime;
-			SpinAccumulator += s;
-			GetPuck()->AddImpulse(FVector(0, s * (spin_angle >= 0 ? 1 : -1), 0));
-		}
+void APuck::OnBodySleep(UPrimitiveComponent*, FName)
+{
+	if (auto* manager = APuckManager::Get(this)) {
+		manager->OnPuckSleep(this);
 	}
+}
 
-	if (State == EPuckState::Resting) {
-		if (Lifetime > TimeResting) {
-			OnResting();
-		}
-		return; 
+void APuck::OnBodyWake(UPrimitiveComponent*, FName)
+{
+	if (auto* manager = APuckManager::Get(this)) {
+		manager->OnPuckWake(this);
 	}
+}
 
-	if ((vel.SizeSquared() < .0001f) && Lifetime > ThresholdToResting) {
-		State = EPuckState::Resting;
+void APuck::EndPlay(const EEndPlayReason::Type reason)
+{
+	if (auto* manager = APuckManager::Get(this)) {
+		manager->Unregister(this);
+	}
 
-		bool scored = false;
-		for (auto i = TActorIterator<AScoringVolume>(GetWorld()); i; ++i) {
-			FBox scoreVol = i->GetBounds().GetBox();
-			if (scoreVol.IsInside(GetActorLocation())) {
-				scored = true;
-				break;
-			}
-		}
-		if (scored) {
-			Lifetime = 0.f; // recyle to count resting time and go again
-		} else {
-			OnResting(); // change turn immediately
-		}
+	Super::EndPlay(reason);
+}
+
+bool APuck::IsSpinning() const
+{
+	return State == EPuckState::Traveling_WithSpin && (!bSpinKicked || SpinStepsLeft > 0);
+}
+
+void APuck::SubstepPhysics(float deltaTime, FBodyInstance* body)
+{
+	// the scene only ever advances in whole `SpinStep`s (see `APuckManager::StepPhysics`)
+	// so spin (and any other custom force) is scheduled by counting steps, never by time
+	if (SpinDelaySteps > 0) {
+		SpinDelaySteps--;
+		return;
+	}
+	if (!bSpinKicked) {
+		bSpinKicked = true;
+		body->AddAngularImpulseInRadians(FVector(0, 0, PI * Radius * 2.f * Impulse.Y), false/*vel change*/);
+	}
+	if (SpinStepsLeft > 0) {
+		SpinStepsLeft--;
+		body->AddImpulse(FVector(0, SpinImpulse, 0), false/*vel change*/);
 	}
 }
 
 void APuck::OnResting()
 {
-	SetActorTickEnabled(false); // don't bother updating anymore once fully rested
+#ifdef VALIDATE_PUCK_SIM
+	if (TurnId == GetWorld()->GetGameState<AShufflGameState>()->GlobalTurnCounter) {
+		ValidateAgainstBatchSim(this); // only the thrown one, not the ones it knocked
+	}
+#endif
 
-	auto iter = TActorIterator<ASceneProps>(GetWorld());
-	make_sure(*iter);
-	auto *SceneProps = Cast<ASceneProps>(*iter);
+	auto* manager = APuckManager::Get(this);
+	make_sure(manager);
 
-	FBox killVol = SceneProps->KillingVolume->GetBounds().GetBox();
 	FBox puckVol = GetBoundingBox();
-	if (killVol.Intersect(puckVol)) {
-		Destroy();
+	if (manager->IsInKillingVolume(puckVol)) {
+		manager->Release(this);
 	} else {
 		//HACK: send a sync for this puck (the game mode will choose which side
 		//to send to, and redirect the request via the Player Ctrl)
@@ -124,15 +176,7 @@ void APuck::OnResting()
 		}
 	}
 
-	// abort if next turn already happened
-	auto* gameState = Cast<AShufflGameState>(GetWorld()->GetGameState());
-	if (TurnId < gameState->GlobalTurnCounter) return;
-	// abort if we're showing the end of round results - next one needs to be manual
-	if (gameState->GetMatchState() == MatchState::Round_End ||
-		gameState->GetMatchState() == MatchState::Round_WinnerDeclared) return;
-
-	// otherwise force next turn/throw
-	GetWorld()->GetAuthGameMode<AShufflCommonGameMode>()->NextTurn();
+	// next turn is triggered by the manager once every puck has settled
 }
 
 void APuck::ApplyThrow(FVector2D force)
@@ -140,6 +184,41 @@ void APuck::ApplyThrow(FVector2D force)
 	Impulse = FVector(force.X, force.Y, 0);
 	GetPuck()->AddImpulse(Impulse);
 	State = EPuckState::Traveling;
+	ThrowTime = GetWorld()->GetTimeSeconds();
+	ThrowStart = FVector2D(GetActorLocation());
+
+	if (auto* manager = APuckManager::Get(this)) {
+		manager->OnThrown(this);
+	}
+
+#ifdef VALIDATE_PUCK_SIM
+	ValidationTable.Reset();
+	for (APuck* p : APuckManager::Get(this)->GetPucks()) {
+		if (p != this) {
+			ValidationTable.Add(FVector2D(p->GetActorLocation()));
+		}
+	}
+#endif
+}
+
+FPuckThrow APuck::GetThrow() const
+{
+	FPuckThrow t;
+	t.Start = ThrowStart;
+	if (State == EPuckState::Traveling_WithSpin) {
+		t.Force = FVector2D(Impulse.X, 0.f);
+		t.SpinAngle = Impulse.Y;
+		t.SpinVelocity = Impulse.Z;
+		t.SpinDelay = SpinDelay;
+	} else {
+		t.Force = FVector2D(Impulse.X, Impulse.Y);
+	}
+	return t;
+}
+
+FPuckRest APuck::PredictRest() const
+{
+	return PuckSim::PredictRest(FPuckSimParams::FromPuck(this), GetThrow());
 }
 
 void APuck::MoveTo(FVector location)
@@ -162,6 +241,10 @@ inline UStaticMeshComponent* FindCap(EPuckColor color, AActor* parent)
 
 void APuck::SetColor(EPuckColor newColor)
 {
+	// both ways as pooled pucks change sides between throws
+	if (auto mesh = FindCap(newColor, this)) {
+		mesh->SetHiddenInGame(false);
+	}
 	auto prev = OppositePuckColor(newColor);
 	if (auto mesh = FindCap(prev, this)) {
 		mesh->SetHiddenInGame(true);
@@ -169,6 +252,39 @@ void APuck::SetColor(EPuckColor newColor)
 	Color = newColor;
 }
 
+void APuck::Activate(FVector location)
+{
+	Impulse = FVector::ZeroVector;
+	SpinDelaySteps = 0;
+	SpinStepsLeft = 0;
+	bSpinKicked = false;
+	SpinDelay = 0.f;
+	PreviewSpin(0.f);
+	HideSlingshotPreview();
+
+	SetActorHiddenInGame(false);
+	SetActorEnableCollision(true);
+
+	auto* body = GetPuck();
+	body->SetSimulatePhysics(true);
+	body->SetPhysicsLinearVelocity(FVector::ZeroVector);
+	body->SetPhysicsAngularVelocityInRadians(FVector::ZeroVector);
+	MoveTo(location);
+	body->PutAllRigidBodiesToSleep(); // until thrown
+}
+
+void APuck::Deactivate(FVector parking)
+{
+	State = EPuckState::Setup; // so the body notifications get ignored
+
+	auto* body = GetPuck();
+	body->SetSimulatePhysics(false);
+	SetActorEnableCollision(false);
+	SetActorHiddenInGame(true);
+	body->SetWorldLocationAndRotation(parking, FRotator::ZeroRotator,
+		false/*sweep*/, nullptr/*hit result*/, ETeleportType::TeleportPhysics);
+}
+
 void APuck::PreviewSpin(float spinAmount)
 {
 	if (auto mesh = FindCap(Color, this)) {
@@ -197,14 +313,26 @@ void APuck::OnExitSpin()
 	springArm->bEnableCameraLag = true;
 }
 
-void APuck::ApplySpin(float spinAmount, float fingerVelocity)
+void APuck::ApplySpin(float spinAmount, float fingerVelocity, float delay)
 {
 	//     .X set previously during the throw part
 	Impulse.Y = spinAmount;
 	Impulse.Z = fingerVelocity;
 	State = EPuckState::Traveling_WithSpin;
-	SpinAccumulator = 0.f;
-	GetPuck()->AddAngularImpulseInRadians(FVector(0, 0, PI * Radius * 2.f * spinAmount));
+
+	// same schedule the simulators use, the first impulse goes in with the next physics step
+	FPuckSimParams params;
+	params.Radius = Radius;
+	params.SpinStep = SpinStep;
+	PuckSim::SpinSchedule(params, spinAmount, fingerVelocity, SpinStepsLeft, SpinImpulse);
+	SpinImpulse *= spinAmount >= 0 ? 1.f : -1.f;
+	SpinDelaySteps = FMath::RoundToInt(delay / SpinStep);
+	bSpinKicked = false;
+	SpinDelay = GetWorld()->GetTimeSeconds() - ThrowTime + SpinDelaySteps * SpinStep;
+
+	if (auto* manager = APuckManager::Get(this)) {
+		manager->OnSpin(this);
+	}
 }
 
 void APuck::ShowSlingshotPreview(FVector rot, FColor color)
@@ -17,6 +17,7 @@
 
 #include "CoreMinimal.h"
 #include "GameFramework/Pawn.h"
+#include "PhysicsEngine/BodyInstance.h"
 
 #include "Def.h"
 
@@ -39,23 +40,30 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Puck)
 	float SpringArmLenghtOnZoom = 15.f;
 
-	/** Time in sec to allow for until puck is checked for rest (no velocity) */
-	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite, Category = Puck)
-	float ThresholdToResting = 3.f;
-
-	/** Time in sec to wait (after puck is resting) before triggering new throw */
+	/** Time in sec to wait (after all pucks rest, if this one scored) before triggering new throw */
 	UPROPERTY(EditDefaultsOnly, BlueprintReadWrite, Category = Puck)
 	float TimeResting = 1.f;
 
+	/** Fixed step in sec at which spin impulses are fed, one per physics step (see `APuckManager::StepPhysics`) */
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, Category = Puck)
+	float SpinStep = 1.f / 120.f;
+
 	EPuckThrowMode ThrowMode = EPuckThrowMode::Simple;
 	int TurnId = 0;
 
 	FVector Impulse = FVector::ZeroVector; // X: flick Y: spin-angle Z: spin-velocity
 	void ApplyThrow(FVector2D);
+	struct FPuckThrow GetThrow() const; // the throw currently in flight
+	struct FPuckRest PredictRest() const; // analytic rest position of the current throw
 	void MoveTo(FVector);
 	void SetColor(EPuckColor);
 
-	void ApplySpin(float, float);
+	// pooling: brought back as a fresh (sleeping) puck / parked out of the game
+	void Activate(FVector);
+	void Deactivate(FVector parking);
+
+	/** `delay` sec from now (in whole `SpinStep`s), 0 for the next physics step */
+	void ApplySpin(float spinAmount, float fingerVelocity, float delay = 0.f);
 	void PreviewSpin(float);
 	void OnEnterSpin();
 	void OnExitSpin();
@@ -64,16 +72,39 @@ public:
 	void HideSlingshotPreview();
 	
 	FBox GetBoundingBox(); // will return just the puck component not the auxiliary elements
+	EPuckState GetState() const { return State; }
+
+protected:
+	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type) override;
 
 private:
-	virtual void Tick(float) override;
+	friend class APuckManager; // drives the state machine below
+
 	void OnResting();
 
+	// physics body notifications, drive the rest detection
+	UFUNCTION()
+	void OnBodySleep(class UPrimitiveComponent*, FName);
+	UFUNCTION()
+	void OnBodyWake(class UPrimitiveComponent*, FName);
+
+	// runs for every fixed physics step (possibly outside the game thread)
+	void SubstepPhysics(float, FBodyInstance*);
+	FCalculateCustomPhysics OnSubstepPhysics;
+	bool IsSpinning() const;
+
 	class UStaticMeshComponent* GetPuck();
 
 	EPuckState State = EPuckState::Setup;
-	float Lifetime = 0.f; // since it started Traveling (in sec)
-	float SpinAccumulator = 0.f;
+	float ThrowTime = 0.f; // world time it started Traveling (in sec)
+	// spin schedule in physics steps, counted down by `SubstepPhysics`
+	int SpinDelaySteps = 0; // before the spin goes in
+	int SpinStepsLeft = 0; // lateral impulses still to feed
+	float SpinImpulse = 0.f; // each of them, signed
+	bool bSpinKicked = false; // got the angular impulse
+	float SpinDelay = 0.f; // sec between throw and spin
+	FVector2D ThrowStart = FVector2D::ZeroVector;
 };
 
 inline const TCHAR* PuckColorToString(EPuckColor color)
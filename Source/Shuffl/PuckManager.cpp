@@ -0,0 +1,470 @@
+// Copyright (C) 2020 Valentin Galea
+//
+// This program is free software : you can redistribute it and /or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#include "PuckManager.h"
+
+#include "EngineUtils.h"
+#include "TimerManager.h"
+#include "Components/StaticMeshComponent.h"
+#include "PhysicsEngine/PhysicsSettings.h"
+#if WITH_PHYSX
+#include "PhysicsPublic.h"
+#endif
+
+#include "Shuffl.h"
+#include "Puck.h"
+#include "GameModes.h"
+#include "GameSubSys.h"
+#include "SceneProps.h"
+#include "PlayerCtrl.h"
+
+static const FVector ParkingSpot(0.f, 0.f, -100000.f); // pooled pucks wait well below the table
+
+APuckManager::APuckManager()
+{
+	PrimaryActorTick.bCanEverTick = true;
+	PrimaryActorTick.TickGroup = TG_PrePhysics; // sets up the physics steps and spin before physics runs
+}
+
+APuckManager* APuckManager::Get(const UObject* context)
+{
+	auto* world = context ? context->GetWorld() : nullptr;
+	auto* gameState = world ? world->GetGameState<AShufflGameState>() : nullptr;
+	return gameState ? gameState->PuckManager : nullptr;
+}
+
+void APuckManager::BeginPlay()
+{
+	Super::BeginPlay();
+
+	CacheScene();
+	Pucks.Reserve(ERound::TotalThrows);
+	InPlay.Reserve(ERound::TotalThrows);
+	Settled.Reserve(ERound::TotalThrows);
+	StartArea.Reserve(ERound::TotalThrows);
+
+	if (auto* sys = UGameSubSys::Get(this)) {
+		Dataset = sys->ThrowDataset;
+	}
+}
+
+void APuckManager::EndPlay(const EEndPlayReason::Type reason)
+{
+	CommitSamples(); // unfinished round, without an outcome
+	Dataset.Reset();
+
+	Super::EndPlay(reason);
+}
+
+void APuckManager::CacheScene()
+{
+	auto iter = TActorIterator<ASceneProps>(GetWorld());
+	make_sure(*iter);
+	SceneProps = *iter;
+	make_sure(SceneProps->KillingVolume);
+	KillBox = SceneProps->KillingVolume->GetBounds().GetBox();
+
+	Zones = FScoringZones::FromWorld(GetWorld());
+	Layout = FPuckTableLayout::FromWorld(GetWorld());
+}
+
+void APuckManager::Register(APuck* puck)
+{
+	Pucks.AddUnique(puck);
+}
+
+void APuckManager::Prewarm(UClass* puckClass, int count)
+{
+	FActorSpawnParameters params;
+	params.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+
+	Pucks.Reserve(count);
+	Free.Reserve(count);
+	while (Pucks.Num() + Free.Num() < count) {
+		auto* puck = GetWorld()->SpawnActor<APuck>(puckClass, ParkingSpot, FRotator::ZeroRotator, params);
+		make_sure(puck);
+		Release(puck); // registered itself on BeginPlay
+	}
+}
+
+APuck* APuckManager::Acquire(UClass* puckClass, const FVector& location)
+{
+	APuck* puck = nullptr;
+	if (Free.Num()) {
+		puck = Free.Pop(false/*shrink*/);
+		Register(puck);
+	} else {
+		// practice mode can go over the pool, it just grows by one
+		ShufflLog(TEXT("puck pool exhausted, spawning"));
+		FActorSpawnParameters params;
+		params.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+		puck = GetWorld()->SpawnActor<APuck>(puckClass, location, FRotator::ZeroRotator, params);
+		if (!puck) return nullptr;
+	}
+
+	puck->Activate(location);
+	StartArea.Add(puck);
+	return puck;
+}
+
+void APuckManager::ClearStartArea()
+{
+	for (int i = StartArea.Num() - 1; i >= 0; --i) {
+		APuck* p = StartArea[i];
+		// never thrown (turn got skipped) or stopped short in the killing volume
+		if (p->State == EPuckState::Setup || IsInKillingVolume(p->GetBoundingBox())) {
+			Release(p);
+		}
+	}
+	StartArea.Reset();
+}
+
+void APuckManager::Release(APuck* puck)
+{
+	if (auto* ctrl = puck->GetController()) {
+		ctrl->UnPossess();
+	}
+
+	Unregister(puck);
+	puck->Deactivate(ParkingSpot);
+	Free.AddUnique(puck);
+}
+
+void APuckManager::Unregister(APuck* puck)
+{
+	Free.RemoveSingleSwap(puck, false/*shrink*/);
+	Pucks.RemoveSingleSwap(puck, false);
+	StartArea.RemoveSingleSwap(puck, false);
+	InPlay.RemoveSingleSwap(puck, false);
+	Settled.RemoveSingleSwap(puck, false);
+	Unrank(puck);
+	UpdateScore();
+	if (Thrown == puck) {
+		Thrown = nullptr; // e.g. the round got reset mid throw
+		GetWorldTimerManager().ClearTimer(FinishTimer);
+		return;
+	}
+
+	CheckAllRested(); // might have been the last one moving (fell off)
+}
+
+void APuckManager::OnThrown(APuck* puck)
+{
+	GetWorldTimerManager().ClearTimer(FinishTimer);
+	Thrown = puck;
+	Settled.Reset();
+	InPlay.AddUnique(puck);
+
+	if (EarlyRest) {
+		SimParams = FPuckSimParams::FromPuck(puck);
+	}
+
+	if (Dataset) {
+		// rounds never end in practice, commit a table's worth at a time
+		if (RoundSamples.Num() == ERound::TotalThrows) {
+			CommitSamples();
+		}
+
+		FThrowSample& sample = RoundSamples.AddDefaulted_GetRef();
+		auto* controller = puck->GetController();
+		sample.Source = controller && controller->IsA<AAIPlayerCtrl>() ? EThrowSource::AI
+			: controller && controller->IsA<AXMPPPlayerSpectator>() ? EThrowSource::Remote
+			: EThrowSource::Human;
+		sample.Color = uint8(puck->Color);
+		sample.Slot = uint8(RoundSamples.Num() - 1);
+		sample.TurnId = puck->TurnId;
+		sample.Throw = puck->GetThrow();
+
+		FTableSnapshot table;
+		SnapshotTable(table, puck);
+		sample.SetBefore(table);
+	}
+}
+
+void APuckManager::OnSpin(APuck* puck)
+{
+	if (RoundSamples.Num() && RoundSamples.Last().TurnId == puck->TurnId) {
+		RoundSamples.Last().Throw = puck->GetThrow(); // now with the spin
+	}
+}
+
+void APuckManager::OnPuckSleep(APuck* puck)
+{
+	if (!Thrown || puck->State == EPuckState::Setup) return;
+
+	InPlay.RemoveSingleSwap(puck, false);
+	puck->State = EPuckState::Resting;
+	Settled.AddUnique(puck);
+	CheckAllRested();
+}
+
+void APuckManager::OnPuckWake(APuck* puck)
+{
+	if (!Thrown || puck->State == EPuckState::Setup) return;
+
+	// knocked by the throw (or still settling), back in play
+	GetWorldTimerManager().ClearTimer(FinishTimer);
+	if (puck->State == EPuckState::Resting) {
+		puck->State = EPuckState::Traveling;
+		StartArea.AddUnique(puck); // could get knocked back
+		Unrank(puck);
+		UpdateScore();
+	}
+	InPlay.AddUnique(puck);
+}
+
+void APuckManager::OnPuckMoved(APuck* puck)
+{
+	if (puck->State != EPuckState::Resting || InPlay.Contains(puck)) return;
+
+	Rank(puck);
+	UpdateScore();
+}
+
+void APuckManager::CheckAllRested()
+{
+	if (!Thrown || InPlay.Num() > 0) return;
+
+	// everything is asleep - the turn goes on from the next frame as this is called
+	// in the middle of the physics notifications (pucks might get destroyed or spawned)
+	auto& timers = GetWorldTimerManager();
+	timers.ClearTimer(FinishTimer);
+	if (!EarlyRest && Thrown->State == EPuckState::Resting && FindZone(Thrown->GetActorLocation()) != INDEX_NONE) {
+		timers.SetTimer(FinishTimer, this, &APuckManager::FinishThrow, Thrown->TimeResting);
+	} else {
+		FinishTimer = timers.SetTimerForNextTick(this, &APuckManager::FinishThrow);
+	}
+}
+
+void APuckManager::FinishThrow()
+{
+	if (!Thrown || InPlay.Num() > 0) return;
+
+	const int turnId = Thrown->TurnId;
+	Thrown = nullptr;
+
+	TArray<APuck*, TInlineAllocator<ERound::TotalThrows>> settled(Settled);
+	Settled.Reset();
+	for (APuck* p : settled) {
+		if (!IsValid(p)) continue;
+		p->OnResting();
+		if (p->State == EPuckState::Resting) { // still there after the killing volume test
+			Rank(p);
+			StartArea.RemoveSingleSwap(p, false);
+		}
+	}
+	UpdateScore();
+
+	if (RoundSamples.Num() && RoundSamples.Last().TurnId == turnId) {
+		FTableSnapshot table;
+		SnapshotTable(table);
+		RoundSamples.Last().SetAfter(table);
+	}
+
+	OnPucksRested.Broadcast(turnId);
+}
+
+void APuckManager::SnapshotTable(FTableSnapshot& out, const APuck* except) const
+{
+	out.Reset();
+	TArray<const APuck*, TInlineAllocator<ERound::TotalThrows>> resting;
+	for (const APuck* p : Pucks) {
+		if (p != except && p->State == EPuckState::Resting) {
+			resting.Add(p);
+		}
+	}
+	resting.Sort([](const APuck& a, const APuck& b) { return a.TurnId < b.TurnId; });
+	for (const APuck* p : resting) {
+		out.Emplace(FVector2D(p->GetActorLocation()), p->Color);
+	}
+}
+
+void APuckManager::EndRound()
+{
+	for (FThrowSample& sample : RoundSamples) {
+		sample.SetOutcome(Score);
+	}
+	CommitSamples();
+}
+
+void APuckManager::CommitSamples()
+{
+	if (Dataset && RoundSamples.Num()) {
+		Dataset->Add(RoundSamples);
+	}
+	RoundSamples.Reset();
+}
+
+void APuckManager::Rank(APuck* puck)
+{
+	Unrank(puck);
+
+	const FVector location = puck->GetActorLocation();
+	int at = 0;
+	while (at < Ranked.Num() && Ranked[at].X >= location.X) at++;
+	Ranked.Insert({ puck, location.X, Zones.GetPoints(location) }, at);
+}
+
+void APuckManager::RankAll()
+{
+	Ranked.Reset();
+	for (APuck* p : Pucks) {
+		if (p->State != EPuckState::Setup) {
+			Rank(p);
+		}
+	}
+	UpdateScore();
+}
+
+void APuckManager::Unrank(APuck* puck)
+{
+	Ranked.RemoveAll([puck](const FRankedPuck& r) { return r.Puck == puck; });
+}
+
+void APuckManager::UpdateScore()
+{
+	FRoundScore score;
+	for (const auto& r : Ranked) {
+		if (!score.Add(r.Puck->Color, r.Points)) break;
+	}
+
+	if (score == Score) return;
+	Score = score;
+
+	if (auto* sys = UGameSubSys::Get(this)) {
+		sys->ProvisionalScoreChanged.Broadcast(Score.Winner, Score.Points);
+	}
+}
+
+int APuckManager::FindZone(const FVector& location) const
+{
+	return Zones.FindZone(location);
+}
+
+int APuckManager::GetPointsAt(const FVector& location) const
+{
+	return Zones.GetPoints(location);
+}
+
+bool APuckManager::IsInKillingVolume(const FBox& box) const
+{
+	return KillBox.Intersect(box);
+}
+
+void APuckManager::Tick(float deltaTime)
+{
+	Super::Tick(deltaTime);
+	StepPhysics(deltaTime);
+
+	// custom physics has to be requested every frame, it then runs for each step
+	// (this ticks pre-physics so there's no overlap with the callback)
+	for (APuck* p : InPlay) {
+		if (p->IsSpinning()) {
+			p->GetPuck()->GetBodyInstance()->AddCustomPhysics(p->OnSubstepPhysics);
+		}
+	}
+
+	if (EarlyRest && InPlay.Num()) {
+		CommitEarlyRests();
+	}
+}
+
+void APuckManager::StepPhysics(float deltaTime)
+{
+#if WITH_PHYSX
+	FPhysScene* scene = GetWorld()->GetPhysicsScene();
+	const auto* settings = UPhysicsSettings::Get();
+	if (!scene || !settings->bSubstepping) return;
+
+	// the engine splits the whole frame evenly, so a 30 fps frame (or a jittery one) would step
+	// differently than a 120 fps one - instead only whole `step`s of game time are simulated
+	// and the rest carries over to the next frame
+	const float step = settings->MaxSubstepDeltaTime;
+	const int maxSteps = FMath::Clamp(FMath::FloorToInt(settings->MaxPhysicsDeltaTime / step + KINDA_SMALL_NUMBER),
+		1, settings->MaxSubsteps);
+	PhysicsTime += deltaTime;
+	int steps = FMath::FloorToInt(PhysicsTime / step);
+	PhysicsTime -= steps * step;
+	steps = FMath::Min(steps, maxSteps); // a hitch: drop the time like the engine's clamp would
+
+	// overrides what the world set up for this frame (`UWorld::SetupPhysicsTickFunctions`), the
+	// substep limit is padded so float rounding can't turn `steps` into `steps + 1` substeps
+	const FVector gravity(0.f, 0.f, GetWorld()->GetGravityZ());
+	scene->SetUpForFrame(&gravity, steps * step, maxSteps * step, step * 1.001f, FMath::Max(steps, 1));
+#endif
+}
+
+void APuckManager::CommitEarlyRests()
+{
+	// right after the throw the impulse isn't in the velocity yet
+	if (!Thrown || GetWorld()->GetTimeSeconds() - Thrown->ThrowTime < .25f/*sec*/) return;
+
+	// where each puck can still get to: a disc around it as wide as its remaining slide
+	struct FReach
+	{
+		APuck* Puck;
+		FVector2D Position;
+		FVector2D Rest;
+		float Slide;
+		bool bMoving;
+	};
+	TArray<FReach, TInlineAllocator<ERound::TotalThrows>> reach;
+	for (APuck* p : Pucks) {
+		if (p->State == EPuckState::Setup) continue;
+
+		FReach& r = reach.AddDefaulted_GetRef();
+		r.Puck = p;
+		r.Position = r.Rest = FVector2D(p->GetActorLocation());
+		r.Slide = 0.f;
+		r.bMoving = InPlay.Contains(p);
+		if (r.bMoving) {
+			const FVector2D velocity(p->GetPuck()->GetPhysicsLinearVelocity());
+			const float speed = velocity.Size();
+			float time;
+			PuckSim::StoppingTimeAndDistance(SimParams, speed, time, r.Slide);
+			if (speed > KINDA_SMALL_NUMBER) {
+				r.Rest += velocity / speed * r.Slide;
+			}
+		}
+	}
+
+	for (const FReach& r : reach) {
+		APuck* p = r.Puck;
+		if (!r.bMoving || r.Slide > EarlyRestSnap) continue;
+		if (p->IsSpinning()) continue;
+		// spin to come, only for the current throw: a spun puck knocked awake later is `Traveling` again
+		if (p == Thrown && p->State == EPuckState::Traveling && p->ThrowMode == EPuckThrowMode::WithSpin) continue;
+		if (!Layout.Surface.IsInside(r.Rest)) continue; // going over the edge, let it fall
+
+		bool clear = true;
+		for (const FReach& other : reach) {
+			if (&other == &r) continue;
+			const float room = 2.f * p->Radius + r.Slide + other.Slide + EarlyRestClearance;
+			if (FVector2D::DistSquared(r.Position, other.Position) <= room * room) {
+				clear = false;
+				break;
+			}
+		}
+		if (!clear) continue;
+
+		auto* body = p->GetPuck();
+		body->SetPhysicsLinearVelocity(FVector::ZeroVector);
+		body->SetPhysicsAngularVelocityInRadians(FVector::ZeroVector);
+		p->SetActorLocation(FVector(r.Rest, p->GetActorLocation().Z),
+			false/*sweep*/, nullptr, ETeleportType::TeleportPhysics);
+		body->PutRigidBodyToSleep();
+		OnPuckSleep(p); // don't depend on the sleep notification for API sleeps
+	}
+}
@@ -0,0 +1,165 @@
+// Copyright (C) 2020 Valentin Galea
+//
+// This program is free software : you can redistribute it and /or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameFramework/Actor.h"
+
+#include "Def.h"
+#include "PuckSim.h"
+#include "ScoringVolume.h"
+#include "ThrowDataset.h"
+
+#include "PuckManager.generated.h"
+
+DECLARE_MULTICAST_DELEGATE_OneParam(FEvent_PucksRested, int /*turnId of the throw*/);
+
+//
+// Owns the list of live pucks and tracks the ones in play from the physics sleep/wake
+// notifications (no polling, settled pucks cost nothing). Once the last one goes to
+// sleep `OnPucksRested` fires, once per throw. Scene lookups are cached at level load.
+//
+// One per world, spawned by the game mode and reachable via `AShufflGameState`
+//
+// Fixed step physics: every frame, before physics, the scene is set up to advance in whole
+// `MaxSubstepDeltaTime` steps of game time with the remainder carried to the next frame,
+// so a throw plays out the same at any frame rate (the spin is counted in those steps).
+//
+// Early rest (optional): a puck whose remaining slide is tiny and can't reach any other
+// puck or the table edge is stopped where the friction model says it would, instead of
+// waiting for PhysX to put it to sleep - the last crawl, the sleep threshold and the
+// scoring pause are what make a turn drag on, not the throw itself. The jump is capped
+// by `EarlyRestSnap` so it stays invisible; the `TimeResting` pause is skipped too.
+//
+UCLASS(NotPlaceable, Transient, Config = Game)
+class SHUFFL_API APuckManager : public AActor
+{
+	GENERATED_BODY()
+
+public:
+	APuckManager();
+
+	UPROPERTY(Config, EditAnywhere, Category = EarlyRest)
+	bool EarlyRest = false;
+
+	/** cm, longest remaining slide that gets cut short (how far the puck jumps) */
+	UPROPERTY(Config, EditAnywhere, Category = EarlyRest)
+	float EarlyRestSnap = 1.f;
+
+	/** cm, room required around the other pucks on top of the slides */
+	UPROPERTY(Config, EditAnywhere, Category = EarlyRest)
+	float EarlyRestClearance = 1.f;
+
+	static APuckManager* Get(const UObject* context);
+
+	/** pool of pucks created up front, no spawning/destroying during a match */
+	void Prewarm(UClass* puckClass, int count);
+	class APuck* Acquire(UClass* puckClass, const FVector& location);
+	void Release(class APuck*);
+
+	/** makes sure the starting point is free before acquiring the next puck */
+	void ClearStartArea();
+
+	void Register(class APuck*);
+	void Unregister(class APuck*);
+	void OnThrown(class APuck*);
+	void OnSpin(class APuck*);
+	void OnPuckSleep(class APuck*);
+	void OnPuckWake(class APuck*);
+	void OnPuckMoved(class APuck*); // teleported while at rest (e.g. network sync)
+
+	FEvent_PucksRested OnPucksRested;
+
+	const TArray<class APuck*>& GetPucks() const { return Pucks; }
+	const FPuckTableLayout& GetLayout() const { return Layout; }
+	class ASceneProps* GetSceneProps() const { return SceneProps; }
+	const FScoringZones& GetZones() const { return Zones; }
+
+	/** score of the round so far, from the rested pucks (kept up to date as they settle) */
+	const FRoundScore& GetRoundScore() const { return Score; }
+	bool HasPucksInPlay() const { return InPlay.Num() > 0; }
+	void RankAll(); // from where the pucks are right now, rested or not
+
+	/** the round's throws get their outcome and go to the dataset (if recording) */
+	void EndRound();
+
+	/** index of the first scoring volume containing the point or INDEX_NONE */
+	int FindZone(const FVector&) const;
+	int GetPointsAt(const FVector&) const;
+	bool IsInKillingVolume(const FBox&) const;
+
+protected:
+	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type) override;
+	virtual void Tick(float) override;
+
+private:
+	void CacheScene();
+	void StepPhysics(float deltaTime);
+	void CheckAllRested();
+	void FinishThrow();
+	void Rank(class APuck*);
+	void Unrank(class APuck*);
+	void UpdateScore();
+	void CommitEarlyRests();
+
+	using FTableSnapshot = TArray<TPair<FVector2D, EPuckColor>, TInlineAllocator<ERound::TotalThrows>>;
+	void SnapshotTable(FTableSnapshot&, const class APuck* except = nullptr) const;
+	void CommitSamples();
+
+	UPROPERTY(Transient)
+	TArray<class APuck*> Pucks;
+
+	UPROPERTY(Transient)
+	TArray<class APuck*> Free; // pooled, parked out of the game
+
+	UPROPERTY(Transient)
+	TArray<class APuck*> StartArea; // might be in the way of the next puck: not thrown or not settled yet
+
+	UPROPERTY(Transient)
+	TArray<class APuck*> InPlay; // physics body awake since the throw
+
+	UPROPERTY(Transient)
+	TArray<class APuck*> Settled; // moved during this throw and went back to sleep
+
+	UPROPERTY(Transient)
+	class APuck* Thrown = nullptr; // nullptr when no throw is in progress
+
+	FTimerHandle FinishTimer;
+	float PhysicsTime = 0.f; // game time not simulated yet, less than a physics step
+
+	UPROPERTY(Transient)
+	class ASceneProps* SceneProps = nullptr;
+
+	FScoringZones Zones;
+	FPuckTableLayout Layout;
+	FPuckSimParams SimParams; // of the puck thrown last
+
+	struct FRankedPuck
+	{
+		class APuck* Puck;
+		float X;
+		int Points;
+	};
+	// rested pucks closest to the edge (furthest X) first
+	TArray<FRankedPuck, TInlineAllocator<ERound::TotalThrows>> Ranked;
+	FRoundScore Score;
+	FBox KillBox = FBox(ForceInit);
+
+	// throws of the current round while recording, see `UGameSubSys::ThrowDataset`
+	TSharedPtr<FThrowDatasetWriter> Dataset;
+	TArray<FThrowSample, TInlineAllocator<ERound::TotalThrows>> RoundSamples;
+};
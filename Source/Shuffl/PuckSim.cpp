@@ -0,0 +1,440 @@
+// Copyright (C) 2020 Valentin Galea
+//
+// This program is free software : you can redistribute it and /or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#include "PuckSim.h"
+
+#include "EngineUtils.h"
+#include "Engine/World.h"
+#include "Components/PrimitiveComponent.h"
+#include "PhysicalMaterials/PhysicalMaterial.h"
+#include "PhysicsEngine/PhysicsSettings.h"
+
+#include "Puck.h"
+#include "ScoringVolume.h"
+#include "SceneProps.h"
+
+FPuckSimParams FPuckSimParams::FromPuck(const APuck* puck)
+{
+	FPuckSimParams params;
+	if (!ensure(puck)) return params;
+
+	params.Radius = puck->Radius;
+
+	if (auto* body = Cast<UPrimitiveComponent>(puck->GetRootComponent())) {
+		params.Mass = body->GetMass();
+		params.LinearDamping = body->GetLinearDamping();
+		// NOTE: the table uses the same PM_Friction material so the (default)
+		// Average combine mode resolves to the puck's own value
+		if (auto* material = body->BodyInstance.GetSimplePhysicalMaterial()) {
+			params.Friction = material->Friction;
+			params.Restitution = material->Restitution;
+		}
+	}
+
+	if (auto* world = puck->GetWorld()) {
+		params.Gravity = -world->GetGravityZ();
+	}
+
+	params.SpinStep = puck->SpinStep;
+	const auto* settings = UPhysicsSettings::Get();
+	params.PhysicsStep = settings->bSubstepping ? settings->MaxSubstepDeltaTime : params.SpinStep;
+
+	return params;
+}
+
+FPuckTableLayout FPuckTableLayout::FromWorld(UWorld* world)
+{
+	FPuckTableLayout layout;
+
+	auto FlatBox = [](const FBox& box) {
+		return FBox2D(FVector2D(box.Min), FVector2D(box.Max));
+	};
+
+	for (auto i = TActorIterator<AScoringVolume>(world); i; ++i) {
+		layout.Surface += FlatBox(i->GetBounds().GetBox());
+	}
+
+	auto iter = TActorIterator<ASceneProps>(world);
+	if (*iter && iter->KillingVolume) {
+		layout.Kill = FlatBox(iter->KillingVolume->GetBounds().GetBox());
+		layout.Surface += layout.Kill;
+	}
+
+	return layout;
+}
+
+void PuckSim::StoppingTimeAndDistance(const FPuckSimParams& params, float speed,
+	float& time, float& dist)
+{
+	const double a = params.Friction * params.Gravity;
+	const double c = params.LinearDamping;
+	const double v = speed;
+
+	if (a <= 0.0) { // no friction, damping only: never truly stops
+		ensure(c > 0.0);
+		time = BIG_NUMBER;
+		dist = float(v / FMath::Max(c, double(KINDA_SMALL_NUMBER)));
+		return;
+	}
+
+	if (c > KINDA_SMALL_NUMBER) {
+		const double t = FMath::Loge(1.0 + c * v / a) / c;
+		time = float(t);
+		dist = float((v - a * t) / c);
+	} else {
+		time = float(v / a);
+		dist = float(v * v / (2.0 * a));
+	}
+}
+
+void PuckSim::Slide(const FPuckSimParams& params, FVector2D& pos, FVector2D& vel, float dt)
+{
+	const float speed = vel.Size();
+	if (speed < KINDA_SMALL_NUMBER) {
+		vel = FVector2D::ZeroVector;
+		return;
+	}
+
+	const FVector2D dir = vel / speed;
+	float stopTime, stopDist;
+	StoppingTimeAndDistance(params, speed, stopTime, stopDist);
+	if (dt >= stopTime) {
+		pos += dir * stopDist;
+		vel = FVector2D::ZeroVector;
+		return;
+	}
+
+	const double a = params.Friction * params.Gravity;
+	const double c = params.LinearDamping;
+	double newSpeed, dist;
+	if (c > KINDA_SMALL_NUMBER) {
+		const double k = speed + a / c;
+		const double e = FMath::Exp(-c * dt);
+		newSpeed = k * e - a / c;
+		dist = (k * (1.0 - e) - a * dt) / c;
+	} else {
+		newSpeed = speed - a * dt;
+		dist = (speed - a * dt / 2.0) * dt;
+	}
+
+	pos += dir * float(dist);
+	vel = dir * float(newSpeed);
+}
+
+void PuckSim::SpinSchedule(const FPuckSimParams& params, float angle, float velocity,
+	int& steps, float& impulse)
+{
+	// what `APuck::ApplySpin` schedules: a `velocity * step` impulse every step for as long
+	// as the accumulated amount is <= |angle * Radius|
+	impulse = velocity * params.SpinStep;
+	if (impulse <= 0.f || angle == 0.f) {
+		steps = 0;
+		return;
+	}
+	steps = FMath::FloorToInt(FMath::Abs(angle * params.Radius) / impulse) + 1;
+}
+
+FPuckRest PuckSim::PredictRest(const FPuckSimParams& params, const FPuckThrow& t)
+{
+	FPuckRest rest;
+	FVector2D pos = t.Start;
+	FVector2D vel = t.Force / params.Mass;
+
+	const float a = params.Friction * params.Gravity;
+	auto SegmentError = [&](const FVector2D& v) {
+		const float h = params.PhysicsStep;
+		return v.Size() * h / 2.f + a * h * h;
+	};
+
+	int spinSteps;
+	float spinImpulse;
+	SpinSchedule(params, t.SpinAngle, t.SpinVelocity, spinSteps, spinImpulse);
+
+	if (spinSteps > 0) {
+		rest.IntegrationError += SegmentError(vel);
+		Slide(params, pos, vel, t.SpinDelay);
+		rest.Time += t.SpinDelay;
+
+		const float dv = (t.SpinAngle >= 0 ? 1.f : -1.f) * spinImpulse / params.Mass;
+		for (int i = 0; i < spinSteps; ++i) {
+			vel.Y += dv;
+			if (i == spinSteps - 1) break; // last one slides all the way below
+			rest.IntegrationError += SegmentError(vel);
+			Slide(params, pos, vel, params.SpinStep);
+			rest.Time += params.SpinStep;
+		}
+	}
+
+	const float speed = vel.Size();
+	if (speed > KINDA_SMALL_NUMBER) {
+		float stopTime, stopDist;
+		StoppingTimeAndDistance(params, speed, stopTime, stopDist);
+		pos += vel / speed * stopDist;
+		rest.Time += stopTime;
+		rest.IntegrationError += SegmentError(vel);
+	}
+
+	rest.Position = pos;
+	return rest;
+}
+
+//
+// Batch simulation
+//
+
+FPuckBatchSim::FPuckBatchSim(const FPuckSimParams& params, const FPuckTableLayout& layout)
+	: Params(params)
+	, Layout(layout)
+{
+}
+
+void FPuckBatchSim::Reset(int numTables)
+{
+	NumTables = numTables;
+	NumLanes = Align(numTables, LaneWidth);
+	const int num = NumLanes * MaxPucks;
+
+	for (FLane* lane : { &PosX, &PosY, &VelX, &VelY, &Alive, &SpinDelay, &SpinSteps, &SpinDv }) {
+		lane->SetNumUninitialized(num, false/*shrink*/);
+		FMemory::Memzero(lane->GetData(), num * sizeof(float));
+	}
+}
+
+void FPuckBatchSim::SetPuck(int table, int slot, FVector2D pos)
+{
+	check(table < NumTables && slot < MaxPucks);
+	const int i = Index(table, slot);
+	PosX[i] = pos.X;
+	PosY[i] = pos.Y;
+	VelX[i] = VelY[i] = 0.f;
+	Alive[i] = 1.f;
+}
+
+void FPuckBatchSim::Throw(int table, int slot, const FPuckThrow& t)
+{
+	SetPuck(table, slot, t.Start);
+	const int i = Index(table, slot);
+	VelX[i] = t.Force.X / Params.Mass;
+	VelY[i] = t.Force.Y / Params.Mass;
+
+	int steps;
+	float impulse;
+	PuckSim::SpinSchedule(Params, t.SpinAngle, t.SpinVelocity, steps, impulse);
+	SpinDelay[i] = t.SpinDelay;
+	SpinSteps[i] = float(steps);
+	SpinDv[i] = (t.SpinAngle >= 0 ? 1.f : -1.f) * impulse / Params.Mass;
+}
+
+bool FPuckBatchSim::IsAlive(int table, int slot) const
+{
+	return Alive[Index(table, slot)] > 0.f;
+}
+
+FVector2D FPuckBatchSim::GetPosition(int table, int slot) const
+{
+	const int i = Index(table, slot);
+	return FVector2D(PosX[i], PosY[i]);
+}
+
+float FPuckBatchSim::Run(float maxTime)
+{
+	//NOTE: the spin is stepped at the physics rate, they are expected to match
+	ensure(FMath::IsNearlyEqual(Params.SpinStep, Params.PhysicsStep, 1e-4f));
+
+	float time = 0.f;
+	while (time < maxTime) {
+		time += Params.PhysicsStep;
+		if (!Step()) break;
+	}
+
+	RemoveKilled();
+	return time;
+}
+
+bool FPuckBatchSim::Step()
+{
+	const float h = Params.PhysicsStep;
+	const VectorRegister Zero = VectorZero();
+	const VectorRegister One = VectorOne();
+	const VectorRegister H = VectorSetFloat1(h);
+	const VectorRegister FrictionStep = VectorSetFloat1(Params.Friction * Params.Gravity * h);
+	const VectorRegister Damping = VectorSetFloat1(1.f / (1.f + Params.LinearDamping * h));
+	const VectorRegister RestSpeedSq = VectorSetFloat1(.0001f); // same as `APuck`
+	const VectorRegister Tiny = VectorSetFloat1(SMALL_NUMBER);
+	const VectorRegister MinX = VectorSetFloat1(Layout.Surface.Min.X);
+	const VectorRegister MinY = VectorSetFloat1(Layout.Surface.Min.Y);
+	const VectorRegister MaxX = VectorSetFloat1(Layout.Surface.Max.X);
+	const VectorRegister MaxY = VectorSetFloat1(Layout.Surface.Max.Y);
+
+	bool slotMoving[MaxPucks];
+	bool anyMoving = false;
+
+	for (int slot = 0; slot < MaxPucks; ++slot) {
+		VectorRegister moving = Zero;
+
+		for (int lane = 0; lane < NumLanes; lane += LaneWidth) {
+			const int i = Index(lane, slot);
+			VectorRegister alive = VectorLoadAligned(&Alive[i]);
+			VectorRegister px = VectorLoadAligned(&PosX[i]);
+			VectorRegister py = VectorLoadAligned(&PosY[i]);
+			VectorRegister vx = VectorLoadAligned(&VelX[i]);
+			VectorRegister vy = VectorLoadAligned(&VelY[i]);
+
+			// spin: train of lateral impulses once the delay expired
+			VectorRegister delay = VectorLoadAligned(&SpinDelay[i]);
+			VectorRegister steps = VectorLoadAligned(&SpinSteps[i]);
+			const VectorRegister spinning = VectorBitwiseAnd(
+				VectorCompareLE(delay, Zero), VectorCompareGT(steps, Zero));
+			vy = VectorAdd(vy, VectorSelect(spinning, VectorLoadAligned(&SpinDv[i]), Zero));
+			steps = VectorSubtract(steps, VectorSelect(spinning, One, Zero));
+			delay = VectorSubtract(delay, H);
+			VectorStoreAligned(delay, &SpinDelay[i]);
+			VectorStoreAligned(steps, &SpinSteps[i]);
+
+			// friction & damping: |v| -= a*h (clamped to 0) then v /= (1 + c*h)
+			const VectorRegister speedSq = VectorMultiplyAdd(vx, vx, VectorMultiply(vy, vy));
+			const VectorRegister invSpeed = VectorReciprocalSqrtAccurate(VectorMax(speedSq, Tiny));
+			VectorRegister scale = VectorMax(VectorSubtract(One,
+				VectorMultiply(FrictionStep, invSpeed)), Zero);
+			scale = VectorMultiply(VectorMultiply(scale, Damping), alive);
+			vx = VectorMultiply(vx, scale);
+			vy = VectorMultiply(vy, scale);
+
+			// semi-implicit Euler like PhysX
+			px = VectorMultiplyAdd(vx, H, px);
+			py = VectorMultiplyAdd(vy, H, py);
+
+			// fell off the table
+			const VectorRegister onTable = VectorBitwiseAnd(
+				VectorBitwiseAnd(VectorCompareGT(px, MinX), VectorCompareLT(px, MaxX)),
+				VectorBitwiseAnd(VectorCompareGT(py, MinY), VectorCompareLT(py, MaxY)));
+			alive = VectorSelect(onTable, alive, Zero);
+			vx = VectorMultiply(vx, alive);
+			vy = VectorMultiply(vy, alive);
+
+			moving = VectorBitwiseOr(moving,
+				VectorCompareGT(VectorMultiplyAdd(vx, vx, VectorMultiply(vy, vy)), RestSpeedSq));
+			moving = VectorBitwiseOr(moving,
+				VectorBitwiseAnd(VectorCompareGT(steps, Zero), VectorCompareGT(alive, Zero)));
+
+			VectorStoreAligned(alive, &Alive[i]);
+			VectorStoreAligned(px, &PosX[i]);
+			VectorStoreAligned(py, &PosY[i]);
+			VectorStoreAligned(vx, &VelX[i]);
+			VectorStoreAligned(vy, &VelY[i]);
+		}
+
+		slotMoving[slot] = VectorMaskBits(moving) != 0;
+		anyMoving |= slotMoving[slot];
+	}
+
+	if (anyMoving) {
+		Collide(slotMoving);
+	}
+	return anyMoving;
+}
+
+void FPuckBatchSim::Collide(const bool* slotMoving)
+{
+	const VectorRegister Zero = VectorZero();
+	const VectorRegister Tiny = VectorSetFloat1(SMALL_NUMBER);
+	const VectorRegister Diameter = VectorSetFloat1(Params.Radius * 2.f);
+	const VectorRegister DiameterSq = VectorSetFloat1(FMath::Square(Params.Radius * 2.f));
+	const VectorRegister Bounce = VectorSetFloat1(-(1.f + Params.Restitution) / 2.f);
+	const VectorRegister Half = VectorSetFloat1(.5f);
+
+	for (int a = 0; a < MaxPucks; ++a) {
+		for (int b = a + 1; b < MaxPucks; ++b) {
+			if (!slotMoving[a] && !slotMoving[b]) continue; // nothing can hit
+
+			for (int lane = 0; lane < NumLanes; lane += LaneWidth) {
+				const int i = Index(lane, a);
+				const int j = Index(lane, b);
+
+				VectorRegister pxi = VectorLoadAligned(&PosX[i]);
+				VectorRegister pyi = VectorLoadAligned(&PosY[i]);
+				VectorRegister pxj = VectorLoadAligned(&PosX[j]);
+				VectorRegister pyj = VectorLoadAligned(&PosY[j]);
+
+				const VectorRegister dx = VectorSubtract(pxj, pxi);
+				const VectorRegister dy = VectorSubtract(pyj, pyi);
+				const VectorRegister distSq = VectorMultiplyAdd(dx, dx, VectorMultiply(dy, dy));
+
+				VectorRegister contact = VectorBitwiseAnd(
+					VectorCompareLT(distSq, DiameterSq), VectorCompareGT(distSq, Tiny));
+				contact = VectorBitwiseAnd(contact, VectorBitwiseAnd(
+					VectorCompareGT(VectorLoadAligned(&Alive[i]), Zero),
+					VectorCompareGT(VectorLoadAligned(&Alive[j]), Zero)));
+				if (!VectorMaskBits(contact)) continue;
+
+				const VectorRegister invDist = VectorReciprocalSqrtAccurate(VectorMax(distSq, Tiny));
+				const VectorRegister nx = VectorMultiply(dx, invDist);
+				const VectorRegister ny = VectorMultiply(dy, invDist);
+
+				VectorRegister vxi = VectorLoadAligned(&VelX[i]);
+				VectorRegister vyi = VectorLoadAligned(&VelY[i]);
+				VectorRegister vxj = VectorLoadAligned(&VelX[j]);
+				VectorRegister vyj = VectorLoadAligned(&VelY[j]);
+
+				// equal masses: each takes half of the normal impulse, only when approaching
+				const VectorRegister vn = VectorMultiplyAdd(VectorSubtract(vxj, vxi), nx,
+					VectorMultiply(VectorSubtract(vyj, vyi), ny));
+				const VectorRegister approaching = VectorBitwiseAnd(contact, VectorCompareLT(vn, Zero));
+				const VectorRegister impulse = VectorSelect(approaching, VectorMultiply(vn, Bounce), Zero);
+				vxi = VectorSubtract(vxi, VectorMultiply(impulse, nx));
+				vyi = VectorSubtract(vyi, VectorMultiply(impulse, ny));
+				vxj = VectorAdd(vxj, VectorMultiply(impulse, nx));
+				vyj = VectorAdd(vyj, VectorMultiply(impulse, ny));
+
+				// push apart the penetration
+				const VectorRegister dist = VectorMultiply(distSq, invDist);
+				const VectorRegister push = VectorSelect(contact,
+					VectorMultiply(VectorSubtract(Diameter, dist), Half), Zero);
+				pxi = VectorSubtract(pxi, VectorMultiply(push, nx));
+				pyi = VectorSubtract(pyi, VectorMultiply(push, ny));
+				pxj = VectorAdd(pxj, VectorMultiply(push, nx));
+				pyj = VectorAdd(pyj, VectorMultiply(push, ny));
+
+				VectorStoreAligned(pxi, &PosX[i]);
+				VectorStoreAligned(pyi, &PosY[i]);
+				VectorStoreAligned(pxj, &PosX[j]);
+				VectorStoreAligned(pyj, &PosY[j]);
+				VectorStoreAligned(vxi, &VelX[i]);
+				VectorStoreAligned(vyi, &VelY[i]);
+				VectorStoreAligned(vxj, &VelX[j]);
+				VectorStoreAligned(vyj, &VelY[j]);
+			}
+		}
+	}
+}
+
+void FPuckBatchSim::RemoveKilled()
+{
+	if (!Layout.Kill.bIsValid) return;
+
+	// same test as `APuck::OnResting`: puck bounds touching the killing volume
+	const FVector2D extent(Params.Radius, Params.Radius);
+	for (int slot = 0; slot < MaxPucks; ++slot) {
+		for (int table = 0; table < NumTables; ++table) {
+			const int i = Index(table, slot);
+			if (Alive[i] == 0.f) continue;
+
+			const FVector2D p(PosX[i], PosY[i]);
+			if (Layout.Kill.Intersect(FBox2D(p - extent, p + extent))) {
+				Alive[i] = 0.f;
+			}
+		}
+	}
+}
@@ -0,0 +1,154 @@
+// Copyright (C) 2020 Valentin Galea
+//
+// This program is free software : you can redistribute it and /or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "Def.h"
+
+//
+// Analytic model of a lone puck sliding on the (flat) table
+//
+// PhysX resolves the puck-table contact as a constant Coulomb friction deceleration
+// `a = mu * g` opposing the velocity, on top of the body's linear damping `c * v`.
+// Between two impulses the direction of travel can't change so `dv/dt = -a - c * v`
+// integrates in closed form:
+//   v(t) = (v0 + a/c) * exp(-c*t) - a/c
+//   stop time t* = ln(1 + c*v0/a) / c
+//   distance  d* = (v0 - a*t*) / c            (-> v0^2 / 2a when c -> 0)
+// The spin is a train of lateral impulses, one per physics step (see `APuck::SubstepPhysics`)
+// so a throw is just a handful of these closed form segments - no frame by frame stepping.
+//
+// `FPuckRest::IntegrationError` only bounds the time discretisation: PhysX integrates
+// semi-implicit Euler, which under-shoots the continuous distance by at most `v0 * h / 2`
+// per segment plus a `a * h^2` term for the final partial step (`h` physics step).
+// It says nothing about where PhysX differs from the model itself - the contact solver,
+// the sleep threshold stopping the puck a little early, the angular coupling of the spin
+// torque (not modeled) - that deviation is measured against the real thing with
+// `Shuffl.SimCheck` (runs the same throws through `ShadowScene`).
+//
+
+struct FPuckSimParams
+{
+	float Mass = 1.f; // kg
+	float Friction = .2f; // effective coefficient i.e. after material combine
+	float LinearDamping = .01f;
+	float Gravity = 980.f; // cm/s^2 (positive)
+	float Radius = 2.5f; // cm
+	float Restitution = .5f; // puck vs puck
+
+	/** sec, fixed step the PhysX scene is advanced with (`APuckManager::StepPhysics`) - only affects `IntegrationError` */
+	float PhysicsStep = 1.f / 60.f;
+
+	/** sec, fixed step at which spin impulses are fed to the puck (`APuck::SpinStep`) */
+	float SpinStep = 1.f / 60.f;
+
+	static FPuckSimParams FromPuck(const class APuck*);
+};
+
+/** the static parts of the table, in world space */
+struct FPuckTableLayout
+{
+	/** playing surface, pucks going past it fall off the table */
+	FBox2D Surface = FBox2D(ForceInit);
+
+	/** see `AKillingVolume` - pucks that come to rest touching it are removed */
+	FBox2D Kill = FBox2D(ForceInit);
+
+	//NOTE: the surface is not an actor on its own so it's taken as the extent of
+	// the scoring and killing volumes (which span the full table width)
+	static FPuckTableLayout FromWorld(class UWorld*);
+};
+
+struct FPuckThrow
+{
+	FVector2D Start = FVector2D::ZeroVector;
+	FVector2D Force = FVector2D::ZeroVector; // as given to `APuck::ApplyThrow`
+	float SpinAngle = 0.f; // as given to `APuck::ApplySpin`
+	float SpinVelocity = 0.f;
+	float SpinDelay = 0.f; // sec between throw and spin
+};
+
+struct FPuckRest
+{
+	FVector2D Position = FVector2D::ZeroVector;
+	float Time = 0.f; // sec until the puck stops
+	float IntegrationError = 0.f; // cm, bound of the discretisation only (see above)
+};
+
+namespace PuckSim
+{
+	/** advance a freely sliding puck for `dt` seconds (or until it stops) - exact for the model */
+	void Slide(const FPuckSimParams&, FVector2D& pos, FVector2D& vel, float dt);
+
+	/** time and distance for a puck at `speed` to come to rest */
+	void StoppingTimeAndDistance(const FPuckSimParams&, float speed, float& time, float& dist);
+
+	/** impulse and number of spin steps `APuck` will feed for a given spin */
+	void SpinSchedule(const FPuckSimParams&, float angle, float velocity, int& steps, float& impulse);
+
+	/** full throw resolution, costs a few exp/log and (usually) a single spin step */
+	FPuckRest PredictRest(const FPuckSimParams&, const FPuckThrow&);
+}
+
+//
+// Structure of arrays simulator for many independent tables at once
+//
+// Each table is a SIMD lane and each throw order (`TurnId` within a round) a slot:
+// arrays are laid out [slot][table] so one vector op advances the same puck on 4 tables.
+// Stepping mirrors what PhysX does with a lone puck (see above) plus:
+// - equal mass puck vs puck impacts with `Restitution`, resolved pairwise per step
+// - pucks leaving the `Surface` fall off, resting ones touching `Kill` get removed
+//
+class FPuckBatchSim
+{
+public:
+	static constexpr int MaxPucks = ERound::TotalThrows;
+	static constexpr int LaneWidth = 4; // sizeof(VectorRegister) / sizeof(float)
+
+	FPuckBatchSim(const FPuckSimParams&, const FPuckTableLayout&);
+
+	/** clears all tables, no heap traffic if `numTables` doesn't grow */
+	void Reset(int numTables);
+	int GetNumTables() const { return NumTables; }
+
+	void SetPuck(int table, int slot, FVector2D pos); // already resting
+	void Throw(int table, int slot, const FPuckThrow&);
+
+	/** steps until every puck on every table rests or `maxTime` passes, returns time simulated */
+	float Run(float maxTime = 15.f);
+
+	bool IsAlive(int table, int slot) const;
+	FVector2D GetPosition(int table, int slot) const;
+
+	const FPuckSimParams Params;
+	const FPuckTableLayout Layout;
+
+private:
+	bool Step();
+	void Collide(const bool* slotMoving);
+	void RemoveKilled();
+
+	int Index(int table, int slot) const { return slot * NumLanes + table; }
+
+	int NumTables = 0;
+	int NumLanes = 0; // tables rounded up to `LaneWidth`
+
+	using FLane = TArray<float, TAlignedHeapAllocator<16>>;
+	FLane PosX, PosY, VelX, VelY;
+	FLane Alive; // 1 or 0
+	FLane SpinDelay, SpinSteps, SpinDv;
+};
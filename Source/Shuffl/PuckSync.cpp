@@ -0,0 +1,138 @@
+// Copyright (C) 2020 Valentin Galea
+//
+// This program is free software : you can redistribute it and /or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#include "PuckSync.h"
+
+#include "Shuffl.h"
+#include "PuckSim.h"
+#include "XMPPMessage.h"
+
+FVector2D PuckSync::GetOrigin(const FPuckTableLayout& layout)
+{
+	return FVector2D(FMath::FloorToFloat(layout.Surface.Min.X), FMath::FloorToFloat(layout.Surface.Min.Y));
+}
+
+FIntPoint PuckSync::Quantize(FVector2D location, FVector2D origin)
+{
+	const FVector2D q = (location - origin) / Step;
+	return FIntPoint(
+		FMath::Clamp(FMath::RoundToInt(q.X), 0, int32(MAX_uint16)),
+		FMath::Clamp(FMath::RoundToInt(q.Y), 0, int32(MAX_uint16)));
+}
+
+FVector2D PuckSync::Dequantize(FIntPoint q, FVector2D origin)
+{
+	return origin + FVector2D(q.X, q.Y) * Step;
+}
+
+const FIntPoint* FPuckSyncSnapshot::Find(int turnId) const
+{
+	for (const auto& i : Pucks) {
+		if (i.Key == turnId) return &i.Value;
+	}
+	return nullptr;
+}
+
+void FPuckSyncSnapshot::Set(int turnId, FIntPoint q)
+{
+	int i = 0;
+	while (i < Pucks.Num() && Pucks[i].Key < turnId) i++;
+	if (i < Pucks.Num() && Pucks[i].Key == turnId) {
+		Pucks[i].Value = q;
+	} else {
+		Pucks.Insert(TPair<int, FIntPoint>(turnId, q), i);
+	}
+}
+
+void FPuckSyncSnapshot::Remove(int turnId)
+{
+	Pucks.RemoveAll([turnId](const auto& i) { return i.Key == turnId; });
+}
+
+bool FPuckSyncSender::Build(const FPuckSyncSnapshot& current, int onlyTurnId, FXMPPSyncDelta& out)
+{
+	// the other side is too far behind (or lost a base), start over from the empty table
+	if (Pending.Num() == MaxPending) {
+		Acked = FPuckSyncSnapshot();
+		Pending.Reset();
+	}
+	const FPuckSyncSnapshot& base = Acked;
+
+	FPuckSyncSnapshot next = base;
+	out = FXMPPSyncDelta();
+	out.Base = base.Sequence;
+	out.bFullTable = onlyTurnId < 0;
+
+	for (const auto& puck : current.Pucks) {
+		if (onlyTurnId >= 0 && puck.Key != onlyTurnId) continue;
+
+		const FIntPoint* was = base.Find(puck.Key);
+		if (was && FMath::Max(FMath::Abs(puck.Value.X - was->X), FMath::Abs(puck.Value.Y - was->Y)) <= PuckSync::Epsilon) continue;
+
+		out.Entries.Add({ puck.Key, false, was ? puck.Value - *was : puck.Value });
+		next.Set(puck.Key, puck.Value);
+	}
+	for (const auto& puck : base.Pucks) {
+		if (!current.Find(puck.Key)) {
+			out.Entries.Add({ puck.Key, true, FIntPoint::ZeroValue });
+			next.Remove(puck.Key);
+		}
+	}
+	if (!out.Entries.Num()) return false;
+
+	out.Entries.Sort([](const auto& a, const auto& b) { return a.TurnId < b.TurnId; });
+	out.Sequence = next.Sequence = NextSequence;
+	NextSequence = NextSequence == MAX_uint16 ? 1 : NextSequence + 1;
+	Pending.Add(MoveTemp(next));
+	return true;
+}
+
+void FPuckSyncSender::OnAck(uint16 sequence)
+{
+	const int i = Pending.IndexOfByPredicate([sequence](const auto& s) { return s.Sequence == sequence; });
+	if (i == INDEX_NONE) return; // late, already superseded
+
+	Acked = MoveTemp(Pending[i]);
+	Pending.RemoveAt(0, i + 1);
+}
+
+bool FPuckSyncReceiver::Apply(const FXMPPSyncDelta& delta, FPuckSyncSnapshot& out)
+{
+	if (delta.Base) {
+		const auto* base = History.FindByPredicate([&delta](const auto& s) { return s.Sequence == delta.Base; });
+		if (!base) return false;
+		out = *base;
+	} else {
+		out = FPuckSyncSnapshot();
+	}
+
+	// the base decides what's a delta and what's a new puck, same as on the sender
+	const FPuckSyncSnapshot base = out;
+	for (const auto& e : delta.Entries) {
+		if (e.bRemoved) {
+			out.Remove(e.TurnId);
+		} else {
+			const FIntPoint* was = base.Find(e.TurnId);
+			out.Set(e.TurnId, was ? *was + e.Delta : e.Delta);
+		}
+	}
+	out.Sequence = delta.Sequence;
+
+	if (History.Num() == MaxHistory) {
+		History.RemoveAt(0);
+	}
+	History.Add(out);
+	return true;
+}
@@ -0,0 +1,91 @@
+// Copyright (C) 2020 Valentin Galea
+//
+// This program is free software : you can redistribute it and /or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "Def.h"
+
+//
+// Puck positions for the XMPP sync, quantized and sent as deltas
+//
+// Resting pucks lie flat on the table so only X and Y travel, as 1/64 cm steps from the
+// table's corner (16 bits cover 10 m at ~0.16 mm). The host keeps the last table state
+// the other side acknowledged and sends only the pucks that are new, moved by more than
+// `Epsilon` or are gone, each relative to its acknowledged position (see `FXMPPSyncDelta`
+// for the packing). The receiver keeps the states it acknowledged so it can rebuild the
+// full table from any of them. A sync of the whole table snaps every puck to it; one for a
+// single puck that came to rest only snaps the pucks it names, the others may still be
+// sliding (or be newer than the base, in a sync that's not acknowledged yet).
+//
+// A base the receiver no longer has simply doesn't get acknowledged; once too many syncs
+// are waiting the host starts over from an empty base, i.e. sends the table in full.
+//
+
+namespace PuckSync
+{
+	static constexpr float Step = 1.f / 64.f; // cm
+	static constexpr int32 Epsilon = 3; // steps, ~0.5 mm
+	static constexpr int MaxPucks = ERound::TotalThrows;
+
+	/** table corner both sides agree on, whole cm so it's the same everywhere */
+	FVector2D GetOrigin(const struct FPuckTableLayout&);
+
+	FIntPoint Quantize(FVector2D location, FVector2D origin);
+	FVector2D Dequantize(FIntPoint, FVector2D origin);
+}
+
+struct FPuckSyncSnapshot
+{
+	uint16 Sequence = 0; // 0 is the empty table everyone starts from
+	TArray<TPair<int, FIntPoint>, TInlineAllocator<PuckSync::MaxPucks>> Pucks; // turn id, sorted
+
+	const FIntPoint* Find(int turnId) const;
+	void Set(int turnId, FIntPoint);
+	void Remove(int turnId);
+};
+
+/** host side */
+class FPuckSyncSender
+{
+public:
+	static constexpr int MaxPending = 16;
+
+	/**
+	 * delta from the acknowledged state to `current` (all the pucks on the table, any order),
+	 * only `onlyTurnId` is looked at for changes if not negative; false if there's nothing to send
+	 */
+	bool Build(const FPuckSyncSnapshot& current, int onlyTurnId, struct FXMPPSyncDelta& out);
+	void OnAck(uint16 sequence);
+
+private:
+	FPuckSyncSnapshot Acked;
+	TArray<FPuckSyncSnapshot, TInlineAllocator<MaxPending>> Pending; // oldest first
+	uint16 NextSequence = 1;
+};
+
+/** receiving side */
+class FPuckSyncReceiver
+{
+public:
+	static constexpr int MaxHistory = FPuckSyncSender::MaxPending + 1; // + the acknowledged one
+
+	/** the full table after the delta, false if its base is unknown (don't acknowledge) */
+	bool Apply(const struct FXMPPSyncDelta&, FPuckSyncSnapshot& out);
+
+private:
+	TArray<FPuckSyncSnapshot, TInlineAllocator<MaxHistory>> History; // oldest first
+};
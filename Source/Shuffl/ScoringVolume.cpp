@@ -0,0 +1,126 @@
+// Copyright (C) 2020 Valentin Galea
+//
+// This program is free software : you can redistribute it and /or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#include "ScoringVolume.h"
+
+#include "EngineUtils.h"
+#include "Algo/BinarySearch.h"
+#include "Math/VectorRegister.h"
+
+FScoringZones FScoringZones::FromWorld(UWorld* world)
+{
+	FScoringZones zones;
+	for (auto i = TActorIterator<AScoringVolume>(world); i; ++i) {
+		zones.Add(i->GetBounds().GetBox(), i->PointsAwarded);
+	}
+	zones.Bake();
+	return zones;
+}
+
+void FScoringZones::Add(const FBox& box, int points)
+{
+	if (!ensureMsgf(Boxes.Num() < MaxZones, TEXT("too many scoring volumes"))) return;
+	Boxes.Add(box);
+	Points.Add(points);
+}
+
+void FScoringZones::Bake()
+{
+	EdgesX.Reset();
+	for (const FBox& box : Boxes) {
+		EdgesX.AddUnique(box.Min.X);
+		EdgesX.AddUnique(box.Max.X);
+	}
+	EdgesX.Sort();
+
+	// slot 2k is the open interval (edge k-1, edge k), slot 2k+1 is edge k itself
+	const int numEdges = EdgesX.Num();
+	SlotMasks.Reset();
+	SlotMasks.AddZeroed(2 * numEdges + 1);
+	for (int zone = 0; zone < Boxes.Num(); ++zone) {
+		const FBox& box = Boxes[zone];
+		for (int k = 0; k < numEdges; ++k) {
+			if (k > 0 && box.Min.X <= EdgesX[k - 1] && box.Max.X >= EdgesX[k]) {
+				SlotMasks[2 * k] |= 1u << zone;
+			}
+			if (box.Min.X < EdgesX[k] && EdgesX[k] < box.Max.X) {
+				SlotMasks[2 * k + 1] |= 1u << zone;
+			}
+		}
+	}
+}
+
+int FScoringZones::FindZone(const FVector& location) const
+{
+	const int less = Algo::LowerBound(EdgesX, location.X); // edges strictly below
+	const bool onEdge = less < EdgesX.Num() && EdgesX[less] == location.X;
+
+	uint32 mask = SlotMasks.Num() ? SlotMasks[2 * less + (onEdge ? 1 : 0)] : 0;
+	while (mask) {
+		const int zone = FMath::CountTrailingZeros(mask);
+		mask &= mask - 1;
+
+		const FBox& box = Boxes[zone];
+		if (location.Y > box.Min.Y && location.Y < box.Max.Y &&
+			location.Z > box.Min.Z && location.Z < box.Max.Z) {
+			return zone;
+		}
+	}
+
+	return INDEX_NONE;
+}
+
+int FScoringZones::GetPoints(const FVector& location) const
+{
+	const int zone = FindZone(location);
+	return zone == INDEX_NONE ? 0 : Points[zone];
+}
+
+void FScoringZones::GetPoints(const float* x, const float* y, float z, int num, int* outPoints) const
+{
+	int i = 0;
+
+	// 4 at a time: all zones tested per lane, walked backwards so the first one wins
+	const VectorRegister Z = VectorSetFloat1(z);
+	for (; i + 4 <= num; i += 4) {
+		const VectorRegister px = VectorLoad(&x[i]);
+		const VectorRegister py = VectorLoad(&y[i]);
+		VectorRegister points = VectorZero();
+
+		for (int zone = Boxes.Num() - 1; zone >= 0; --zone) {
+			const FBox& box = Boxes[zone];
+			VectorRegister inside = VectorBitwiseAnd(
+				VectorCompareGT(px, VectorSetFloat1(box.Min.X)),
+				VectorCompareLT(px, VectorSetFloat1(box.Max.X)));
+			inside = VectorBitwiseAnd(inside, VectorBitwiseAnd(
+				VectorCompareGT(py, VectorSetFloat1(box.Min.Y)),
+				VectorCompareLT(py, VectorSetFloat1(box.Max.Y))));
+			inside = VectorBitwiseAnd(inside, VectorBitwiseAnd(
+				VectorCompareGT(Z, VectorSetFloat1(box.Min.Z)),
+				VectorCompareLT(Z, VectorSetFloat1(box.Max.Z))));
+			points = VectorSelect(inside, VectorSetFloat1(float(Points[zone])), points);
+		}
+
+		float out[4];
+		VectorStore(points, out);
+		for (int lane = 0; lane < 4; ++lane) {
+			outPoints[i + lane] = int(out[lane]);
+		}
+	}
+
+	for (; i < num; ++i) {
+		outPoints[i] = GetPoints(FVector(x[i], y[i], z));
+	}
+}
@@ -17,6 +17,9 @@
 
 #include "CoreMinimal.h"
 #include "Engine/TriggerVolume.h"
+
+#include "Def.h"
+
 #include "ScoringVolume.generated.h"
 
 UCLASS()
@@ -35,4 +38,82 @@ class SHUFFL_API AKillingVolume : public ATriggerVolume
 	GENERATED_BODY()
 
 public:
-};
\ No newline at end of file
+};
+
+//
+// Scoring volumes baked into a lookup table at level load
+//
+// The box edges along the lane (X) split it into intervals, each slot keeping a bitmask
+// of the zones spanning it (the edges themselves get their own slot since `FBox::IsInside`
+// is strict). A lookup is a binary search over a handful of edges plus the Y/Z test of the
+// candidates in level order, so results match iterating the volumes, borders included.
+//
+struct SHUFFL_API FScoringZones
+{
+	static constexpr int MaxZones = 32; // bits in a slot mask
+
+	static FScoringZones FromWorld(class UWorld*);
+
+	/** zones are matched in the order they were added, call `Bake` after */
+	void Add(const FBox&, int points);
+	void Bake();
+
+	/** index of the first zone containing the point or INDEX_NONE */
+	int FindZone(const FVector&) const;
+	int GetPoints(const FVector&) const;
+
+	/** batch version of the above for positions at the same height, SoA layout */
+	void GetPoints(const float* x, const float* y, float z, int num, int* outPoints) const;
+
+	int Num() const { return Boxes.Num(); }
+	const FBox& GetBox(int zone) const { return Boxes[zone]; }
+	int GetZonePoints(int zone) const { return Points[zone]; }
+
+private:
+	TArray<FBox, TInlineAllocator<4>> Boxes;
+	TArray<int, TInlineAllocator<4>> Points;
+
+	TArray<float, TInlineAllocator<8>> EdgesX; // sorted, unique
+	TArray<uint32, TInlineAllocator<17>> SlotMasks; // 2 * edges + 1
+};
+
+//
+// The round scoring rule, fed with the pucks ordered closest to the edge first:
+// the first scoring puck decides the winner color, then its points add up for every
+// following puck of the same color until the first scoring puck of the other color
+//
+struct SHUFFL_API FRoundScore
+{
+	EPuckColor Winner = EPuckColor::Red; // a default if nothing scored, BP handles it
+	int Points = 0;
+
+	/** returns false once nothing after can count anymore */
+	bool Add(EPuckColor color, int points)
+	{
+		if (bClosed) return false;
+		if (points <= 0) return true;
+
+		if (!bFound) {
+			bFound = true;
+			Winner = color;
+			Points = points;
+		} else if (color == Winner) {
+			Points += points;
+		} else {
+			bClosed = true;
+		}
+		return !bClosed;
+	}
+
+	bool HasWinner() const { return bFound; }
+
+	bool operator==(const FRoundScore& other) const
+	{
+		return bFound == other.bFound && Winner == other.Winner && Points == other.Points;
+	}
+	bool operator!=(const FRoundScore& other) const { return !(*this == other); }
+
+private:
+	bool bFound = false;
+	bool bClosed = false;
+};
@@ -0,0 +1,265 @@
+// Copyright (C) 2020 Valentin Galea
+//
+// This program is free software : you can redistribute it and /or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#include "ShadowScene.h"
+
+#include "EngineUtils.h"
+#include "Async/Async.h"
+#include "Components/PrimitiveComponent.h"
+#include "PhysicsEngine/BodySetup.h"
+#include "GameFramework/PlayerStart.h"
+#if WITH_PHYSX
+#include "PhysXPublic.h"
+#endif
+
+#include "Shuffl.h"
+#include "Puck.h"
+#include "PuckManager.h"
+#include "SceneProps.h"
+
+#if WITH_PHYSX
+using namespace physx;
+
+// creating and releasing SDK level objects is kept serialized between the shadow scenes
+static FCriticalSection SDKLock;
+#endif
+
+struct FShadowGeometry
+{
+#if WITH_PHYSX
+	TArray<PxConvexMesh*, TInlineAllocator<2>> Meshes;
+	FVector Scale = FVector::OneVector;
+
+	~FShadowGeometry()
+	{
+		FScopeLock lock(&SDKLock);
+		for (auto* mesh : Meshes) {
+			mesh->release(); // our reference, the engine keeps its own
+		}
+	}
+
+	void AddShapes(PxRigidActor& actor, const PxMaterial& material) const
+	{
+		for (auto* mesh : Meshes) {
+			PxConvexMeshGeometry geom(mesh, PxMeshScale(U2PVector(Scale)));
+			PxRigidActorExt::createExclusiveShape(actor, geom, material);
+		}
+	}
+#endif
+};
+
+FShadowTable ShadowScene::Capture(UWorld* world)
+{
+	check(IsInGameThread());
+	FShadowTable table;
+	table.Layout = FPuckTableLayout::FromWorld(world);
+	table.Gravity = FVector(0, 0, world->GetGravityZ());
+
+	auto iter = TActorIterator<ASceneProps>(world);
+	if (*iter && iter->KillingVolume) {
+		table.Kill = iter->KillingVolume->GetBounds().GetBox();
+	}
+	if (*iter && iter->StartingPoint) {
+		table.PuckZ = iter->StartingPoint->GetActorLocation().Z;
+	}
+
+	auto* manager = APuckManager::Get(world);
+	if (!ensure(manager)) return table;
+	table.Zones = manager->GetZones();
+
+	bool first = true;
+	for (APuck* i : manager->GetPucks()) {
+		auto* body = Cast<UPrimitiveComponent>(i->GetRootComponent());
+		if (!body) continue;
+
+		if (first) {
+			first = false;
+			table.Params = FPuckSimParams::FromPuck(i);
+			table.SurfaceZ = i->GetBoundingBox().Min.Z;
+			table.PuckZ = i->GetActorLocation().Z;
+
+			table.Geometry = MakeShared<FShadowGeometry, ESPMode::ThreadSafe>();
+#if WITH_PHYSX
+			table.Geometry->Scale = body->GetComponentTransform().GetScale3D();
+			if (UBodySetup* setup = body->GetBodySetup()) {
+				for (const FKConvexElem& elem : setup->AggGeom.ConvexElems) {
+					if (PxConvexMesh* mesh = elem.GetConvexMesh()) {
+						mesh->acquireReference(); // outlive the engine's copy if need be
+						table.Geometry->Meshes.Add(mesh);
+					}
+				}
+			}
+#endif
+		}
+
+		// the puck waiting to be thrown is replaced by the simulated throw
+		if (i->GetState() == EPuckState::Setup) continue;
+
+		FShadowPuck p;
+		p.TurnId = i->TurnId;
+		p.Color = i->Color;
+		p.Transform = i->GetActorTransform();
+		p.LinearVelocity = body->GetPhysicsLinearVelocity();
+		p.AngularVelocity = body->GetPhysicsAngularVelocityInRadians();
+		table.Pucks.Add(p);
+	}
+
+	return table;
+}
+
+static void RunScene(FShadowTable& table, const FPuckThrow& t, EPuckColor color, float maxTime)
+{
+	FShadowPuck thrown;
+	thrown.TurnId = 0;
+	for (const auto& p : table.Pucks) {
+		thrown.TurnId = FMath::Max(thrown.TurnId, p.TurnId + 1);
+	}
+	thrown.Color = color;
+	thrown.Transform = FTransform(FVector(t.Start, table.PuckZ));
+	table.Pucks.Add(thrown);
+
+#if WITH_PHYSX
+	if (!ensure(table.Geometry.IsValid() && table.Geometry->Meshes.Num())) return;
+
+	const FPuckSimParams& params = table.Params;
+	const float h = params.PhysicsStep;
+
+	PxDefaultCpuDispatcher* dispatcher = nullptr;
+	PxScene* scene = nullptr;
+	PxMaterial* material = nullptr;
+	PxRigidStatic* top = nullptr;
+	TArray<PxRigidDynamic*, TInlineAllocator<ERound::TotalThrows>> bodies;
+
+	{
+		FScopeLock lock(&SDKLock);
+
+		dispatcher = PxDefaultCpuDispatcherCreate(0); // simulate on this thread
+		PxSceneDesc desc(GPhysXSDK->getTolerancesScale());
+		desc.gravity = U2PVector(table.Gravity);
+		desc.cpuDispatcher = dispatcher;
+		desc.filterShader = PxDefaultSimulationFilterShader;
+		scene = GPhysXSDK->createScene(desc);
+
+		material = GPhysXSDK->createMaterial(params.Friction, params.Friction, params.Restitution);
+
+		// table top as a thin slab, pucks going past its edges fall off
+		const FVector2D center = table.Layout.Surface.GetCenter();
+		const FVector2D extent = table.Layout.Surface.GetExtent();
+		top = GPhysXSDK->createRigidStatic(PxTransform(U2PVector(
+			FVector(center, table.SurfaceZ - 1.f))));
+		PxRigidActorExt::createExclusiveShape(*top, PxBoxGeometry(extent.X, extent.Y, 1.f), *material);
+		scene->addActor(*top);
+
+		for (const auto& p : table.Pucks) {
+			PxRigidDynamic* body = GPhysXSDK->createRigidDynamic(U2PTransform(p.Transform));
+			table.Geometry->AddShapes(*body, *material);
+			PxRigidBodyExt::setMassAndUpdateInertia(*body, params.Mass);
+			body->setLinearDamping(params.LinearDamping);
+			scene->addActor(*body);
+			body->setLinearVelocity(U2PVector(p.LinearVelocity));
+			body->setAngularVelocity(U2PVector(p.AngularVelocity));
+			bodies.Add(body);
+		}
+	}
+
+	PxRigidDynamic* thrownBody = bodies.Last();
+	thrownBody->addForce(PxVec3(t.Force.X, t.Force.Y, 0), PxForceMode::eIMPULSE);
+
+	FPuckSimParams spinParams = params;
+	spinParams.SpinStep = h;
+	int spinSteps;
+	float spinImpulse;
+	PuckSim::SpinSchedule(spinParams, t.SpinAngle, t.SpinVelocity, spinSteps, spinImpulse);
+	spinImpulse *= t.SpinAngle >= 0 ? 1.f : -1.f;
+
+	// the angular kick `APuck::ApplySpin` gives the puck, it changes how contacts resolve
+	bool angularApplied = t.SpinAngle == 0.f;
+
+	float time = 0.f;
+	while (time < maxTime) {
+		if (!angularApplied && time >= t.SpinDelay) {
+			thrownBody->addTorque(PxVec3(0, 0, PI * params.Radius * 2.f * t.SpinAngle), PxForceMode::eIMPULSE);
+			angularApplied = true;
+		}
+		if (spinSteps > 0 && time >= t.SpinDelay) {
+			thrownBody->addForce(PxVec3(0, spinImpulse, 0), PxForceMode::eIMPULSE);
+			spinSteps--;
+		}
+
+		scene->simulate(h);
+		scene->fetchResults(true/*block*/);
+		time += h;
+
+		bool awake = spinSteps > 0;
+		for (auto* body : bodies) {
+			awake |= !body->isSleeping();
+		}
+		if (!awake) break;
+	}
+	table.SimulatedTime = time;
+
+	for (int i = 0; i < bodies.Num(); ++i) {
+		auto& p = table.Pucks[i];
+		p.Transform = P2UTransform(bodies[i]->getGlobalPose());
+		p.LinearVelocity = P2UVector(bodies[i]->getLinearVelocity());
+		p.AngularVelocity = P2UVector(bodies[i]->getAngularVelocity());
+	}
+
+	{
+		FScopeLock lock(&SDKLock);
+		for (auto* body : bodies) {
+			body->release();
+		}
+		top->release();
+		scene->release();
+		material->release();
+		dispatcher->release();
+	}
+
+	// same rules as `APuck::OnResting` and the scoring in the game mode
+	const FVector extent(params.Radius, params.Radius, params.Radius);
+	for (auto& p : table.Pucks) {
+		const FVector loc = p.Transform.GetLocation();
+		p.bAlive = loc.Z > table.SurfaceZ - params.Radius &&
+			!table.Kill.Intersect(FBox(loc - extent, loc + extent));
+		p.Points = p.bAlive ? table.Zones.GetPoints(loc) : 0;
+	}
+#else
+	ShufflErr(TEXT("shadow scene needs PhysX"));
+#endif
+}
+
+TFuture<FShadowTable> ShadowScene::Simulate(FShadowTable table, const FPuckThrow& t,
+	EPuckColor color, float maxTime)
+{
+	return Async(EAsyncExecution::ThreadPool,
+		[table = MoveTemp(table), t, color, maxTime]() mutable {
+			RunScene(table, t, color, maxTime);
+			return MoveTemp(table);
+		});
+}
+
+void ShadowScene::Simulate(FShadowTable table, const FPuckThrow& t, EPuckColor color,
+	TFunction<void(const FShadowTable&)> onGameThread, float maxTime)
+{
+	Async(EAsyncExecution::ThreadPool,
+		[table = MoveTemp(table), t, color, maxTime, callback = MoveTemp(onGameThread)]() mutable {
+			RunScene(table, t, color, maxTime);
+			AsyncTask(ENamedThreads::GameThread,
+				[table = MoveTemp(table), callback = MoveTemp(callback)]() {
+					callback(table);
+				});
+		});
+}
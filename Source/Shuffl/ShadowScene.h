@@ -0,0 +1,77 @@
+// Copyright (C) 2020 Valentin Galea
+//
+// This program is free software : you can redistribute it and /or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Async/Future.h"
+
+#include "Def.h"
+#include "PuckSim.h"
+#include "ScoringVolume.h"
+
+//
+// "What if" simulations with the real PhysX model, off the game thread
+//
+// The live table is captured into plain data on the game thread, then each request
+// builds its own private PxScene (own CPU dispatcher, no worker threads) on a pool
+// thread and steps it until everything rests. Nothing touches the game world so any
+// number of these can run at the same time.
+//
+
+struct FShadowPuck
+{
+	int TurnId = 0;
+	EPuckColor Color = EPuckColor::Red;
+	FTransform Transform;
+	FVector LinearVelocity = FVector::ZeroVector;
+	FVector AngularVelocity = FVector::ZeroVector; // radians
+
+	// filled after simulating
+	bool bAlive = true; // false if fell off or was removed by the killing volume
+	int Points = 0;
+};
+
+struct FShadowTable
+{
+	TArray<FShadowPuck, TInlineAllocator<ERound::TotalThrows>> Pucks;
+
+	FScoringZones Zones;
+	FBox Kill = FBox(ForceInit);
+
+	FPuckTableLayout Layout;
+	FPuckSimParams Params;
+	FVector Gravity = FVector::ZeroVector;
+	float SurfaceZ = 0.f; // top of the table
+	float PuckZ = 0.f; // pivot height of a puck resting on it
+
+	float SimulatedTime = 0.f;
+
+	/** shared collision geometry of the puck (ref-counted PhysX meshes) */
+	TSharedPtr<struct FShadowGeometry, ESPMode::ThreadSafe> Geometry;
+};
+
+namespace ShadowScene
+{
+	/** snapshot of every live puck and the table volumes - game thread only */
+	FShadowTable Capture(class UWorld*);
+
+	/** throws a new puck onto a copy of the table and simulates until all rest */
+	TFuture<FShadowTable> Simulate(FShadowTable, const FPuckThrow&, EPuckColor, float maxTime = 15.f);
+
+	/** same as above but hands back the result on the game thread */
+	void Simulate(FShadowTable, const FPuckThrow&, EPuckColor,
+		TFunction<void(const FShadowTable&)> onGameThread, float maxTime = 15.f);
+}
@@ -30,7 +30,8 @@ public class Shuffl : ModuleRules
 		PrivateDependencyModuleNames.AddRange(new string[] {
 			"UMG", "Slate", "SlateCore",
 			"LevelSequence", "MovieScene",
-			"XMPP"
+			"XMPP",
+			"PhysicsCore", "PhysX"
 		});
 	}
 }
@@ -0,0 +1,242 @@
+// Copyright (C) 2020 Valentin Galea
+//
+// This program is free software : you can redistribute it and /or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+//
+// `Shuffl.SimCheck` - how far the fast puck models drift from the real PhysX one
+//
+// A seeded sweep of lone throws (same mix as the AI tries) is played on an empty copy
+// of the current table through `ShadowScene` and compared against `FPuckBatchSim` and
+// `PuckSim::PredictRest`. Also times the batch simulator on its own, single threaded.
+//
+// `Shuffl.ScriptedThrow` throws the waiting puck with fixed values and logs where it rests,
+// run it under `t.MaxFPS 30`, `60` and `120` - with fixed step physics the spots match.
+//
+
+#include "EngineUtils.h"
+#include "Engine/World.h"
+#include "GameFramework/PlayerStart.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/PlatformTime.h"
+#include "Math/RandomStream.h"
+
+#include "Shuffl.h"
+#include "PlayerCtrl.h"
+#include "Puck.h"
+#include "PuckManager.h"
+#include "PuckSim.h"
+#include "SceneProps.h"
+#include "ShadowScene.h"
+
+#if !UE_BUILD_SHIPPING
+
+static TAutoConsoleVariable<float> CVarSimCheckTolerance(
+	TEXT("Shuffl.SimCheckTolerance"),
+	2.f,
+	TEXT("cm, largest rest position deviation from PhysX `Shuffl.SimCheck` passes with"));
+
+namespace SimCheck
+{
+	constexpr int DefaultThrows = 64;
+	constexpr int BenchTables = 1024;
+	constexpr double BenchSeconds = 1.;
+	constexpr double TargetRate = 1e5; // throws/sec/core the search was sized for
+}
+
+struct FSimDeviation
+{
+	float Max = 0.f;
+	double Sum = 0.;
+	int Num = 0;
+	int FateDiffers = 0; // rests on the table in one, fell off or got removed in the other
+
+	void Add(bool alive, bool expectedAlive, const FVector2D& pos, const FVector2D& expected)
+	{
+		if (alive != expectedAlive) {
+			FateDiffers++;
+		} else if (alive) {
+			const float d = (pos - expected).Size();
+			Max = FMath::Max(Max, d);
+			Sum += d;
+			Num++;
+		}
+	}
+
+	float Mean() const { return Num ? float(Sum / Num) : 0.f; }
+	bool Passed(float tolerance) const { return !FateDiffers && Max <= tolerance; }
+};
+
+static FPuckThrow RandomThrow(FVector2D lineStart, FVector2D lineEnd, FRandomStream& rand)
+{
+	// same spread as `RandomMove` in the AI planner
+	const auto* ctrl = GetDefault<APlayerCtrl>();
+	FPuckThrow t;
+	t.Start = FMath::Lerp(lineStart, lineEnd, rand.FRand());
+	const float force = rand.FRandRange(.1f, 1.f) * ctrl->ThrowForceMax;
+	switch (rand.RandHelper(3)) {
+	case 0:
+		t.Force = FVector2D(force, 0.f);
+		break;
+	case 1: {
+		const float angle = rand.FRandRange(-PI / 4.f, PI / 4.f);
+		t.Force = FVector2D(FMath::Cos(angle), FMath::Sin(angle)) * force;
+		break;
+	}
+	default:
+		t.Force = FVector2D(force, 0.f);
+		t.SpinAngle = rand.FRandRange(-PI / 2.f, PI / 2.f);
+		t.SpinVelocity = rand.FRandRange(.1f, 1.f) * ctrl->EscapeVelocity;
+		t.SpinDelay = .1f;
+		break;
+	}
+	return t;
+}
+
+static void RunSimCheck(const TArray<FString>& args, UWorld* world)
+{
+	const int numThrows = args.Num() > 0 ? FMath::Max(FCString::Atoi(*args[0]), 1) : SimCheck::DefaultThrows;
+	const int32 seed = args.Num() > 1 ? FCString::Atoi(*args[1]) : 0;
+
+	FShadowTable table = ShadowScene::Capture(world);
+	auto props = TActorIterator<ASceneProps>(world);
+	if (!table.Geometry.IsValid() || !*props || !props->StartingPoint) {
+		ShufflErr(TEXT("SimCheck needs a table with a puck on it"));
+		return;
+	}
+	// lone throws, that's all `PredictRest` knows about
+	table.Pucks.Reset();
+
+	const auto* ctrl = GetDefault<APlayerCtrl>();
+	const FVector lineStart = props->StartingPoint->GetActorLocation() - ctrl->StartingLine / 2.f;
+	const FVector lineEnd = lineStart + FVector(0, ctrl->StartingLine.Y, 0);
+
+	TArray<FPuckThrow> throws;
+	FRandomStream rand(seed);
+	for (int i = 0; i < numThrows; ++i) {
+		throws.Add(RandomThrow(FVector2D(lineStart), FVector2D(lineEnd), rand));
+	}
+
+	// PhysX, every throw on its own pool thread
+	TArray<TFuture<FShadowTable>> physx;
+	for (const auto& t : throws) {
+		physx.Add(ShadowScene::Simulate(table, t, EPuckColor::Red));
+	}
+
+	FPuckBatchSim sim(table.Params, table.Layout);
+	sim.Reset(numThrows);
+	for (int i = 0; i < numThrows; ++i) {
+		sim.Throw(i, 0, throws[i]);
+	}
+	sim.Run();
+
+	FSimDeviation batch, analytic;
+	for (int i = 0; i < numThrows; ++i) {
+		const FShadowPuck& real = physx[i].Get().Pucks.Last();
+		const FVector2D realPos(real.Transform.GetLocation());
+
+		batch.Add(sim.IsAlive(i, 0), real.bAlive, sim.GetPosition(i, 0), realPos);
+
+		// the analytic model doesn't know about the table edges, only compare what stayed on
+		const FPuckRest rest = PuckSim::PredictRest(table.Params, throws[i]);
+		analytic.Add(real.bAlive, real.bAlive, rest.Position, realPos);
+	}
+
+	const float tolerance = CVarSimCheckTolerance.GetValueOnGameThread();
+	auto Report = [&](const TCHAR* name, const FSimDeviation& d) {
+		ShufflLog(TEXT("%s vs PhysX: max %.2f cm, mean %.2f cm over %i, %i ended elsewhere - %s (tolerance %.2f cm)"),
+			name, d.Max, d.Mean(), d.Num, d.FateDiffers, d.Passed(tolerance) ? TEXT("PASS") : TEXT("FAIL"), tolerance);
+	};
+	Report(TEXT("batch sim"), batch);
+	Report(TEXT("PredictRest"), analytic);
+
+	// throughput on this thread only: the same sweep over and over on a full batch
+	int64 simulated = 0;
+	const double start = FPlatformTime::Seconds();
+	double elapsed = 0.;
+	for (int round = 0; elapsed < SimCheck::BenchSeconds; ++round) {
+		sim.Reset(SimCheck::BenchTables);
+		for (int i = 0; i < SimCheck::BenchTables; ++i) {
+			sim.Throw(i, 0, throws[(round + i) % numThrows]);
+		}
+		sim.Run();
+		simulated += SimCheck::BenchTables;
+		elapsed = FPlatformTime::Seconds() - start;
+	}
+	const double rate = simulated / elapsed;
+	ShufflLog(TEXT("batch sim: %.0f throws/sec/core (target %.0f) - %s"),
+		rate, SimCheck::TargetRate, rate >= SimCheck::TargetRate ? TEXT("PASS") : TEXT("FAIL"));
+}
+
+static FAutoConsoleCommandWithWorldAndArgs SimCheckCommand(
+	TEXT("Shuffl.SimCheck"),
+	TEXT("Puck models vs PhysX: rest position deviation and batch sim throughput. Optional: throws seed"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateStatic(&RunSimCheck));
+
+static void RunScriptedThrow(const TArray<FString>& args, UWorld* world)
+{
+	auto* manager = APuckManager::Get(world);
+	APuck* puck = nullptr;
+	if (manager) {
+		for (APuck* p : manager->GetPucks()) {
+			if (p->GetState() == EPuckState::Setup) {
+				puck = p;
+			}
+		}
+	}
+	if (!puck) {
+		ShufflErr(TEXT("ScriptedThrow needs a puck waiting to be thrown"));
+		return;
+	}
+
+	const auto* ctrl = GetDefault<APlayerCtrl>();
+	FPuckThrow t;
+	t.Force.X = args.Num() > 0 ? FCString::Atof(*args[0]) : ctrl->ThrowForceMax * .6f;
+	t.SpinAngle = args.Num() > 1 ? FCString::Atof(*args[1]) : .5f;
+	t.SpinVelocity = args.Num() > 2 ? FCString::Atof(*args[2]) : ctrl->EscapeVelocity * .5f;
+	t.SpinDelay = .1f;
+
+	// from the middle of the line, wherever the puck was left
+	auto* props = manager->GetSceneProps();
+	if (props && props->StartingPoint) {
+		puck->MoveTo(props->StartingPoint->GetActorLocation());
+	}
+	puck->ApplyThrow(t.Force);
+	if (t.SpinAngle != 0.f) {
+		puck->ApplySpin(t.SpinAngle, t.SpinVelocity, t.SpinDelay);
+	}
+
+	static FDelegateHandle rested;
+	manager->OnPucksRested.Remove(rested);
+	TWeakObjectPtr<APuckManager> weakManager(manager);
+	TWeakObjectPtr<APuck> weakPuck(puck);
+	const int turnId = puck->TurnId;
+	rested = manager->OnPucksRested.AddLambda([weakManager, weakPuck, turnId](int) {
+		if (weakManager.IsValid()) {
+			weakManager->OnPucksRested.Remove(rested);
+		}
+		if (!weakPuck.IsValid() || weakPuck->TurnId != turnId) return;
+
+		const auto* maxFPS = IConsoleManager::Get().FindConsoleVariable(TEXT("t.MaxFPS"));
+		const FVector loc = weakPuck->GetActorLocation();
+		ShufflLog(TEXT("scripted throw at t.MaxFPS %.0f rested at %.3f %.3f"),
+			maxFPS ? maxFPS->GetFloat() : 0.f, loc.X, loc.Y);
+	});
+}
+
+static FAutoConsoleCommandWithWorldAndArgs ScriptedThrowCommand(
+	TEXT("Shuffl.ScriptedThrow"),
+	TEXT("Throws the waiting puck the same way every time and logs where it rests. Optional: force spinAngle spinVelocity"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateStatic(&RunScriptedThrow));
+
+#endif // !UE_BUILD_SHIPPING
@@ -0,0 +1,376 @@
+// Copyright (C) 2020 Valentin Galea
+//
+// This program is free software : you can redistribute it and /or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#include "ThrowDataset.h"
+
+#include "Async/Async.h"
+#include "HAL/FileManager.h"
+#include "HAL/PlatformProcess.h"
+#include "Misc/Crc.h"
+#include "Misc/DateTime.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Misc/ScopeLock.h"
+
+#include "Shuffl.h"
+#include "ScoringVolume.h"
+
+struct FThrowShardHeader
+{
+	static constexpr uint32 CurrentMagic = 0x53574854; // "THWS"
+	static constexpr uint32 CurrentVersion = 1;
+
+	uint32 Magic = CurrentMagic;
+	uint32 Version = CurrentVersion;
+	int32 NumRows = 0;
+	int32 NumColumns = 0;
+	uint32 Crc = 0; // of the column data, in column order
+	uint32 Pad = 0;
+};
+
+struct FThrowShardColumn
+{
+	ANSICHAR Name[24];
+	EThrowColumnType Type;
+	uint8 Width; // values per row
+	uint16 Pad;
+	uint32 Offset; // from the start of the file, aligned to 16
+};
+
+struct FThrowSchemaColumn
+{
+	const ANSICHAR* Name;
+	EThrowColumnType Type;
+	uint8 Width;
+	uint32 Offset; // in `FThrowSample`
+};
+
+#define THROW_COLUMN(name, type, width, member) \
+	{ name, EThrowColumnType::type, width, uint32(STRUCT_OFFSET(FThrowSample, member)) }
+
+// what gets written, readers go by name so columns can be added later
+static const FThrowSchemaColumn Schema[] = {
+	THROW_COLUMN("source", U8, 1, Source),
+	THROW_COLUMN("color", U8, 1, Color),
+	THROW_COLUMN("slot", U8, 1, Slot),
+	THROW_COLUMN("turn_id", I32, 1, TurnId),
+	THROW_COLUMN("before_x", F32, FThrowSample::MaxPucks, BeforeX),
+	THROW_COLUMN("before_y", F32, FThrowSample::MaxPucks, BeforeY),
+	THROW_COLUMN("before_color", U8, FThrowSample::MaxPucks, BeforeColor),
+	THROW_COLUMN("throw_start", F32, 2, Throw.Start),
+	THROW_COLUMN("throw_force", F32, 2, Throw.Force),
+	THROW_COLUMN("spin_angle", F32, 1, Throw.SpinAngle),
+	THROW_COLUMN("spin_velocity", F32, 1, Throw.SpinVelocity),
+	THROW_COLUMN("spin_delay", F32, 1, Throw.SpinDelay),
+	THROW_COLUMN("after_x", F32, FThrowSample::MaxPucks, AfterX),
+	THROW_COLUMN("after_y", F32, FThrowSample::MaxPucks, AfterY),
+	THROW_COLUMN("after_color", U8, FThrowSample::MaxPucks, AfterColor),
+	THROW_COLUMN("round_winner", U8, 1, RoundWinner),
+	THROW_COLUMN("round_points", U8, 1, RoundPoints),
+};
+
+#undef THROW_COLUMN
+
+static constexpr int NumSchemaColumns = ARRAY_COUNT(Schema);
+
+static const TCHAR* ManifestFile = TEXT("manifest.txt");
+
+static int TypeSize(EThrowColumnType type)
+{
+	switch (type) {
+	case EThrowColumnType::U8: return 1;
+	case EThrowColumnType::I32: return 4;
+	case EThrowColumnType::F32: return 4;
+	default: return 0;
+	}
+}
+
+//
+// Sample
+//
+
+FThrowSample::FThrowSample()
+{
+	FMemory::Memzero(BeforeX);
+	FMemory::Memzero(BeforeY);
+	FMemory::Memset(BeforeColor, None);
+	FMemory::Memzero(AfterX);
+	FMemory::Memzero(AfterY);
+	FMemory::Memset(AfterColor, None);
+}
+
+static void SetTable(FThrowSample::FTable table, float* x, float* y, uint8* color)
+{
+	const int num = FMath::Min(table.Num(), FThrowSample::MaxPucks);
+	for (int i = 0; i < num; ++i) {
+		x[i] = table[i].Key.X;
+		y[i] = table[i].Key.Y;
+		color[i] = uint8(table[i].Value);
+	}
+}
+
+void FThrowSample::SetBefore(FTable table)
+{
+	SetTable(table, BeforeX, BeforeY, BeforeColor);
+}
+
+void FThrowSample::SetAfter(FTable table)
+{
+	SetTable(table, AfterX, AfterY, AfterColor);
+}
+
+void FThrowSample::SetOutcome(const FRoundScore& score)
+{
+	RoundWinner = score.HasWinner() ? uint8(score.Winner) : None;
+	RoundPoints = uint8(FMath::Min(score.Points, 255));
+}
+
+//
+// Writer
+//
+
+struct FThrowDatasetWriter::FShard
+{
+	int NumRows = 0;
+	TArray<uint8> Columns[NumSchemaColumns];
+
+	FShard()
+	{
+		for (int i = 0; i < NumSchemaColumns; ++i) {
+			Columns[i].SetNumUninitialized(RowsPerShard * Schema[i].Width * TypeSize(Schema[i].Type));
+		}
+	}
+
+	void Add(const FThrowSample& sample)
+	{
+		const auto* row = reinterpret_cast<const uint8*>(&sample);
+		for (int i = 0; i < NumSchemaColumns; ++i) {
+			const int size = Schema[i].Width * TypeSize(Schema[i].Type);
+			FMemory::Memcpy(Columns[i].GetData() + NumRows * size, row + Schema[i].Offset, size);
+		}
+		NumRows++;
+	}
+};
+
+FThrowDatasetWriter::FThrowDatasetWriter(const FString& directory, EFullPolicy fullPolicy)
+	: Directory(directory)
+	, SessionName(FString::Printf(TEXT("%s_%u"),
+		*FDateTime::Now().ToString(TEXT("%Y%m%d-%H%M%S")), FPlatformProcess::GetCurrentProcessId()))
+	, FullPolicy(fullPolicy)
+{
+	IFileManager::Get().MakeDirectory(*Directory, true);
+}
+
+FThrowDatasetWriter::~FThrowDatasetWriter()
+{
+	Flush();
+	WaitForWrites();
+}
+
+void FThrowDatasetWriter::WaitForWrites()
+{
+	FScopeLock lock(&Lock);
+	for (auto& write : Writes) {
+		write.Wait();
+	}
+	Writes.Reset();
+}
+
+FString FThrowDatasetWriter::DefaultDirectory()
+{
+	return FPaths::ProjectSavedDir() / TEXT("ThrowDataset");
+}
+
+void FThrowDatasetWriter::Add(TArrayView<const FThrowSample> samples)
+{
+	FScopeLock lock(&Lock);
+	for (const FThrowSample& sample : samples) {
+		if (!Current) {
+			Current = MakeUnique<FShard>();
+		}
+		Current->Add(sample);
+		if (Current->NumRows == RowsPerShard) {
+			Submit(MoveTemp(Current));
+		}
+	}
+}
+
+void FThrowDatasetWriter::Flush()
+{
+	FScopeLock lock(&Lock);
+	if (Current && Current->NumRows) {
+		Submit(MoveTemp(Current));
+	}
+}
+
+void FThrowDatasetWriter::Submit(TUniquePtr<FShard> shard)
+{
+	Writes.RemoveAll([](const TFuture<void>& write) { return write.IsReady(); });
+	if (Writes.Num() >= MaxPendingShards && FullPolicy == EFullPolicy::Wait) {
+		// the other threads adding wait on `Lock` meanwhile, which is the point
+		Writes[0].Wait();
+		Writes.RemoveAt(0);
+	}
+	if (Writes.Num() >= MaxPendingShards) {
+		Dropped += shard->NumRows;
+		UE_LOG(LogShuffl, Warning, TEXT("throw dataset: disk too slow, dropped %i samples"), shard->NumRows);
+		return;
+	}
+
+	const FString fileName = FString::Printf(TEXT("%s_%04i.bin"), *SessionName, NextShard++);
+	FShard* raw = shard.Release();
+	Writes.Add(Async(EAsyncExecution::ThreadPool, [this, raw, fileName]() {
+		TUniquePtr<FShard> owned(raw);
+		WriteShard(*owned, fileName);
+	}));
+}
+
+// pool thread
+void FThrowDatasetWriter::WriteShard(const FShard& shard, const FString& fileName)
+{
+	FThrowShardHeader header;
+	header.NumRows = shard.NumRows;
+	header.NumColumns = NumSchemaColumns;
+
+	FThrowShardColumn columns[NumSchemaColumns];
+	FMemory::Memzero(columns);
+	uint32 offset = Align(sizeof(header) + sizeof(columns), 16);
+	for (int i = 0; i < NumSchemaColumns; ++i) {
+		FCStringAnsi::Strncpy(columns[i].Name, Schema[i].Name, ARRAY_COUNT(columns[i].Name));
+		columns[i].Type = Schema[i].Type;
+		columns[i].Width = Schema[i].Width;
+		columns[i].Offset = offset;
+
+		const int bytes = shard.NumRows * Schema[i].Width * TypeSize(Schema[i].Type);
+		header.Crc = FCrc::MemCrc32(shard.Columns[i].GetData(), bytes, header.Crc);
+		offset = Align(offset + bytes, 16);
+	}
+
+	// written under a temp name so a reader never sees half a shard
+	const FString path = Directory / fileName;
+	const FString tempPath = path + TEXT(".tmp");
+	TUniquePtr<FArchive> file(IFileManager::Get().CreateFileWriter(*tempPath));
+	bool ok = file.IsValid();
+	if (ok) {
+		static uint8 Zeros[16] = {};
+		file->Serialize(&header, sizeof(header));
+		file->Serialize(columns, sizeof(columns));
+		for (int i = 0; i < NumSchemaColumns; ++i) {
+			file->Serialize(Zeros, columns[i].Offset - file->Tell());
+			const int bytes = shard.NumRows * Schema[i].Width * TypeSize(Schema[i].Type);
+			file->Serialize(const_cast<uint8*>(shard.Columns[i].GetData()), bytes);
+		}
+		ok = file->Close() && !file->IsError();
+		file.Reset();
+	}
+	if (!ok || !IFileManager::Get().Move(*path, *tempPath)) {
+		Dropped += shard.NumRows;
+		UE_LOG(LogShuffl, Error, TEXT("throw dataset: can't write %s"), *path);
+		return;
+	}
+
+	{
+		FScopeLock lock(&ManifestLock);
+		FFileHelper::SaveStringToFile(FString::Printf(TEXT("%s %i %u\n"), *fileName, shard.NumRows, header.Crc),
+			*(Directory / ManifestFile), FFileHelper::EEncodingOptions::ForceAnsi, &IFileManager::Get(), FILEWRITE_Append);
+	}
+	Written += shard.NumRows;
+}
+
+//
+// Reader
+//
+
+bool FThrowShard::Load(const FString& path)
+{
+	Columns = nullptr;
+	NumColumns = NumRows = 0;
+
+	if (!FFileHelper::LoadFileToArray(Data, *path, FILEREAD_Silent) || Data.Num() < sizeof(FThrowShardHeader)) {
+		return false;
+	}
+
+	const auto* header = reinterpret_cast<const FThrowShardHeader*>(Data.GetData());
+	if (header->Magic != FThrowShardHeader::CurrentMagic || header->Version != FThrowShardHeader::CurrentVersion ||
+		header->NumRows < 0 || header->NumColumns <= 0 ||
+		sizeof(FThrowShardHeader) + sizeof(FThrowShardColumn) * header->NumColumns > Data.Num()) {
+		return false;
+	}
+
+	const auto* columns = reinterpret_cast<const FThrowShardColumn*>(Data.GetData() + sizeof(FThrowShardHeader));
+	uint32 crc = 0;
+	for (int i = 0; i < header->NumColumns; ++i) {
+		const int64 bytes = int64(header->NumRows) * columns[i].Width * TypeSize(columns[i].Type);
+		if (!TypeSize(columns[i].Type) || columns[i].Offset + bytes > Data.Num()) return false;
+		crc = FCrc::MemCrc32(Data.GetData() + columns[i].Offset, bytes, crc);
+	}
+	if (crc != header->Crc) return false;
+
+	Columns = columns;
+	NumColumns = header->NumColumns;
+	NumRows = header->NumRows;
+	return true;
+}
+
+const void* FThrowShard::FindColumn(const ANSICHAR* name, EThrowColumnType type, int& width) const
+{
+	for (int i = 0; i < NumColumns; ++i) {
+		const FThrowShardColumn& c = Columns[i];
+		if (c.Type == type && FCStringAnsi::Strncmp(c.Name, name, ARRAY_COUNT(c.Name)) == 0) {
+			width = c.Width;
+			return Data.GetData() + c.Offset;
+		}
+	}
+	width = 0;
+	return nullptr;
+}
+
+void FThrowShard::GetRow(int row, FThrowSample& out) const
+{
+	if (!ensure(row >= 0 && row < NumRows)) return;
+
+	auto* dst = reinterpret_cast<uint8*>(&out);
+	for (const FThrowSchemaColumn& column : Schema) {
+		int width;
+		const auto* src = static_cast<const uint8*>(FindColumn(column.Name, column.Type, width));
+		if (!src || width != column.Width) continue;
+
+		const int size = width * TypeSize(column.Type);
+		FMemory::Memcpy(dst + column.Offset, src + row * size, size);
+	}
+}
+
+bool FThrowDatasetReader::Open(const FString& directory)
+{
+	Directory = directory;
+	Shards.Reset();
+	NumRows = 0;
+
+	TArray<FString> lines;
+	if (!FFileHelper::LoadFileToStringArray(lines, *(directory / ManifestFile))) return false;
+
+	for (const FString& line : lines) {
+		TArray<FString> fields;
+		if (line.ParseIntoArrayWS(fields) < 2) continue;
+		Shards.Add(fields[0]);
+		NumRows += FCString::Atoi(*fields[1]);
+	}
+	return true;
+}
+
+bool FThrowDatasetReader::LoadShard(int index, FThrowShard& out) const
+{
+	return Shards.IsValidIndex(index) && out.Load(Directory / Shards[index]);
+}
@@ -0,0 +1,192 @@
+// Copyright (C) 2020 Valentin Galea
+//
+// This program is free software : you can redistribute it and /or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Async/Future.h"
+#include "HAL/CriticalSection.h"
+
+#include "Def.h"
+#include "PuckSim.h"
+
+//
+// Throw samples for training / balancing, streamed to disk while matches run
+//
+// A sample is the table before a throw, the throw itself, the table once everything
+// rested and the outcome of the round it was part of (filled in when the round ends, so
+// samples are committed a round at a time). Rows go into column buffers in memory; when
+// a shard is full it's handed to a pool thread that writes it out, nothing on the calling
+// thread but a copy under a short lock. If the disk can't keep up samples are dropped
+// (and counted) rather than stalling the game, unless the writer is made to wait (offline
+// tools, where every sample counts and nothing is waiting on frames).
+//
+// Shard file: header, column descriptors (name, type, width), then every column as one
+// contiguous aligned array - a column can be read without touching the others. Each
+// finished shard is appended to `manifest.txt` in the same directory (file, rows, crc).
+//
+
+enum class EThrowSource : uint8
+{
+	Human,
+	AI,
+	Remote, // the other side of a XMPP game
+	Tournament
+};
+
+struct FThrowSample
+{
+	static constexpr int MaxPucks = ERound::TotalThrows;
+	static constexpr uint8 None = 0xff; // empty slot, round without a winner
+
+	EThrowSource Source = EThrowSource::Human;
+	uint8 Color = 0; // `EPuckColor` of the thrower
+	uint8 Slot = 0; // throws before this one in the round
+	int32 TurnId = 0;
+
+	// slots in throw order, color `None` where there's no puck
+	float BeforeX[MaxPucks];
+	float BeforeY[MaxPucks];
+	uint8 BeforeColor[MaxPucks];
+
+	FPuckThrow Throw;
+
+	float AfterX[MaxPucks];
+	float AfterY[MaxPucks];
+	uint8 AfterColor[MaxPucks];
+
+	uint8 RoundWinner = None;
+	uint8 RoundPoints = 0;
+
+	FThrowSample();
+
+	using FTable = TArrayView<const TPair<FVector2D, EPuckColor>>;
+	void SetBefore(FTable);
+	void SetAfter(FTable);
+	void SetOutcome(const struct FRoundScore&);
+};
+
+enum class EThrowColumnType : uint8
+{
+	U8,
+	I32,
+	F32
+};
+
+class FThrowDatasetWriter
+{
+public:
+	static constexpr int RowsPerShard = 1 << 14; // ~3MB
+	static constexpr int MaxPendingShards = 4; // being written, past that samples are dropped (or wait)
+
+	enum class EFullPolicy : uint8
+	{
+		Drop, // in game
+		Wait // `Add` blocks until a write finishes
+	};
+
+	explicit FThrowDatasetWriter(const FString& directory, EFullPolicy = EFullPolicy::Drop);
+	~FThrowDatasetWriter(); // flushes and waits for the writes to finish
+
+	/** any thread, a finished round (or what's left of one) */
+	void Add(TArrayView<const FThrowSample>);
+
+	/** writes out the current partial shard */
+	void Flush();
+
+	/** blocks until everything submitted is on disk (or failed) */
+	void WaitForWrites();
+
+	int64 GetNumWritten() const { return Written; }
+	int64 GetNumDropped() const { return Dropped; }
+
+	static FString DefaultDirectory();
+
+private:
+	struct FShard;
+	void Submit(TUniquePtr<FShard>); // with `Lock` held
+	void WriteShard(const FShard&, const FString& fileName);
+
+	const FString Directory;
+	const FString SessionName; // shard file prefix, unique per run
+	const EFullPolicy FullPolicy;
+
+	FCriticalSection Lock;
+	TUniquePtr<FShard> Current;
+	TArray<TFuture<void>> Writes;
+	int32 NextShard = 0;
+
+	FCriticalSection ManifestLock;
+
+	TAtomic<int64> Written { 0 };
+	TAtomic<int64> Dropped { 0 };
+};
+
+/** one shard loaded in memory, columns looked up by name */
+class FThrowShard
+{
+public:
+	/** checks the header and the crc */
+	bool Load(const FString& path);
+
+	int GetNumRows() const { return NumRows; }
+
+	/** nullptr if missing or of another type, `width` values per row */
+	const void* FindColumn(const ANSICHAR* name, EThrowColumnType, int& width) const;
+	const float* GetFloats(const ANSICHAR* name, int& width) const;
+	const uint8* GetBytes(const ANSICHAR* name, int& width) const;
+	const int32* GetInts(const ANSICHAR* name, int& width) const;
+
+	/** gathers the columns back into a sample (missing ones stay default) */
+	void GetRow(int row, FThrowSample&) const;
+
+private:
+	TArray<uint8> Data;
+	const struct FThrowShardColumn* Columns = nullptr;
+	int NumColumns = 0;
+	int NumRows = 0;
+};
+
+/** the shards listed in a directory's manifest */
+class FThrowDatasetReader
+{
+public:
+	bool Open(const FString& directory);
+
+	int GetNumShards() const { return Shards.Num(); }
+	int64 GetNumRows() const { return NumRows; }
+
+	bool LoadShard(int index, FThrowShard& out) const;
+
+private:
+	FString Directory;
+	TArray<FString> Shards;
+	int64 NumRows = 0;
+};
+
+inline const float* FThrowShard::GetFloats(const ANSICHAR* name, int& width) const
+{
+	return static_cast<const float*>(FindColumn(name, EThrowColumnType::F32, width));
+}
+
+inline const uint8* FThrowShard::GetBytes(const ANSICHAR* name, int& width) const
+{
+	return static_cast<const uint8*>(FindColumn(name, EThrowColumnType::U8, width));
+}
+
+inline const int32* FThrowShard::GetInts(const ANSICHAR* name, int& width) const
+{
+	return static_cast<const int32*>(FindColumn(name, EThrowColumnType::I32, width));
+}
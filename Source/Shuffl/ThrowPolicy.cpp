@@ -0,0 +1,328 @@
+// Copyright (C) 2020 Valentin Galea
+//
+// This program is free software : you can redistribute it and /or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#include "ThrowPolicy.h"
+
+#include "Math/RandomStream.h"
+
+#include "Shuffl.h"
+#include "AIPlanner.h"
+
+#if defined(PLATFORM_ENABLE_VECTORINTRINSICS_NEON) && PLATFORM_ENABLE_VECTORINTRINSICS_NEON
+#define POLICY_NEON 1
+#include <arm_neon.h>
+#elif defined(__AVX2__)
+#define POLICY_AVX2 1
+#include <immintrin.h>
+#elif defined(_M_X64) || defined(__x86_64__)
+#define POLICY_SSE2 1 // part of x64 itself, every desktop build has it
+#include <emmintrin.h>
+#endif
+
+// `n` is a multiple of `FThrowPolicy::Lanes`, products of [-127, 127] fit in int16
+static int32 DotInt8(const int8* a, const int8* b, int n)
+{
+#if defined(POLICY_NEON)
+	int32x4_t acc = vdupq_n_s32(0);
+	for (int i = 0; i < n; i += 16) {
+		const int8x16_t va = vld1q_s8(a + i);
+		const int8x16_t vb = vld1q_s8(b + i);
+		acc = vpadalq_s16(acc, vmull_s8(vget_low_s8(va), vget_low_s8(vb)));
+		acc = vpadalq_s16(acc, vmull_s8(vget_high_s8(va), vget_high_s8(vb)));
+	}
+	int32x2_t sum = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+	sum = vpadd_s32(sum, sum);
+	return vget_lane_s32(sum, 0);
+#elif defined(POLICY_AVX2)
+	__m256i acc = _mm256_setzero_si256();
+	for (int i = 0; i < n; i += 16) {
+		const __m256i va = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)));
+		const __m256i vb = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+		acc = _mm256_add_epi32(acc, _mm256_madd_epi16(va, vb));
+	}
+	__m128i sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+	sum = _mm_hadd_epi32(sum, sum);
+	sum = _mm_hadd_epi32(sum, sum);
+	return _mm_cvtsi128_si32(sum);
+#elif defined(POLICY_SSE2)
+	// no sign extending load before SSE4.1: put each byte in the high half and shift it back down
+	__m128i acc = _mm_setzero_si128();
+	for (int i = 0; i < n; i += 16) {
+		const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+		const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+		const __m128i aLo = _mm_srai_epi16(_mm_unpacklo_epi8(va, va), 8);
+		const __m128i bLo = _mm_srai_epi16(_mm_unpacklo_epi8(vb, vb), 8);
+		const __m128i aHi = _mm_srai_epi16(_mm_unpackhi_epi8(va, va), 8);
+		const __m128i bHi = _mm_srai_epi16(_mm_unpackhi_epi8(vb, vb), 8);
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(aLo, bLo));
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(aHi, bHi));
+	}
+	acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+	acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(acc);
+#else
+	int32 acc = 0;
+	for (int i = 0; i < n; ++i) {
+		acc += int32(a[i]) * int32(b[i]);
+	}
+	return acc;
+#endif
+}
+
+static int8 Quantize(float v, float scale)
+{
+	return int8(FMath::Clamp(FMath::RoundToInt(v / scale), -127, 127));
+}
+
+FThrowPolicy::FThrowPolicy(const UThrowPolicyAsset* asset)
+	: Asset(asset)
+{
+	if (!Asset || !Asset->Layers.Num() || Asset->InputScale <= 0.f) return;
+	if (Asset->Layers[0].NumInputs < NumFeatures) return;
+
+	int inputs = Asset->Layers[0].NumInputs;
+	for (const auto& layer : Asset->Layers) {
+		if (layer.NumInputs != Align(inputs, Lanes) || layer.NumInputs > MaxWidth ||
+			layer.NumOutputs <= 0 || layer.NumOutputs > MaxWidth ||
+			layer.Weights.Num() != layer.NumInputs * layer.NumOutputs ||
+			layer.WeightScales.Num() != layer.NumOutputs || layer.Bias.Num() != layer.NumOutputs ||
+			layer.OutputScale <= 0.f) {
+			return;
+		}
+		inputs = layer.NumOutputs;
+	}
+	bValid = inputs == NumActions;
+}
+
+void FThrowPolicy::Encode(const FAIPlanRequest& req, int ownScore, int opponentScore, float* features)
+{
+	FMemory::Memzero(features, sizeof(float) * NumFeatures);
+
+	// closest to the edge first, same order the scoring walks them
+	TArray<TPair<FVector2D, EPuckColor>, TInlineAllocator<ERound::TotalThrows>> pucks(req.Pucks);
+	pucks.Sort([](const auto& a, const auto& b) { return a.Key.X > b.Key.X; });
+
+	const FVector2D center = req.Layout.Surface.GetCenter();
+	const FVector2D extent = req.Layout.Surface.GetExtent();
+	for (int i = 0; i < ERound::TotalThrows; ++i) {
+		float* f = features + i * FeaturesPerPuck;
+		if (i >= pucks.Num()) {
+			f[4] = 1.f; // empty
+			continue;
+		}
+		const FVector2D p = (pucks[i].Key - center) / extent;
+		f[0] = FMath::Clamp(p.X, -1.f, 1.f);
+		f[1] = FMath::Clamp(p.Y, -1.f, 1.f);
+		f[pucks[i].Value == req.Color ? 2 : 3] = 1.f;
+	}
+
+	float* f = features + ERound::TotalThrows * FeaturesPerPuck;
+	f[0] = FMath::Min(float(ownScore) / ERound::WinningScore, 1.f);
+	f[1] = FMath::Min(float(opponentScore) / ERound::WinningScore, 1.f);
+	f[2] = float(req.ThrowsLeft) / ERound::TotalThrows;
+}
+
+FAIMove FThrowPolicy::DecodeAction(const FAIPlanRequest& req, int action)
+{
+	const int kind = action % NumKinds;
+	const int force = (action / NumKinds) % NumForces;
+	const int place = action / (NumKinds * NumForces);
+
+	FAIMove move;
+	FPuckThrow& t = move.Throw;
+	t.Start = FMath::Lerp(req.LineStart, req.LineEnd, (place + .5f) / NumPlacements);
+
+	const float strength = req.ForceMax * (force + 1) / NumForces;
+	switch (kind) {
+	case 1:
+	case 2: {
+		const float angle = (kind == 1 ? -1.f : 1.f) * PI / 8.f;
+		t.Force = FVector2D(FMath::Cos(angle), FMath::Sin(angle)) * strength;
+		break;
+	}
+	case 3:
+	case 4:
+		t.Force = FVector2D(strength, 0.f);
+		t.SpinAngle = (kind == 3 ? -1.f : 1.f) * PI / 4.f;
+		t.SpinVelocity = req.SpinVelocityMax * .5f;
+		t.SpinDelay = req.SpinDelay;
+		move.bSpin = true;
+		break;
+	default:
+		t.Force = FVector2D(strength, 0.f);
+		break;
+	}
+
+	return move;
+}
+
+void FThrowPolicy::Forward(const float* features, float* logits) const
+{
+	alignas(32) int8 bufferA[MaxWidth];
+	alignas(32) int8 bufferB[MaxWidth];
+	int8* in = bufferA;
+	int8* out = bufferB;
+
+	const int numInputs = Asset->Layers[0].NumInputs;
+	for (int i = 0; i < numInputs; ++i) {
+		in[i] = i < NumFeatures ? Quantize(features[i], Asset->InputScale) : 0;
+	}
+	float inScale = Asset->InputScale;
+
+	const int numLayers = Asset->Layers.Num();
+	for (int l = 0; l < numLayers; ++l) {
+		const FThrowPolicyLayer& layer = Asset->Layers[l];
+		const bool last = l == numLayers - 1;
+		const int8* w = layer.Weights.GetData();
+
+		for (int o = 0; o < layer.NumOutputs; ++o) {
+			const int32 acc = DotInt8(w + o * layer.NumInputs, in, layer.NumInputs);
+			const float y = acc * layer.WeightScales[o] * inScale + layer.Bias[o];
+			if (last) {
+				logits[o] = y;
+			} else {
+				out[o] = Quantize(FMath::Max(y, 0.f), layer.OutputScale);
+			}
+		}
+		if (last) break;
+
+		// zero the padding the next layer reads
+		const int next = Asset->Layers[l + 1].NumInputs;
+		for (int o = layer.NumOutputs; o < next; ++o) {
+			out[o] = 0;
+		}
+		inScale = layer.OutputScale;
+		Swap(in, out);
+	}
+}
+
+bool FThrowPolicy::Decide(const FAIPlanRequest& req, int ownScore, int opponentScore, FAIMove& out) const
+{
+	if (!bValid) return false;
+
+	float features[NumFeatures];
+	float logits[NumActions];
+	Encode(req, ownScore, opponentScore, features);
+	Forward(features, logits);
+
+	int best = 0;
+	for (int i = 1; i < NumActions; ++i) {
+		if (logits[i] > logits[best]) {
+			best = i;
+		}
+	}
+
+	if (Asset->Temperature > 0.f) {
+		// softmax sampling, relative to the best to stay in range
+		float probs[NumActions];
+		float total = 0.f;
+		for (int i = 0; i < NumActions; ++i) {
+			probs[i] = FMath::Exp((logits[i] - logits[best]) / Asset->Temperature);
+			total += probs[i];
+		}
+		FRandomStream rand(req.Seed);
+		float pick = rand.FRand() * total;
+		for (int i = 0; i < NumActions; ++i) {
+			pick -= probs[i];
+			if (pick <= 0.f) {
+				best = i;
+				break;
+			}
+		}
+	}
+
+	out = DecodeAction(req, best);
+	out.Value = logits[best];
+	out.Evaluated = 1;
+	return true;
+}
+
+bool UThrowPolicyAsset::ImportWeights(const TArray<uint8>& file, FString& outError)
+{
+	int offset = 0;
+	auto Read = [&file, &offset](void* out, int size) {
+		if (offset + size > file.Num()) return false;
+		FMemory::Memcpy(out, file.GetData() + offset, size);
+		offset += size;
+		return true;
+	};
+	static_assert(PLATFORM_LITTLE_ENDIAN, "the file is read as is");
+
+	uint32 magic = 0, version = 0, numLayers = 0;
+	float inputScale = 0.f, temperature = 0.f;
+	if (!Read(&magic, 4) || magic != FileMagic) {
+		outError = TEXT("not a policy file");
+		return false;
+	}
+	if (!Read(&version, 4) || version != FileVersion) {
+		outError = FString::Printf(TEXT("version %u, expected %u"), version, FileVersion);
+		return false;
+	}
+	if (!Read(&inputScale, 4) || !Read(&temperature, 4) || !Read(&numLayers, 4)) {
+		outError = TEXT("truncated header");
+		return false;
+	}
+
+	TArray<FThrowPolicyLayer> layers;
+	int expectedInputs = FThrowPolicy::NumFeatures;
+	for (uint32 l = 0; l < numLayers; ++l) {
+		uint32 inputs, outputs;
+		FThrowPolicyLayer& layer = layers.AddDefaulted_GetRef();
+		if (!Read(&inputs, 4) || !Read(&outputs, 4) || !Read(&layer.OutputScale, 4)) {
+			outError = FString::Printf(TEXT("truncated layer %u"), l);
+			return false;
+		}
+		if (int(inputs) != expectedInputs || !outputs || outputs > FThrowPolicy::MaxWidth) {
+			outError = FString::Printf(TEXT("layer %u is %u x %u, expected %i inputs"), l, inputs, outputs, expectedInputs);
+			return false;
+		}
+
+		layer.NumInputs = Align(int(inputs), FThrowPolicy::Lanes);
+		layer.NumOutputs = outputs;
+		layer.Weights.SetNumZeroed(layer.NumInputs * layer.NumOutputs);
+		layer.WeightScales.SetNumUninitialized(outputs);
+		layer.Bias.SetNumUninitialized(outputs);
+		bool ok = true;
+		for (int o = 0; o < layer.NumOutputs; ++o) {
+			ok &= Read(layer.Weights.GetData() + o * layer.NumInputs, inputs);
+		}
+		ok = ok && Read(layer.WeightScales.GetData(), outputs * 4) && Read(layer.Bias.GetData(), outputs * 4);
+		if (!ok) {
+			outError = FString::Printf(TEXT("truncated layer %u"), l);
+			return false;
+		}
+		expectedInputs = outputs;
+	}
+	if (offset != file.Num()) {
+		outError = FString::Printf(TEXT("%i bytes left over"), file.Num() - offset);
+		return false;
+	}
+
+	// check the whole thing the way the brain will before replacing anything
+	UThrowPolicyAsset* check = NewObject<UThrowPolicyAsset>();
+	check->InputScale = inputScale;
+	check->Temperature = temperature;
+	check->Layers = layers;
+	if (!FThrowPolicy(check).IsValid()) {
+		outError = FString::Printf(TEXT("not a valid network, it must end in %i outputs no wider than %i"),
+			FThrowPolicy::NumActions, FThrowPolicy::MaxWidth);
+		return false;
+	}
+
+	InputScale = inputScale;
+	Temperature = temperature;
+	Layers = MoveTemp(layers);
+	return true;
+}
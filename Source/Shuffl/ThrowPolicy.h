@@ -0,0 +1,131 @@
+// Copyright (C) 2020 Valentin Galea
+//
+// This program is free software : you can redistribute it and /or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/DataAsset.h"
+
+#include "Def.h"
+
+#include "ThrowPolicy.generated.h"
+
+//
+// Small fully connected network picking the AI throw, run on the CPU
+//
+// Weights are int8 with a float scale per output row, activations are re-quantized to
+// int8 between layers (ReLU on all but the last). The dot products run on NEON (mobile),
+// AVX2 (desktop builds that enable it) or SSE2 (any other x64) with a plain C++ fallback;
+// one inference is a few thousand multiply-adds on stack buffers, no heap allocation.
+//
+// Input: the pucks on the table sorted closest to the edge first (position on the table
+// + own/opponent/empty), the match scores and the throws left in the round.
+// Output: one logit per discrete throw (placement x force x kind), see `FThrowPolicy`.
+//
+// Trained weights come in a little endian file, see `UThrowPolicyImportCommandlet`:
+//   magic:"SHPN" version:u32 input_scale:f32 temperature:f32 layers:u32
+//   per layer:
+//     inputs:u32 outputs:u32 output_scale:f32
+//     weights:i8[outputs * inputs] (row major) weight_scales:f32[outputs] bias:f32[outputs]
+// `inputs` is the real count (`NumFeatures` for the first layer, the previous layer's
+// `outputs` after), the rows get padded with zero weights on import.
+//
+
+USTRUCT()
+struct FThrowPolicyLayer
+{
+	GENERATED_BODY()
+
+	/** padded to a multiple of `FThrowPolicy::Lanes` (with zero weights) */
+	UPROPERTY(VisibleAnywhere, Category = Policy)
+	int32 NumInputs = 0;
+
+	UPROPERTY(VisibleAnywhere, Category = Policy)
+	int32 NumOutputs = 0;
+
+	/** [output][input] row major */
+	UPROPERTY()
+	TArray<int8> Weights;
+
+	/** dequantization factor per output row */
+	UPROPERTY()
+	TArray<float> WeightScales;
+
+	UPROPERTY()
+	TArray<float> Bias;
+
+	/** quantization step of this layer's outputs as fed to the next one */
+	UPROPERTY(VisibleAnywhere, Category = Policy)
+	float OutputScale = 1.f / 127.f;
+};
+
+UCLASS(BlueprintType)
+class SHUFFL_API UThrowPolicyAsset : public UDataAsset
+{
+	GENERATED_BODY()
+
+public:
+	/** quantization step of the (normalized -1..1) input features */
+	UPROPERTY(EditAnywhere, Category = Policy)
+	float InputScale = 1.f / 127.f;
+
+	/** pick among the top throws by their probability instead of always the best one */
+	UPROPERTY(EditAnywhere, Category = Policy)
+	float Temperature = 0.f;
+
+	/** filled by `ImportWeights` */
+	UPROPERTY(VisibleAnywhere, Category = Policy)
+	TArray<FThrowPolicyLayer> Layers;
+
+	static constexpr uint32 FileMagic = 'S' | 'H' << 8 | 'P' << 16 | 'N' << 24;
+	static constexpr uint32 FileVersion = 1;
+
+	/** replaces the network with the file's (format above), false and untouched if it's not usable */
+	bool ImportWeights(const TArray<uint8>& file, FString& outError);
+};
+
+class FThrowPolicy
+{
+public:
+	static constexpr int Lanes = 16; // int8 per SIMD step
+	static constexpr int MaxWidth = 256; // widest layer supported
+
+	// input encoding
+	static constexpr int FeaturesPerPuck = 5; // x, y, own, opponent, empty
+	static constexpr int NumFeatures = ERound::TotalThrows * FeaturesPerPuck + 3;
+
+	// output decoding
+	static constexpr int NumPlacements = 5; // along the start line
+	static constexpr int NumForces = 8; // up to the max force
+	static constexpr int NumKinds = 5; // straight, angled left/right, spin left/right
+	static constexpr int NumActions = NumPlacements * NumForces * NumKinds;
+
+	explicit FThrowPolicy(const UThrowPolicyAsset*);
+
+	/** layer sizes chain up, fit the buffers and end in `NumActions` */
+	bool IsValid() const { return bValid; }
+
+	/** picks a throw for the table in `req` (`Value` holds the logit), ~µs and no allocations */
+	bool Decide(const struct FAIPlanRequest& req, int ownScore, int opponentScore, struct FAIMove& out) const;
+
+	static void Encode(const struct FAIPlanRequest& req, int ownScore, int opponentScore, float* features);
+	static struct FAIMove DecodeAction(const struct FAIPlanRequest& req, int action);
+
+private:
+	void Forward(const float* features, float* logits) const;
+
+	const UThrowPolicyAsset* Asset;
+	bool bValid = false;
+};
@@ -0,0 +1,79 @@
+// Copyright (C) 2020 Valentin Galea
+//
+// This program is free software : you can redistribute it and /or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#include "Commandlets.h"
+
+#include "Misc/FileHelper.h"
+#include "Misc/PackageName.h"
+#include "UObject/Package.h"
+
+#include "Shuffl.h"
+#include "ThrowPolicy.h"
+
+int32 UThrowPolicyImportCommandlet::Main(const FString& params)
+{
+	LogShuffl.SetVerbosity(ELogVerbosity::Display); // the report, the category defaults to warnings
+
+	FString inputPath, assetPath;
+	if (!FParse::Value(*params, TEXT("Input="), inputPath) || !FParse::Value(*params, TEXT("Asset="), assetPath)) {
+		UE_LOG(LogShuffl, Error, TEXT("usage: -run=ThrowPolicyImport -Input=<file> -Asset=/Game/<path>.<name>"));
+		return 1;
+	}
+
+	TArray<uint8> file;
+	if (!FFileHelper::LoadFileToArray(file, *inputPath)) {
+		UE_LOG(LogShuffl, Error, TEXT("can't read %s"), *inputPath);
+		return 1;
+	}
+
+#if WITH_EDITOR
+	const FString packageName = FPackageName::ObjectPathToPackageName(assetPath);
+	const FString assetName = FPackageName::GetLongPackageAssetName(packageName);
+	if (!FPackageName::IsValidLongPackageName(packageName) || !packageName.StartsWith(TEXT("/Game/"))) {
+		UE_LOG(LogShuffl, Error, TEXT("%s is not a project asset path"), *assetPath);
+		return 1;
+	}
+
+	UPackage* package = CreatePackage(nullptr, *packageName);
+	package->FullyLoad();
+	auto* asset = FindObject<UThrowPolicyAsset>(package, *assetName);
+	if (!asset) {
+		asset = NewObject<UThrowPolicyAsset>(package, *assetName, RF_Public | RF_Standalone);
+	}
+
+	FString error;
+	if (!asset->ImportWeights(file, error)) {
+		UE_LOG(LogShuffl, Error, TEXT("%s: %s"), *inputPath, *error);
+		return 1;
+	}
+
+	package->MarkPackageDirty();
+	const FString packageFile = FPackageName::LongPackageNameToFilename(packageName, FPackageName::GetAssetPackageExtension());
+	if (!UPackage::SavePackage(package, asset, RF_Public | RF_Standalone, *packageFile)) {
+		UE_LOG(LogShuffl, Error, TEXT("can't save %s"), *packageFile);
+		return 1;
+	}
+
+	FString shape = FString::FromInt(FThrowPolicy::NumFeatures);
+	for (const auto& layer : asset->Layers) {
+		shape += FString::Printf(TEXT(" -> %i"), layer.NumOutputs);
+	}
+	UE_LOG(LogShuffl, Display, TEXT("saved %s: %s, temperature %.2f"), *asset->GetPathName(), *shape, asset->Temperature);
+	return 0;
+#else
+	UE_LOG(LogShuffl, Error, TEXT("assets can only be saved from an editor build"));
+	return 1;
+#endif
+}
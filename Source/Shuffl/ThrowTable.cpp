@@ -0,0 +1,279 @@
+// Copyright (C) 2020 Valentin Galea
+//
+// This program is free software : you can redistribute it and /or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#include "ThrowTable.h"
+
+#include "Async/MappedFileHandle.h"
+#include "HAL/PlatformFilemanager.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Misc/Crc.h"
+
+#include "Shuffl.h"
+#include "Puck.h"
+#include "PlayerCtrl.h"
+
+struct FThrowTable::FHeader
+{
+	static constexpr uint32 CurrentMagic = 0x54485254; // "TRHT"
+	static constexpr uint32 CurrentVersion = 1;
+
+	uint32 Magic = CurrentMagic;
+	uint32 Version = CurrentVersion;
+	uint32 Fingerprint = 0;
+	int32 NumForce = FThrowTable::NumForce;
+	int32 NumAngle = FThrowTable::NumAngle;
+	int32 NumVelocity = FThrowTable::NumVelocity;
+	float ForceMax = 0.f;
+	float SpinVelocityMax = 0.f;
+};
+
+struct FThrowTable::FCell
+{
+	float X, Y; // rest displacement from the start
+	float Time;
+};
+
+static const TCHAR* TableFile = TEXT("ThrowTable.bin");
+
+static constexpr float AngleMin = -PI / 2.f;
+static constexpr float AngleMax = PI / 2.f;
+
+FThrowTableTuning FThrowTableTuning::FromConfig()
+{
+	return FromCtrl(GetDefault<APlayerCtrl>());
+}
+
+FThrowTableTuning FThrowTableTuning::FromCtrl(const APlayerCtrl* ctrl)
+{
+	FThrowTableTuning tuning;
+	tuning.ForceMax = ctrl->ThrowForceMax;
+	tuning.SpinVelocityMax = ctrl->EscapeVelocity;
+	tuning.ThrowForceScaling = ctrl->ThrowForceScaling;
+	tuning.SpinTime = ctrl->SpinTime;
+	tuning.SpinSlowMoFactor = ctrl->SpinSlowMoFactor;
+	tuning.SlingshotForceScaling = ctrl->SlingshotForceScaling;
+	tuning.EscapeVelocity = ctrl->EscapeVelocity;
+	return tuning;
+}
+
+FVector2D FThrowTableTuning::FlickForce(FVector2D gesture, float velocity) const
+{
+	gesture.Normalize();
+	gesture *= velocity / (50.f - ThrowForceScaling);
+		//TODO: HACK: inverted it so it makes more sense: low scale -> slow flick push
+
+	return FVector2D(
+		FMath::Clamp(FMath::Abs(gesture.Y), 0.f, ForceMax),
+		FMath::Clamp(gesture.X, -ForceMax, ForceMax));
+}
+
+FVector2D FThrowTableTuning::SlingshotForce(FVector2D pull) const
+{
+	auto f = pull * SlingshotForceScaling;
+	auto len = f.Size();
+	f.Normalize();
+	f *= FMath::Min(len, ForceMax);
+	return f;
+}
+
+uint32 FThrowTable::Fingerprint(const FPuckSimParams& params, const FThrowTableTuning& tuning)
+{
+	const float values[] = {
+		params.Mass, params.Friction, params.LinearDamping, params.Gravity, params.Radius,
+		params.Restitution, params.PhysicsStep, params.SpinStep,
+		tuning.ForceMax, tuning.SpinVelocityMax, tuning.SpinDelay, tuning.ThrowForceScaling,
+		tuning.SpinTime, tuning.SpinSlowMoFactor, tuning.SlingshotForceScaling,
+	};
+	return FCrc::MemCrc32(values, sizeof(values), FHeader::CurrentVersion);
+}
+
+TSharedPtr<const FThrowTable, ESPMode::ThreadSafe> FThrowTable::Get(const APuck* puck)
+{
+	check(IsInGameThread());
+	static TSharedPtr<const FThrowTable, ESPMode::ThreadSafe> Current;
+	if (!puck) return Current;
+
+	const FPuckSimParams params = FPuckSimParams::FromPuck(puck);
+	const FThrowTableTuning tuning = FThrowTableTuning::FromConfig();
+	const uint32 fingerprint = Fingerprint(params, tuning);
+	if (Current.IsValid() && Current->Header->Fingerprint == fingerprint) return Current;
+
+	Current.Reset(); // unmap before it gets overwritten
+	const FString path = FPaths::Combine(FPaths::ProjectSavedDir(), TableFile);
+
+	TSharedPtr<FThrowTable, ESPMode::ThreadSafe> table(new FThrowTable());
+	if (!table->Map(path, fingerprint)) {
+		ShufflLog(TEXT("rebuilding throw table %08x"), fingerprint);
+		if (!Generate(path, params, tuning, fingerprint) || !table->Map(path, fingerprint)) {
+			ShufflErr(TEXT("can't build throw table at %s"), *path);
+			return nullptr;
+		}
+	}
+
+	Current = table;
+	return Current;
+}
+
+FThrowTable::~FThrowTable()
+{
+	Region.Reset(); // before the file
+	File.Reset();
+}
+
+bool FThrowTable::Map(const FString& path, uint32 fingerprint)
+{
+	const int64 size = sizeof(FHeader) + sizeof(FCell) * NumForce * NumAngle * NumVelocity;
+
+	const uint8* data = nullptr;
+	File.Reset(FPlatformFileManager::Get().GetPlatformFile().OpenMapped(*path));
+	if (File.IsValid() && File->GetFileSize() == size) {
+		Region.Reset(File->MapRegion(0, size));
+		data = Region.IsValid() ? Region->GetMappedPtr() : nullptr;
+	}
+	if (!data) { // no memory mapping on this platform (or no file)
+		Region.Reset();
+		File.Reset();
+		if (!FFileHelper::LoadFileToArray(Loaded, *path, FILEREAD_Silent) || Loaded.Num() != size) {
+			return false;
+		}
+		data = Loaded.GetData();
+	}
+
+	const auto* header = reinterpret_cast<const FHeader*>(data);
+	if (header->Magic != FHeader::CurrentMagic || header->Version != FHeader::CurrentVersion ||
+		header->Fingerprint != fingerprint ||
+		header->NumForce != NumForce || header->NumAngle != NumAngle || header->NumVelocity != NumVelocity) {
+		Region.Reset();
+		File.Reset();
+		Loaded.Empty();
+		return false;
+	}
+
+	Header = header;
+	Cells = reinterpret_cast<const FCell*>(data + sizeof(FHeader));
+	return true;
+}
+
+bool FThrowTable::Generate(const FString& path, const FPuckSimParams& params,
+	const FThrowTableTuning& tuning, uint32 fingerprint)
+{
+	FHeader header;
+	header.Fingerprint = fingerprint;
+	header.ForceMax = tuning.ForceMax;
+	header.SpinVelocityMax = tuning.SpinVelocityMax;
+
+	TArray<uint8> out;
+	out.SetNumUninitialized(sizeof(FHeader) + sizeof(FCell) * NumForce * NumAngle * NumVelocity);
+	FMemory::Memcpy(out.GetData(), &header, sizeof(FHeader));
+	auto* cells = reinterpret_cast<FCell*>(out.GetData() + sizeof(FHeader));
+
+	for (int f = 0; f < NumForce; ++f) {
+		for (int a = 0; a < NumAngle; ++a) {
+			for (int v = 0; v < NumVelocity; ++v) {
+				FPuckThrow t;
+				t.Force = FVector2D(tuning.ForceMax * f / (NumForce - 1), 0.f);
+				t.SpinAngle = FMath::Lerp(AngleMin, AngleMax, float(a) / (NumAngle - 1));
+				t.SpinVelocity = tuning.SpinVelocityMax * v / (NumVelocity - 1);
+				t.SpinDelay = tuning.SpinDelay;
+
+				const FPuckRest rest = PuckSim::PredictRest(params, t);
+				cells[(f * NumAngle + a) * NumVelocity + v] = { rest.Position.X, rest.Position.Y, rest.Time };
+			}
+		}
+	}
+
+	return FFileHelper::SaveArrayToFile(out, *path);
+}
+
+const FThrowTable::FCell& FThrowTable::Cell(int force, int angle, int velocity) const
+{
+	return Cells[(force * NumAngle + angle) * NumVelocity + velocity];
+}
+
+float FThrowTable::GetForceMax() const
+{
+	return Header->ForceMax;
+}
+
+FVector FThrowTable::Sample(float force, float angle, float velocity) const
+{
+	// grid coordinates, clamped to the baked range
+	auto Coord = [](float v, float lo, float hi, int num, int& i0, float& frac) {
+		const float x = FMath::Clamp((v - lo) / (hi - lo), 0.f, 1.f) * (num - 1);
+		i0 = FMath::Min(FMath::FloorToInt(x), num - 2);
+		frac = x - i0;
+	};
+	int f0, a0, v0;
+	float ff, af, vf;
+	Coord(force, 0.f, Header->ForceMax, NumForce, f0, ff);
+	Coord(angle, AngleMin, AngleMax, NumAngle, a0, af);
+	Coord(velocity, 0.f, Header->SpinVelocityMax, NumVelocity, v0, vf);
+
+	FVector out = FVector::ZeroVector;
+	for (int corner = 0; corner < 8; ++corner) {
+		const int df = corner & 1, da = (corner >> 1) & 1, dv = corner >> 2;
+		const float w = (df ? ff : 1.f - ff) * (da ? af : 1.f - af) * (dv ? vf : 1.f - vf);
+		const FCell& c = Cell(f0 + df, a0 + da, v0 + dv);
+		out += FVector(c.X, c.Y, c.Time) * w;
+	}
+	return out;
+}
+
+FPuckRest FThrowTable::Lookup(const FPuckThrow& t) const
+{
+	FPuckRest rest;
+	if (t.SpinVelocity > 0.f && t.SpinAngle != 0.f) {
+		// spin throws go straight down the lane (see `APlayerCtrl::ThrowPuck`)
+		const FVector s = Sample(t.Force.X, t.SpinAngle, t.SpinVelocity);
+		rest.Position = t.Start + FVector2D(s.X, s.Y);
+		rest.Time = s.Z;
+	} else {
+		// no spin: the straight throw rotated onto the force direction
+		const float force = t.Force.Size();
+		const FVector s = Sample(force, 0.f, 0.f);
+		const FVector2D dir = force > 0.f ? t.Force / force : FVector2D(1.f, 0.f);
+		rest.Position = t.Start + dir * s.X;
+		rest.Time = s.Z;
+	}
+	return rest;
+}
+
+bool FThrowTable::FindForce(FVector2D start, FVector2D target, FVector2D& outForce) const
+{
+	const FVector2D d = target - start;
+	const float dist = d.Size();
+
+	// distance grows with force, search the no spin slice then invert the segment
+	auto Dist = [this](int f) { return Cell(f, 0, 0).X; };
+	if (dist > Dist(NumForce - 1)) return false;
+
+	int lo = 0, hi = NumForce - 1;
+	while (hi - lo > 1) {
+		const int mid = (lo + hi) / 2;
+		if (Dist(mid) < dist) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+
+	const float d0 = Dist(lo), d1 = Dist(hi);
+	const float frac = d1 > d0 ? (dist - d0) / (d1 - d0) : 0.f;
+	const float force = (lo + frac) * Header->ForceMax / (NumForce - 1);
+
+	outForce = dist > 0.f ? d / dist * force : FVector2D::ZeroVector;
+	return true;
+}
@@ -0,0 +1,96 @@
+// Copyright (C) 2020 Valentin Galea
+//
+// This program is free software : you can redistribute it and /or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "PuckSim.h"
+
+//
+// Baked throw response: where a puck comes to rest on an empty table
+//
+// A grid over (force, spin angle, spin velocity) of rest displacements, generated from
+// `PuckSim::PredictRest`. On an empty table the outcome doesn't depend on where on the
+// start line the puck was placed (it just translates) and throws without spin are
+// rotation invariant, so the start offset and the lateral force don't need an axis.
+//
+// Stored as a flat binary file mapped straight into memory. The header carries a
+// fingerprint of the physics (puck material, mass, damping ...) and of the throw tuning
+// in DefaultGame.ini; on any mismatch the table gets rebuilt (a few ms) and rewritten.
+//
+
+/** the `APlayerCtrl` throw config the table is built for */
+struct FThrowTableTuning
+{
+	float ForceMax = 150.f;
+	float SpinVelocityMax = 300.f;
+	float SpinDelay = 1.f / 60.f; // sec from throw to spin (timer before spin mode)
+	float ThrowForceScaling = 25.f;
+	float SpinTime = 3.f;
+	float SpinSlowMoFactor = .1f;
+	float SlingshotForceScaling = 5.f;
+	float EscapeVelocity = 300.f; // pixels per sec, slower flicks only move the puck
+
+	static FThrowTableTuning FromConfig();
+	static FThrowTableTuning FromCtrl(const class APlayerCtrl*);
+
+	/** throw force of a flick (screen space gesture, pixels per sec), without spin */
+	FVector2D FlickForce(FVector2D gesture, float velocity) const;
+
+	/** throw force of a slingshot pulled back by `pull` (cm on the table) */
+	FVector2D SlingshotForce(FVector2D pull) const;
+};
+
+class FThrowTable
+{
+public:
+	static constexpr int NumForce = 64;
+	static constexpr int NumAngle = 17; // [-PI/2, PI/2]
+	static constexpr int NumVelocity = 9; // [0, SpinVelocityMax]
+
+	/** current table for this puck's physics, (re)built if needed - game thread */
+	static TSharedPtr<const FThrowTable, ESPMode::ThreadSafe> Get(const class APuck*);
+
+	~FThrowTable();
+
+	/** interpolated rest position (and time) of a throw, no collisions - any thread */
+	FPuckRest Lookup(const FPuckThrow&) const;
+
+	/** force (without spin) that stops a puck placed at `start` on `target` */
+	bool FindForce(FVector2D start, FVector2D target, FVector2D& outForce) const;
+
+	float GetForceMax() const;
+
+	static uint32 Fingerprint(const FPuckSimParams&, const FThrowTableTuning&);
+
+private:
+	struct FHeader;
+	struct FCell;
+
+	FThrowTable() = default;
+	bool Map(const FString& path, uint32 fingerprint);
+	static bool Generate(const FString& path, const FPuckSimParams&, const FThrowTableTuning&, uint32 fingerprint);
+
+	const FCell& Cell(int force, int angle, int velocity) const;
+	FVector Sample(float force, float angle, float velocity) const; // X,Y: displacement Z: time
+
+	TUniquePtr<class IMappedFileHandle> File;
+	TUniquePtr<class IMappedFileRegion> Region;
+	TArray<uint8> Loaded; // when the platform can't map files
+
+	const FHeader* Header = nullptr;
+	const FCell* Cells = nullptr;
+};
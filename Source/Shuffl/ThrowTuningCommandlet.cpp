@@ -0,0 +1,421 @@
+// Copyright (C) 2020 Valentin Galea
+//
+// This program is free software : you can redistribute it and /or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#include "Commandlets.h"
+
+#include "Engine/World.h"
+#include "Async/ParallelFor.h"
+#include "Components/PrimitiveComponent.h"
+#include "HAL/PlatformTime.h"
+#include "Math/RandomStream.h"
+#include "Misc/FileHelper.h"
+#include "Misc/PackageName.h"
+#include "Misc/Paths.h"
+#include "Misc/ScopeExit.h"
+#include "PhysicalMaterials/PhysicalMaterial.h"
+#include "UObject/Package.h"
+
+#include "Shuffl.h"
+#include "PlayerCtrl.h"
+#include "PuckSim.h"
+#include "ScoringVolume.h"
+#include "ThrowTable.h"
+
+namespace ETuningParam
+{
+	enum Type { ThrowForceScaling, ThrowForceMax, SlingshotForceScaling, EscapeVelocity, Friction, Num };
+}
+
+static const TCHAR* ParamNames[ETuningParam::Num] = {
+	TEXT("ThrowForceScaling"), TEXT("ThrowForceMax"), TEXT("SlingshotForceScaling"), TEXT("EscapeVelocity"), TEXT("Friction")
+};
+
+// search box, roughly what still feels like the game
+static const float ParamMin[ETuningParam::Num] = { 0.f, 50.f, .5f, 50.f, .05f };
+static const float ParamMax[ETuningParam::Num] = { 49.f, 400.f, 10.f, 1500.f, .6f };
+
+enum class ETuningGoal : uint8
+{
+	Target, // a gesture from the config lands on `Value` (X)
+	TableEnd, // a `ThrowForceMax` throw stops on `Value` (X)
+	Escape, // the slowest flick that throws reaches `Value` (X)
+	SlideTime // the median flick takes `Value` sec to stop
+};
+
+struct FTuningGoal
+{
+	FString Name;
+	ETuningGoal Kind = ETuningGoal::Target;
+	EThrowGesture Gesture = EThrowGesture::Flick;
+	float Magnitude = 0.f;
+	float Value = 0.f;
+	float Scale = 1.f; // error that counts as 1
+};
+
+struct FTuningCandidate
+{
+	float Values[ETuningParam::Num] = {};
+	float Loss = MAX_flt;
+};
+
+// everything a candidate is evaluated against, read only while sweeping
+struct FTuningProblem
+{
+	FPuckSimParams Physics;
+	FThrowTableTuning Tuning;
+	FPuckTableLayout Layout;
+	FScoringZones Zones;
+	FVector2D Start = FVector2D::ZeroVector;
+	float PuckZ = 0.f;
+	TArray<FTuningGoal> Goals;
+
+	void Apply(const FTuningCandidate&, FThrowTableTuning&, FPuckSimParams&) const;
+	float Achieved(const FTuningGoal&, const FThrowTableTuning&, const FPuckSimParams&) const;
+	float Evaluate(const FTuningCandidate&) const;
+};
+
+// straight up the screen or pulled straight back, same as the player does
+static FVector2D GestureForce(const FThrowTableTuning& tuning, EThrowGesture gesture, float magnitude)
+{
+	return gesture == EThrowGesture::Flick
+		? tuning.FlickForce(FVector2D(0.f, -1.f), magnitude)
+		: tuning.SlingshotForce(FVector2D(magnitude, 0.f));
+}
+
+void FTuningProblem::Apply(const FTuningCandidate& c, FThrowTableTuning& tuning, FPuckSimParams& physics) const
+{
+	tuning = Tuning;
+	tuning.ThrowForceScaling = c.Values[ETuningParam::ThrowForceScaling];
+	tuning.ForceMax = c.Values[ETuningParam::ThrowForceMax];
+	tuning.SlingshotForceScaling = c.Values[ETuningParam::SlingshotForceScaling];
+	tuning.EscapeVelocity = c.Values[ETuningParam::EscapeVelocity];
+	tuning.SpinVelocityMax = tuning.EscapeVelocity;
+	physics = Physics;
+	physics.Friction = c.Values[ETuningParam::Friction];
+}
+
+float FTuningProblem::Achieved(const FTuningGoal& goal, const FThrowTableTuning& tuning, const FPuckSimParams& physics) const
+{
+	FPuckThrow t;
+	t.Start = Start;
+	switch (goal.Kind) {
+	case ETuningGoal::Target:
+	case ETuningGoal::SlideTime:
+		t.Force = GestureForce(tuning, goal.Gesture, goal.Magnitude);
+		break;
+	case ETuningGoal::TableEnd:
+		t.Force = FVector2D(tuning.ForceMax, 0.f);
+		break;
+	case ETuningGoal::Escape:
+		t.Force = GestureForce(tuning, EThrowGesture::Flick, tuning.EscapeVelocity);
+		break;
+	}
+
+	const FPuckRest rest = PuckSim::PredictRest(physics, t);
+	return goal.Kind == ETuningGoal::SlideTime ? rest.Time : rest.Position.X;
+}
+
+float FTuningProblem::Evaluate(const FTuningCandidate& c) const
+{
+	FThrowTableTuning tuning;
+	FPuckSimParams physics;
+	Apply(c, tuning, physics);
+
+	float loss = 0.f;
+	for (const FTuningGoal& goal : Goals) {
+		loss += FMath::Square((Achieved(goal, tuning, physics) - goal.Value) / goal.Scale);
+	}
+	return loss;
+}
+
+// longest stretch of the throwing lane worth `points`
+static bool FindZoneSpan(const FTuningProblem& problem, int points, float& outMin, float& outMax)
+{
+	const float step = 1.f; // cm
+	float bestLen = 0.f, runStart = 0.f;
+	bool inRun = false;
+	for (float x = problem.Layout.Surface.Min.X; x <= problem.Layout.Surface.Max.X + step; x += step) {
+		const bool match = x <= problem.Layout.Surface.Max.X &&
+			problem.Zones.GetPoints(FVector(x, problem.Start.Y, problem.PuckZ)) == points;
+		if (match && !inRun) {
+			runStart = x;
+		} else if (!match && inRun && x - runStart > bestLen) {
+			bestLen = x - runStart;
+			outMin = runStart;
+			outMax = x - step;
+		}
+		inRun = match;
+	}
+	return bestLen > 0.f;
+}
+
+static float FirstZoneX(const FTuningProblem& problem)
+{
+	for (float x = problem.Start.X; x <= problem.Layout.Surface.Max.X; x += 1.f) {
+		if (problem.Zones.GetPoints(FVector(x, problem.Start.Y, problem.PuckZ)) > 0) return x;
+	}
+	return problem.Layout.Surface.Max.X;
+}
+
+// `num` candidates uniformly inside [lo, hi], every one seeded on its own so the result
+// doesn't depend on how the work got split; keeps `best` if none beats it
+static void Sweep(const FTuningProblem& problem, const float* lo, const float* hi, int num, int32 seed,
+	FTuningCandidate& best)
+{
+	TArray<FTuningCandidate> candidates;
+	candidates.SetNum(num);
+	ParallelFor(num, [&](int32 i) {
+		FRandomStream rand(int32(HashCombine(uint32(seed), uint32(i))));
+		FTuningCandidate& c = candidates[i];
+		for (int p = 0; p < ETuningParam::Num; ++p) {
+			c.Values[p] = rand.FRandRange(lo[p], hi[p]);
+		}
+		c.Loss = problem.Evaluate(c);
+	});
+
+	for (const FTuningCandidate& c : candidates) {
+		if (c.Loss < best.Loss) {
+			best = c;
+		}
+	}
+}
+
+static float SampleLogNormal(FRandomStream& rand, float median, float sigma)
+{
+	const float u = FMath::Max(rand.FRand(), SMALL_NUMBER);
+	const float gauss = FMath::Sqrt(-2.f * FMath::Loge(u)) * FMath::Cos(2.f * PI * rand.FRand());
+	return median * FMath::Exp(sigma * gauss);
+}
+
+// where a population of gestures ends up: % per zone points, short of the zones and off the table
+static FString OutcomeCurve(const FTuningProblem& problem, const FTuningCandidate& c, EThrowGesture gesture,
+	float median, float spread, int32 seed)
+{
+	static constexpr int Samples = 10000;
+
+	FThrowTableTuning tuning;
+	FPuckSimParams physics;
+	problem.Apply(c, tuning, physics);
+
+	TMap<int, int> perPoints;
+	for (int zone = 0; zone < problem.Zones.Num(); ++zone) {
+		perPoints.Add(problem.Zones.GetZonePoints(zone), 0);
+	}
+	perPoints.KeySort(TLess<int>());
+	int noThrow = 0, off = 0;
+
+	FRandomStream rand(seed);
+	for (int i = 0; i < Samples; ++i) {
+		const float magnitude = SampleLogNormal(rand, median, spread);
+		if (gesture == EThrowGesture::Flick && magnitude < tuning.EscapeVelocity) {
+			noThrow++;
+			continue;
+		}
+
+		FPuckThrow t;
+		t.Start = problem.Start;
+		t.Force = GestureForce(tuning, gesture, magnitude);
+		const FVector2D rest = PuckSim::PredictRest(physics, t).Position;
+		if (rest.X > problem.Layout.Surface.Max.X || problem.Layout.Kill.IsInside(rest)) {
+			off++;
+			continue;
+		}
+		perPoints.FindOrAdd(problem.Zones.GetPoints(FVector(rest, problem.PuckZ)))++;
+	}
+
+	FString out;
+	for (const auto& i : perPoints) {
+		out += FString::Printf(TEXT(" %ipt %5.1f%%"), i.Key, 100.f * i.Value / Samples);
+	}
+	out += FString::Printf(TEXT(" | off %5.1f%%"), 100.f * off / Samples);
+	if (gesture == EThrowGesture::Flick) {
+		out += FString::Printf(TEXT(" | too slow %5.1f%%"), 100.f * noThrow / Samples);
+	}
+	return out;
+}
+
+UThrowTuningCommandlet::UThrowTuningCommandlet()
+{
+	IsClient = false;
+	IsServer = false;
+	IsEditor = true; // for -SaveMaterial
+	LogToConsole = true;
+}
+
+int32 UThrowTuningCommandlet::Main(const FString& params)
+{
+	LogShuffl.SetVerbosity(ELogVerbosity::Display); // the report, the category defaults to warnings
+
+	FString mapName = TEXT("/Game/L_Main");
+	FString outputPath = FPaths::ProjectSavedDir() / TEXT("Tuning/ThrowTuning.ini");
+	int32 seed = 0;
+	FParse::Value(*params, TEXT("Map="), mapName);
+	FParse::Value(*params, TEXT("Output="), outputPath);
+	FParse::Value(*params, TEXT("Seed="), seed);
+	FParse::Value(*params, TEXT("Candidates="), Candidates);
+	FParse::Value(*params, TEXT("SlideTime="), SlideTime);
+
+	APuck* puck = nullptr;
+	FVector startingPoint;
+	UWorld* world = ShufflCommandlet::LoadTable(mapName, puck, startingPoint);
+	if (!world) return 1;
+	ON_SCOPE_EXIT { ShufflCommandlet::UnloadTable(world); };
+
+	FTuningProblem problem;
+	problem.Physics = FPuckSimParams::FromPuck(puck);
+	problem.Tuning = FThrowTableTuning::FromConfig();
+	problem.Layout = FPuckTableLayout::FromWorld(world);
+	problem.Zones = FScoringZones::FromWorld(world);
+	problem.Start = FVector2D(startingPoint);
+	problem.PuckZ = startingPoint.Z;
+	if (!problem.Zones.Num() || !problem.Layout.Surface.bIsValid) {
+		UE_LOG(LogShuffl, Error, TEXT("%s has no scoring volumes"), *mapName);
+		return 1;
+	}
+
+	//
+	// the goals
+	//
+	for (const FThrowTuningTarget& target : Targets) {
+		float zoneMin, zoneMax;
+		if (!FindZoneSpan(problem, target.Points, zoneMin, zoneMax)) {
+			UE_LOG(LogShuffl, Error, TEXT("no %i point zone in front of the starting point"), target.Points);
+			return 1;
+		}
+		FTuningGoal& goal = problem.Goals.AddDefaulted_GetRef();
+		goal.Name = FString::Printf(TEXT("%s %.0f -> %ipt"),
+			target.Gesture == EThrowGesture::Flick ? TEXT("flick") : TEXT("slingshot"), target.Magnitude, target.Points);
+		goal.Gesture = target.Gesture;
+		goal.Magnitude = target.Magnitude;
+		goal.Value = (zoneMin + zoneMax) / 2.f;
+		goal.Scale = FMath::Max((zoneMax - zoneMin) / 2.f, 1.f);
+	}
+	{
+		FTuningGoal& goal = problem.Goals.AddDefaulted_GetRef();
+		goal.Name = TEXT("max force -> table end");
+		goal.Kind = ETuningGoal::TableEnd;
+		goal.Value = problem.Layout.Surface.Max.X - problem.Physics.Radius;
+		goal.Scale = Tolerance;
+	}
+	{
+		FTuningGoal& goal = problem.Goals.AddDefaulted_GetRef();
+		goal.Name = TEXT("escape flick -> first zone");
+		goal.Kind = ETuningGoal::Escape;
+		goal.Value = FirstZoneX(problem);
+		goal.Scale = Tolerance;
+	}
+	if (SlideTime > 0.f) {
+		FTuningGoal& goal = problem.Goals.AddDefaulted_GetRef();
+		goal.Name = FString::Printf(TEXT("flick %.0f slide time"), FlickMedian);
+		goal.Kind = ETuningGoal::SlideTime;
+		goal.Magnitude = FlickMedian;
+		goal.Value = SlideTime;
+		goal.Scale = SlideTime; // relative
+	}
+
+	//
+	// search: wide random sweep, then keep shrinking the box around the best
+	//
+	FTuningCandidate current;
+	current.Values[ETuningParam::ThrowForceScaling] = problem.Tuning.ThrowForceScaling;
+	current.Values[ETuningParam::ThrowForceMax] = problem.Tuning.ForceMax;
+	current.Values[ETuningParam::SlingshotForceScaling] = problem.Tuning.SlingshotForceScaling;
+	current.Values[ETuningParam::EscapeVelocity] = problem.Tuning.EscapeVelocity;
+	current.Values[ETuningParam::Friction] = problem.Physics.Friction;
+	current.Loss = problem.Evaluate(current);
+
+	const double startTime = FPlatformTime::Seconds();
+	FTuningCandidate best = current;
+	Sweep(problem, ParamMin, ParamMax, FMath::Max(Candidates, 1), seed, best);
+
+	float extent = 1.f;
+	for (int round = 0; round < RefineRounds; ++round) {
+		extent *= .5f;
+		float lo[ETuningParam::Num], hi[ETuningParam::Num];
+		for (int p = 0; p < ETuningParam::Num; ++p) {
+			const float half = (ParamMax[p] - ParamMin[p]) * extent / 2.f;
+			lo[p] = FMath::Max(best.Values[p] - half, ParamMin[p]);
+			hi[p] = FMath::Min(best.Values[p] + half, ParamMax[p]);
+		}
+		Sweep(problem, lo, hi, FMath::Max(Candidates / 4, 1), seed + round + 1, best);
+	}
+	const double elapsed = FPlatformTime::Seconds() - startTime;
+
+	//
+	// report
+	//
+	UE_LOG(LogShuffl, Display, TEXT("%i candidates in %.2f sec, loss %.4f -> %.4f"),
+		Candidates + RefineRounds * (Candidates / 4), elapsed, current.Loss, best.Loss);
+
+	FThrowTableTuning tuningBefore, tuningAfter;
+	FPuckSimParams physicsBefore, physicsAfter;
+	problem.Apply(current, tuningBefore, physicsBefore);
+	problem.Apply(best, tuningAfter, physicsAfter);
+	for (const FTuningGoal& goal : problem.Goals) {
+		UE_LOG(LogShuffl, Display, TEXT("%-32s target %8.2f | current %8.2f | fitted %8.2f"),
+			*goal.Name, goal.Value,
+			problem.Achieved(goal, tuningBefore, physicsBefore),
+			problem.Achieved(goal, tuningAfter, physicsAfter));
+	}
+	for (int p = 0; p < ETuningParam::Num; ++p) {
+		UE_LOG(LogShuffl, Display, TEXT("%-24s %8.3f -> %8.3f"), ParamNames[p], current.Values[p], best.Values[p]);
+	}
+	for (EThrowGesture gesture : { EThrowGesture::Flick, EThrowGesture::Slingshot }) {
+		const bool flick = gesture == EThrowGesture::Flick;
+		const float median = flick ? FlickMedian : SlingshotMedian;
+		UE_LOG(LogShuffl, Display, TEXT("%s around %.0f, current:%s"), flick ? TEXT("flicks") : TEXT("slingshots"),
+			median, *OutcomeCurve(problem, current, gesture, median, GestureSpread, seed));
+		UE_LOG(LogShuffl, Display, TEXT("%s around %.0f,  fitted:%s"), flick ? TEXT("flicks") : TEXT("slingshots"),
+			median, *OutcomeCurve(problem, best, gesture, median, GestureSpread, seed));
+	}
+
+	//
+	// output
+	//
+	FString ini = FString::Printf(TEXT("; -run=ThrowTuning on %s, loss %.4f\n[/Script/Shuffl.PlayerCtrl]\n"),
+		*mapName, best.Loss);
+	ini += FString::Printf(TEXT("EscapeVelocity=%.0f ; pixel / sec\n"), best.Values[ETuningParam::EscapeVelocity]);
+	ini += FString::Printf(TEXT("ThrowForceScaling=%.2f ; 0..50\n"), best.Values[ETuningParam::ThrowForceScaling]);
+	ini += FString::Printf(TEXT("ThrowForceMax=%.1f ; force (after scaling has been applied)\n"), best.Values[ETuningParam::ThrowForceMax]);
+	ini += FString::Printf(TEXT("SlingshotForceScaling=%.3f ; 0..10\n"), best.Values[ETuningParam::SlingshotForceScaling]);
+	ini += FString::Printf(TEXT("; PM_Friction Friction=%.3f\n"), best.Values[ETuningParam::Friction]);
+	if (!FFileHelper::SaveStringToFile(ini, *outputPath)) {
+		UE_LOG(LogShuffl, Error, TEXT("can't write %s"), *outputPath);
+		return 1;
+	}
+	UE_LOG(LogShuffl, Display, TEXT("wrote %s"), *outputPath);
+
+#if WITH_EDITOR
+	if (FParse::Param(*params, TEXT("SaveMaterial"))) {
+		auto* body = Cast<UPrimitiveComponent>(puck->GetRootComponent());
+		UPhysicalMaterial* material = body ? body->BodyInstance.GetSimplePhysicalMaterial() : nullptr;
+		UPackage* package = material ? material->GetOutermost() : nullptr;
+		if (!package || !package->GetName().StartsWith(TEXT("/Game/"))) {
+			UE_LOG(LogShuffl, Error, TEXT("the puck doesn't use a project physical material"));
+			return 1;
+		}
+		material->Friction = best.Values[ETuningParam::Friction];
+		package->MarkPackageDirty();
+		const FString file = FPackageName::LongPackageNameToFilename(package->GetName(), FPackageName::GetAssetPackageExtension());
+		if (!UPackage::SavePackage(package, nullptr, RF_Standalone, *file)) {
+			UE_LOG(LogShuffl, Error, TEXT("can't save %s"), *file);
+			return 1;
+		}
+		UE_LOG(LogShuffl, Display, TEXT("saved %s with Friction=%.3f"), *material->GetPathName(), material->Friction);
+	}
+#endif
+
+	return 0;
+}
@@ -0,0 +1,404 @@
+// Copyright (C) 2020 Valentin Galea
+//
+// This program is free software : you can redistribute it and /or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#include "Commandlets.h"
+
+#include "Engine/World.h"
+#include "Async/ParallelFor.h"
+#include "HAL/PlatformTime.h"
+#include "Math/RandomStream.h"
+#include "Misc/FileHelper.h"
+#include "Misc/ScopeExit.h"
+
+#include "Shuffl.h"
+#include "AIPlanner.h"
+#include "PlayerCtrl.h"
+#include "ThrowDataset.h"
+#include "ThrowPolicy.h"
+#include "ThrowTable.h"
+
+static constexpr int MaxRounds = 100; // nobody scoring for this long ends the match anyway
+
+struct FTournamentEntrant
+{
+	FString Name; // as given on the command line
+	EAIBrain Brain = EAIBrain::Search;
+	float Budget = 0.f; // sec per throw, 0 is a greedy one throw search
+	TSharedPtr<const FThrowPolicy> Policy;
+
+	// totals
+	int Played = 0;
+	int Won = 0;
+	int RoundsFirst = 0; // rounds it threw first in (the starter alternates)
+	int RoundsSecond = 0;
+	int RoundsWonFirst = 0;
+	int RoundsWonSecond = 0;
+	int PointsFor = 0;
+	int PointsAgainst = 0;
+};
+
+struct FTournamentMatch
+{
+	int Players[2] = {}; // entrants, [0] plays red and starts the first round
+	int32 Seed = 0;
+
+	int Score[2] = {};
+	int Rounds = 0;
+	int Throws = 0;
+
+	// per player: rounds started and rounds won, split by who started them
+	int RoundsFirst[2] = {};
+	int RoundsWonFirst[2] = {};
+	int RoundsWonSecond[2] = {};
+
+	int Winner() const { return Score[0] >= Score[1] ? 0 : 1; }
+};
+
+static bool ParseEntrant(const FString& spec, FTournamentEntrant& out)
+{
+	TArray<FString> parts;
+	spec.ParseIntoArray(parts, TEXT(":"));
+	if (parts.Num() < 2) return false;
+
+	out.Name = spec;
+	out.Budget = FCString::Atof(*parts[1]);
+	if (parts[0] == TEXT("search")) {
+		out.Brain = EAIBrain::Search;
+		return parts.Num() == 2;
+	}
+	if (parts[0] == TEXT("policy") && parts.Num() == 3) {
+		out.Brain = EAIBrain::Policy;
+		const auto* asset = LoadObject<UThrowPolicyAsset>(nullptr, *parts[2]);
+		if (!asset) return false;
+		out.Policy = MakeShared<const FThrowPolicy>(asset);
+		return out.Policy->IsValid();
+	}
+	return false;
+}
+
+// the game mode's round scoring, see `APuckManager::RankAll`
+static FRoundScore ScoreRound(const FAIPlanRequest& table)
+{
+	TArray<TPair<float, int>, TInlineAllocator<ERound::TotalThrows>> ranked; // X, puck
+	for (int i = 0; i < table.Pucks.Num(); ++i) {
+		ranked.Emplace(table.Pucks[i].Key.X, i);
+	}
+	ranked.Sort([](const auto& a, const auto& b) { return a.Key > b.Key; });
+
+	FRoundScore score;
+	for (const auto& r : ranked) {
+		const auto& puck = table.Pucks[r.Value];
+		if (!score.Add(puck.Value, table.Zones.GetPoints(FVector(puck.Key, table.PuckZ)))) break;
+	}
+	return score;
+}
+
+// `base` holds the table, both sides use it to plan; throws alternate, [0] starts the first
+// round and the rounds swap who starts, as `AShufflCommonGameMode::SetupRound` does
+static void PlayMatch(const FAIPlanRequest& base, const TArray<FTournamentEntrant>& entrants,
+	float noise, FThrowDatasetWriter* dataset, FTournamentMatch& match)
+{
+	static const EPuckColor Colors[2] = { EPuckColor::Red, EPuckColor::Blue };
+	const TAtomic<bool> cancel { false };
+
+	FRandomStream rand(match.Seed);
+	FPuckBatchSim sim(base.Params, base.Layout);
+	FAIPlanRequest req = base;
+
+	const FVector2D line = base.LineEnd - base.LineStart;
+	const float lineLen = line.Size();
+	TArray<FThrowSample, TInlineAllocator<ERound::TotalThrows>> samples;
+
+	while (match.Rounds < MaxRounds && FMath::Max(match.Score[0], match.Score[1]) < ERound::WinningScore) {
+		req.Pucks.Reset();
+		samples.Reset();
+
+		for (int turn = 0; turn < ERound::TotalThrows; ++turn) {
+			const int player = (match.Rounds + turn) % 2;
+			const FTournamentEntrant& entrant = entrants[match.Players[player]];
+			req.Color = Colors[player];
+			req.ThrowsLeft = ERound::TotalThrows - turn;
+			req.Budget = entrant.Budget;
+			req.Seed = int32(rand.GetUnsignedInt());
+
+			FAIMove move;
+			if (!entrant.Policy || !entrant.Policy->Decide(req, match.Score[player], match.Score[1 - player], move)) {
+				move = FAIPlanner::Plan(req, cancel);
+			}
+
+			// a human-like hand: off by a bit along the line, in force and in aim
+			FPuckThrow t = move.Throw;
+			if (noise > 0.f && lineLen > 0.f) {
+				const float along = FVector2D::DotProduct(t.Start - base.LineStart, line) / (lineLen * lineLen);
+				t.Start = base.LineStart + line * FMath::Clamp(along + rand.FRandRange(-noise, noise), 0.f, 1.f);
+				t.Force = t.Force.GetRotated(FMath::RadiansToDegrees(rand.FRandRange(-noise, noise)));
+				t.Force *= 1.f + rand.FRandRange(-noise, noise);
+			}
+
+			const int thrownSlot = req.Pucks.Num();
+			sim.Reset(1);
+			for (int slot = 0; slot < thrownSlot; ++slot) {
+				sim.SetPuck(0, slot, req.Pucks[slot].Key);
+			}
+			sim.Throw(0, thrownSlot, t);
+			sim.Run();
+
+			auto pucks = req.Pucks;
+			req.Pucks.Reset();
+			for (int slot = 0; slot <= thrownSlot; ++slot) {
+				if (!sim.IsAlive(0, slot)) continue;
+				req.Pucks.Emplace(sim.GetPosition(0, slot), slot == thrownSlot ? req.Color : pucks[slot].Value);
+			}
+
+			if (dataset) {
+				FThrowSample& sample = samples.AddDefaulted_GetRef();
+				sample.Source = EThrowSource::Tournament;
+				sample.Color = uint8(req.Color);
+				sample.Slot = uint8(turn);
+				sample.TurnId = match.Throws;
+				sample.Throw = t;
+				sample.SetBefore(pucks);
+				sample.SetAfter(req.Pucks);
+			}
+			match.Throws++;
+		}
+
+		const FRoundScore score = ScoreRound(req);
+		const int starter = match.Rounds % 2;
+		match.RoundsFirst[starter]++;
+		if (score.HasWinner()) {
+			const int winner = score.Winner == Colors[0] ? 0 : 1;
+			match.Score[winner] += score.Points;
+			(winner == starter ? match.RoundsWonFirst : match.RoundsWonSecond)[winner]++;
+		}
+		match.Rounds++;
+
+		if (dataset) {
+			for (FThrowSample& sample : samples) {
+				sample.SetOutcome(score);
+			}
+			dataset->Add(samples);
+		}
+	}
+}
+
+UTournamentCommandlet::UTournamentCommandlet()
+{
+	IsClient = false;
+	IsServer = false;
+	IsEditor = false;
+	LogToConsole = true;
+}
+
+int32 UTournamentCommandlet::Main(const FString& params)
+{
+	LogShuffl.SetVerbosity(ELogVerbosity::Display); // the report, the category defaults to warnings
+
+	FString mapName = TEXT("/Game/L_Main");
+	FString entrantSpecs = TEXT("search:0,search:.05");
+	FString csvPath;
+	int matchesPerPair = 100;
+	int threads = FPlatformMisc::NumberOfCoresIncludingHyperthreads();
+	float noise = .02f;
+	int32 seed = 0;
+	FParse::Value(*params, TEXT("Map="), mapName);
+	FParse::Value(*params, TEXT("Entrants="), entrantSpecs, false/*keep the commas*/);
+	FParse::Value(*params, TEXT("Csv="), csvPath);
+	FParse::Value(*params, TEXT("Matches="), matchesPerPair);
+	FParse::Value(*params, TEXT("Threads="), threads);
+	FParse::Value(*params, TEXT("Noise="), noise);
+	FParse::Value(*params, TEXT("Seed="), seed);
+
+	TUniquePtr<FThrowDatasetWriter> dataset;
+	FString datasetDir;
+	if (FParse::Value(*params, TEXT("Dataset="), datasetDir)) {
+		dataset = MakeUnique<FThrowDatasetWriter>(datasetDir, FThrowDatasetWriter::EFullPolicy::Wait);
+	} else if (FParse::Param(*params, TEXT("Dataset"))) {
+		dataset = MakeUnique<FThrowDatasetWriter>(FThrowDatasetWriter::DefaultDirectory(),
+			FThrowDatasetWriter::EFullPolicy::Wait);
+	}
+
+	TArray<FTournamentEntrant> entrants;
+	TArray<FString> specs;
+	entrantSpecs.ParseIntoArray(specs, TEXT(","));
+	for (const FString& spec : specs) {
+		FTournamentEntrant entrant;
+		if (!ParseEntrant(spec, entrant)) {
+			UE_LOG(LogShuffl, Error, TEXT("bad entrant '%s', expected search:<budget> or policy:<budget>:<asset>"), *spec);
+			return 1;
+		}
+		entrants.Add(MoveTemp(entrant));
+	}
+	if (entrants.Num() < 2 || matchesPerPair <= 0) {
+		UE_LOG(LogShuffl, Error, TEXT("need at least 2 entrants and 1 match per pairing"));
+		return 1;
+	}
+
+	//
+	// the table, taken once from the level
+	//
+	APuck* puck = nullptr;
+	FVector startingPoint;
+	UWorld* world = ShufflCommandlet::LoadTable(mapName, puck, startingPoint);
+	if (!world) return 1;
+	ON_SCOPE_EXIT { ShufflCommandlet::UnloadTable(world); };
+	const auto* ctrl = GetDefault<APlayerCtrl>();
+
+	// same as `AAIPlayerCtrl::HandleNewThrow`
+	FAIPlanRequest base;
+	base.Params = FPuckSimParams::FromPuck(puck);
+	base.Layout = FPuckTableLayout::FromWorld(world);
+	base.Zones = FScoringZones::FromWorld(world);
+	base.PuckZ = startingPoint.Z;
+	const FVector lineStart = startingPoint - ctrl->StartingLine / 2.f;
+	base.LineStart = FVector2D(lineStart);
+	base.LineEnd = FVector2D(lineStart + FVector(0, ctrl->StartingLine.Y, 0));
+	base.ForceMax = ctrl->ThrowForceMax;
+	base.SpinVelocityMax = ctrl->EscapeVelocity;
+	if (auto table = FThrowTable::Get(puck)) {
+		base.AddZoneSeeds(*table);
+	}
+
+	//
+	// every ordered pair, matches spread over the workers
+	//
+	TArray<FTournamentMatch> matches;
+	FRandomStream rand(seed);
+	for (int a = 0; a < entrants.Num(); ++a) {
+		for (int b = 0; b < entrants.Num(); ++b) {
+			if (a == b) continue;
+			for (int i = 0; i < matchesPerPair; ++i) {
+				FTournamentMatch& match = matches.AddDefaulted_GetRef();
+				match.Players[0] = a;
+				match.Players[1] = b;
+				match.Seed = int32(rand.GetUnsignedInt());
+			}
+		}
+	}
+
+	UE_LOG(LogShuffl, Display, TEXT("%i entrants, %i matches on %s with %i workers"),
+		entrants.Num(), matches.Num(), *mapName, threads);
+
+	const double startTime = FPlatformTime::Seconds();
+	TAtomic<int32> next { 0 };
+	TAtomic<int32> done { 0 };
+	ParallelFor(FMath::Max(threads, 1), [&](int32 worker) {
+		for (int32 i = next++; i < matches.Num(); i = next++) {
+			PlayMatch(base, entrants, noise, dataset.Get(), matches[i]);
+
+			const int32 finished = ++done;
+			if (finished % 100 == 0) {
+				UE_LOG(LogShuffl, Display, TEXT("%i/%i matches"), finished, matches.Num());
+			}
+		}
+	});
+	const double elapsed = FPlatformTime::Seconds() - startTime;
+
+	//
+	// report
+	//
+	int throws = 0, rounds = 0, minRounds = MAX_int32, maxRounds = 0, unfinished = 0;
+	TArray<int> loserScores, margins;
+	loserScores.SetNumZeroed(ERound::WinningScore);
+	margins.SetNumZeroed(ERound::WinningScore + ERound::PucksPerPlayer * 4);
+	TArray<int> headToHead; // [winner][loser]
+	headToHead.SetNumZeroed(entrants.Num() * entrants.Num());
+
+	for (const FTournamentMatch& match : matches) {
+		throws += match.Throws;
+		rounds += match.Rounds;
+		minRounds = FMath::Min(minRounds, match.Rounds);
+		maxRounds = FMath::Max(maxRounds, match.Rounds);
+
+		const int w = match.Winner();
+		if (match.Score[w] < ERound::WinningScore) {
+			unfinished++;
+			continue;
+		}
+		loserScores[FMath::Min(match.Score[1 - w], loserScores.Num() - 1)]++;
+		margins[FMath::Min(match.Score[w] - match.Score[1 - w], margins.Num() - 1)]++;
+		headToHead[match.Players[w] * entrants.Num() + match.Players[1 - w]]++;
+
+		for (int side = 0; side < 2; ++side) {
+			FTournamentEntrant& e = entrants[match.Players[side]];
+			e.Played++;
+			e.Won += side == w;
+			e.RoundsFirst += match.RoundsFirst[side];
+			e.RoundsSecond += match.Rounds - match.RoundsFirst[side];
+			e.RoundsWonFirst += match.RoundsWonFirst[side];
+			e.RoundsWonSecond += match.RoundsWonSecond[side];
+			e.PointsFor += match.Score[side];
+			e.PointsAgainst += match.Score[1 - side];
+		}
+	}
+
+	UE_LOG(LogShuffl, Display, TEXT("%i matches in %.1f sec: %.2f matches/sec, %.0f throws/sec"),
+		matches.Num(), elapsed, matches.Num() / elapsed, throws / elapsed);
+	UE_LOG(LogShuffl, Display, TEXT("rounds per match: avg %.1f min %i max %i, %i hit the %i round limit"),
+		float(rounds) / matches.Num(), minRounds, maxRounds, unfinished, MaxRounds);
+
+	for (const FTournamentEntrant& e : entrants) {
+		const int played = FMath::Max(e.Played, 1);
+		UE_LOG(LogShuffl, Display, TEXT("%-32s won %5.1f%% (%i/%i) rounds won first %5.1f%% second %5.1f%% | points %.1f - %.1f"),
+			*e.Name, 100.f * e.Won / played, e.Won, e.Played,
+			100.f * e.RoundsWonFirst / FMath::Max(e.RoundsFirst, 1),
+			100.f * e.RoundsWonSecond / FMath::Max(e.RoundsSecond, 1),
+			float(e.PointsFor) / played, float(e.PointsAgainst) / played);
+	}
+
+	for (int a = 0; a < entrants.Num(); ++a) {
+		FString row;
+		for (int b = 0; b < entrants.Num(); ++b) {
+			const int wins = headToHead[a * entrants.Num() + b];
+			const int total = wins + headToHead[b * entrants.Num() + a];
+			row += a == b ? TEXT("    -  ") : FString::Printf(TEXT(" %5.1f%%"), total ? 100.f * wins / total : 0.f);
+		}
+		UE_LOG(LogShuffl, Display, TEXT("vs [%i] %s"), a, *row);
+	}
+
+	FString scores, marginRow;
+	for (int i = 0; i < loserScores.Num(); ++i) {
+		scores += FString::Printf(TEXT(" %i:%i"), i, loserScores[i]);
+	}
+	for (int i = 1; i < margins.Num(); ++i) {
+		marginRow += FString::Printf(TEXT(" %i:%i"), i, margins[i]);
+	}
+	UE_LOG(LogShuffl, Display, TEXT("loser score:%s"), *scores);
+	UE_LOG(LogShuffl, Display, TEXT("winning margin:%s"), *marginRow);
+
+	if (dataset) {
+		dataset->Flush();
+		dataset->WaitForWrites();
+		UE_LOG(LogShuffl, Display, TEXT("dataset: %lld of %i throws recorded, %lld dropped"),
+			dataset->GetNumWritten(), throws, dataset->GetNumDropped());
+		dataset.Reset();
+	}
+
+	if (!csvPath.IsEmpty()) {
+		TArray<FString> lines;
+		lines.Add(TEXT("red,blue,seed,score_red,score_blue,rounds,throws"));
+		for (const FTournamentMatch& match : matches) {
+			lines.Add(FString::Printf(TEXT("%s,%s,%i,%i,%i,%i,%i"),
+				*entrants[match.Players[0]].Name, *entrants[match.Players[1]].Name, match.Seed,
+				match.Score[0], match.Score[1], match.Rounds, match.Throws));
+		}
+		if (!FFileHelper::SaveStringArrayToFile(lines, *csvPath)) {
+			UE_LOG(LogShuffl, Error, TEXT("can't write %s"), *csvPath);
+			return 1;
+		}
+	}
+
+	return 0;
+}
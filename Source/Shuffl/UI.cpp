@@ -33,6 +33,12 @@ void ABoardPlayHUD::DrawHUD()
 {
 	Super::DrawHUD();
 
+	if (const auto* pc = Cast<APlayerCtrl>(GetOwningPlayerController())) {
+		if (const FAimPrediction* ghost = pc->GetAimGhost()) {
+			DrawAimGhost(*ghost, *pc);
+		}
+	}
+
 #ifdef DEBUG_DRAW_TOUCH
 	const auto& pc = *static_cast<APlayerCtrl*>(this->GetOwningPlayerController());
 	for (int i = 0; i < pc.TouchHistory.Num() - 1; ++i) {
@@ -45,6 +51,32 @@ void ABoardPlayHUD::DrawHUD()
 #endif
 }
 
+void ABoardPlayHUD::DrawAimGhost(const FAimPrediction& ghost, const APlayerCtrl& pc)
+{
+	if (!ghost.bOnTable) return;
+
+	const auto* puck = pc.GetPawn<APuck>();
+	const FVector center = Project(ghost.Position);
+	const FVector edge = Project(ghost.Position + FVector(0, puck ? puck->Radius : 2.5f, 0));
+
+	const float radius = FMath::Max(FVector2D::Distance(FVector2D(center), FVector2D(edge)), 4.f);
+	const FLinearColor color = puck && puck->Color == EPuckColor::Blue ?
+		FLinearColor(.2f, .4f, 1.f, .7f) : FLinearColor(1.f, .2f, .2f, .7f);
+
+	constexpr int Segments = 16;
+	for (int i = 0; i < Segments; ++i) {
+		const float a0 = 2.f * PI * i / Segments;
+		const float a1 = 2.f * PI * (i + 1) / Segments;
+		DrawLine(center.X + radius * FMath::Cos(a0), center.Y + radius * FMath::Sin(a0),
+			center.X + radius * FMath::Cos(a1), center.Y + radius * FMath::Sin(a1), color, 2.f);
+	}
+
+	// the zone points, highlighted if the round would be ours
+	const bool leading = puck && ghost.Round.HasWinner() && ghost.Round.Winner == puck->Color;
+	DrawText(FString::Printf(TEXT("%i"), ghost.Points), leading ? FLinearColor::Green : FLinearColor::White,
+		center.X + radius, center.Y - 2.f * radius);
+}
+
 void ABoardPlayHUD::HandleTutorial()
 {
 	switch (TutorialStep)
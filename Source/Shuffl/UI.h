@@ -59,4 +59,7 @@ public:
 	
 	virtual void BeginPlay() override;
 	virtual void DrawHUD() override;
+
+private:
+	void DrawAimGhost(const struct FAimPrediction&, const class APlayerCtrl&);
 };
@@ -15,6 +15,8 @@
 
 #include "XMPP.h"
 #include "Engine/Engine.h"
+#include "Containers/Ticker.h"
+#include "HAL/IConsoleManager.h"
 #include "Online/XMPP/Public/XmppModule.h"
 #include "Online/XMPP/Public/XmppMultiUserChat.h"
 #include "Kismet/GameplayStatics.h"
@@ -23,6 +25,11 @@
 #include "GameSubSys.h"
 #include "Puck.h"
 
+static TAutoConsoleVariable<float> CVarSendInterval(
+	TEXT("Shuffl.XMPPSendInterval"),
+	.2f,
+	TEXT("Seconds between XMPP chat messages, unless a turn critical one is waiting (then next frame)"));
+
 inline void TravelHost(const UObject* context, EPuckColor color)
 {
 	UGameplayStatics::OpenLevel(context, XMPPGameMode::Level, true/*absolute travel*/,
@@ -121,6 +128,14 @@ void FShufflXMPPService::OnLogin(const FXmppUserJid& userJid, bool bWasSuccess,
 
 	LoginTimestamp = FDateTime::UtcNow();
 
+	SendQueue.Reset();
+	Channel.Reset();
+	bPeerStalled = false;
+	if (!TickHandle.IsValid()) {
+		TickHandle = FTicker::GetCoreTicker().AddTicker(
+			FTickerDelegate::CreateRaw(this, &FShufflXMPPService::Tick));
+	}
+
 	State = EXMPPState::LoggedIn;
 	if (auto sys = UGameSubSys::Get(UGameSubSys::GetWorldContext())) {
 		sys->OnXMPPStateChange.Broadcast(EXMPPState::LoggedIn);
@@ -129,6 +144,14 @@ void FShufflXMPPService::OnLogin(const FXmppUserJid& userJid, bool bWasSuccess,
 
 void FShufflXMPPService::Logout()
 {
+	if (TickHandle.IsValid()) {
+		FTicker::GetCoreTicker().RemoveTicker(TickHandle);
+		TickHandle.Reset();
+	}
+	SendQueue.Reset();
+	Channel.Reset();
+	bPeerStalled = false;
+
 	if (!(Connection.IsValid() && 
 		(Connection->GetLoginStatus() == EXmppLoginStatus::LoggedIn))) return;
 
@@ -159,6 +182,10 @@ void FShufflXMPPService::JoinRoom(FString roomId)
 	make_sure(!roomId.IsEmpty());
 
 	RoomId = roomId;
+	PeerProtocol = XMPPWire::Text; // until told otherwise
+	SendQueue.Reset();
+	Channel.Reset();
+	bPeerStalled = false;
 
 	Connection->MultiUserChat()->OnJoinPublicRoom().AddLambda(
 		[&state = State](const TSharedRef<IXmppConnection>& conn, bool success,
@@ -182,6 +209,12 @@ void FShufflXMPPService::StartGame(const UObject* context)
 	make_sure(Connection.IsValid());
 	make_sure(State == EXMPPState::HostReady);
 
+	PeerProtocol = XMPPWire::Text; // until told otherwise
+	SendQueue.Reset();
+	Channel.Reset();
+	bPeerStalled = false;
+	SendChat(FString::Printf(TEXT("%s %i"), ChatCmd::Protocol, XMPPWire::Latest));
+
 	HandshakeSyn = FMath::Rand();
 	SendChat(FString::Printf(TEXT("/travel-syn %i"), HandshakeSyn));
 }
@@ -200,63 +233,150 @@ void FShufflXMPPService::OnChat(const TSharedRef<IXmppConnection>& connection,
 		return;
 	}
 
-	auto sys = UGameSubSys::Get(UGameSubSys::GetWorldContext());
-	make_sure(sys);
-
-	//TODO: find better way as this allocates too much => security vulnerability
-	TArray<FString> args;
-	msg.ParseIntoArrayWS(args);
-	make_sure(args.Num() >= 1);
-	const FString& cmd = args[0];
+	ReceiveChat(msg);
+}
 
+void FShufflXMPPService::ReceiveChat(const FString& msg)
+{
 //
 // TCP style handshake
 // https://en.wikipedia.org/wiki/Transmission_Control_Protocol#Connection_establishment
 //
-	if (cmd == TEXT("/travel-syn") && args.Num() == 2) {
-		HandshakeSyn = FMath::Rand();
-		HandshakeAck = FCString::Atoi(*args[1]);
-		SendChat(FString::Printf(TEXT("/travel-syn-ack %i %i"), HandshakeSyn, HandshakeAck + 1));
-		return;
-	}
+	static const TChatCommand<FShufflXMPPService> Commands[] = {
+		{ ChatCmd::Protocol, 1, 1, &FShufflXMPPService::OnProtocol },
+		{ TEXT("/travel-syn"), 1, 1, &FShufflXMPPService::OnTravelSyn },
+		{ TEXT("/travel-syn-ack"), 2, 2, &FShufflXMPPService::OnTravelSynAck },
+		{ TEXT("/travel-ack"), 2, 2, &FShufflXMPPService::OnTravelAck },
+		{ TEXT("/travel"), 0, 0, &FShufflXMPPService::OnTravel },
+	};
 
-	if (cmd == TEXT("/travel-syn-ack") && args.Num() == 3) {
-		int32 otherSyn = FCString::Atoi(*args[1]);
-		HandshakeAck = FCString::Atoi(*args[2]);
-		if (HandshakeSyn != HandshakeAck - 1) {
-			ShufflErr(TEXT("got faulty handshake syn!"));
-			return;
+//
+// everything else is a game command for the Controllers and Game Mode
+//
+	FXMPPMessage in;
+	if (FXMPPMessage::IsBinary(msg)) {
+		const int32 headerLen = FXMPPMessage::GetBinaryLen(*msg, msg.Len());
+		if (in.DecodeBinary(*msg, headerLen) && in.Type == EXMPPMsg::Frame) {
+			Channel.Receive(in.Frame, *msg + headerLen, msg.Len() - headerLen, FPlatformTime::Seconds(),
+				[this](const TCHAR* body, int32 len) { DeliverBatch(body, len); });
+		} else {
+			DeliverBatch(*msg, msg.Len());
 		}
-		SendChat(FString::Printf(TEXT("/travel-ack %i %i"), otherSyn + 1, HandshakeAck));
 		return;
 	}
 
-	if (cmd == TEXT("/travel-ack") && args.Num() == 3) {
-		int32 otherSyn = FCString::Atoi(*args[1]);
-		int32 otherAck = FCString::Atoi(*args[2]);
-		if (HandshakeSyn != otherSyn - 1) {
-			ShufflErr(TEXT("got faulty handshake ack!"));
-			return;
+	const FChatTokens args(msg);
+	EChatDispatch result = DispatchChat(*this, Commands, args);
+	if (result == EChatDispatch::Handled) return;
+	if (result == EChatDispatch::Unknown) {
+		result = in.DecodeText(args);
+	}
+
+	switch (result) {
+	case EChatDispatch::Handled:
+		Deliver(in);
+		break;
+	case EChatDispatch::Malformed:
+		ShufflErr(TEXT("malformed XMPP message: %s"), *msg);
+		break;
+	default:
+		UE_LOG(LogShuffl, Warning, TEXT("unknown XMPP message: %s"), *msg);
+		break;
+	}
+}
+
+void FShufflXMPPService::DeliverBatch(const TCHAR* body, int32 len)
+{
+	// possibly several back to back, see `XMPPWire::Batch`
+	FXMPPMessage in;
+	while (len > 0) {
+		const int32 msgLen = FXMPPMessage::GetBinaryLen(body, len);
+		if (!in.DecodeBinary(body, msgLen)) {
+			ShufflErr(TEXT("malformed XMPP message: %s"), *FString(msgLen, body));
+		} else {
+			Deliver(in);
 		}
+		body += msgLen;
+		len -= msgLen;
+	}
+}
 
-		TravelInvitee(sys->GetWorldContext(), Color);
-		SendChat(TEXT("/travel"));
-		State = EXMPPState::PlayingGame;
-		sys->OnXMPPStateChange.Broadcast(EXMPPState::PlayingGame);
-		return;
+void FShufflXMPPService::Deliver(const FXMPPMessage& msg)
+{
+	switch (msg.Type) {
+	case EXMPPMsg::NextTurn: OnNextTurn.Broadcast(msg.TurnId); break;
+	case EXMPPMsg::Move: OnMove.Broadcast(msg.TurnId, msg.Move); break;
+	case EXMPPMsg::Throw: OnThrow.Broadcast(msg.TurnId, msg.Throw); break;
+	case EXMPPMsg::Bowl: OnBowl.Broadcast(msg.TurnId); break;
+	case EXMPPMsg::Sync: OnSync.Broadcast(msg.TurnId, msg.Sync); break;
+	case EXMPPMsg::ScoreSync: OnScoreSync.Broadcast(msg.TurnId, msg.ScoreSync); break;
+	case EXMPPMsg::SyncDelta: OnSyncDelta.Broadcast(msg.TurnId, msg.SyncDelta); break;
+	case EXMPPMsg::SyncAck: OnSyncAck.Broadcast(msg.TurnId, msg.SyncAck); break;
+	default: break;
 	}
+}
 
-	if (cmd == TEXT("/travel")) {
-		TravelHost(sys->GetWorldContext(), Color);
-		State = EXMPPState::PlayingGame;
-		sys->OnXMPPStateChange.Broadcast(EXMPPState::PlayingGame);
-		return;
+bool FShufflXMPPService::OnProtocol(const FChatTokens& args)
+{
+	int32 version;
+	if (!args.Int(1, version) || version < 1) return false;
+	PeerProtocol = uint8(FMath::Min(version, 255));
+	return true;
+}
+
+bool FShufflXMPPService::OnTravelSyn(const FChatTokens& args)
+{
+	if (!args.Int(1, HandshakeAck)) return false;
+	// a new game, the host starts over too
+	SendQueue.Reset();
+	Channel.Reset();
+	bPeerStalled = false;
+	SendChat(FString::Printf(TEXT("%s %i"), ChatCmd::Protocol, XMPPWire::Latest));
+	HandshakeSyn = FMath::Rand();
+	SendChat(FString::Printf(TEXT("/travel-syn-ack %i %i"), HandshakeSyn, HandshakeAck + 1));
+	return true;
+}
+
+bool FShufflXMPPService::OnTravelSynAck(const FChatTokens& args)
+{
+	int32 otherSyn;
+	if (!args.Int(1, otherSyn) || !args.Int(2, HandshakeAck)) return false;
+	if (HandshakeSyn != HandshakeAck - 1) {
+		ShufflErr(TEXT("got faulty handshake syn!"));
+		return true;
 	}
+	SendChat(FString::Printf(TEXT("/travel-ack %i %i"), otherSyn + 1, HandshakeAck));
+	return true;
+}
 
-//
-// pass everything else to the Controllers
-//
-	sys->OnXMPPChatReceived.Broadcast(msg);
+bool FShufflXMPPService::OnTravelAck(const FChatTokens& args)
+{
+	int32 otherSyn, otherAck;
+	if (!args.Int(1, otherSyn) || !args.Int(2, otherAck)) return false;
+	if (HandshakeSyn != otherSyn - 1) {
+		ShufflErr(TEXT("got faulty handshake ack!"));
+		return true;
+	}
+
+	auto sys = UGameSubSys::Get(UGameSubSys::GetWorldContext());
+	if (!ensure(sys)) return true;
+	ShufflLog(TEXT("XMPP protocol %i"), GetProtocol());
+	TravelInvitee(sys->GetWorldContext(), Color);
+	SendChat(TEXT("/travel"));
+	State = EXMPPState::PlayingGame;
+	sys->OnXMPPStateChange.Broadcast(EXMPPState::PlayingGame);
+	return true;
+}
+
+bool FShufflXMPPService::OnTravel(const FChatTokens&)
+{
+	auto sys = UGameSubSys::Get(UGameSubSys::GetWorldContext());
+	if (!ensure(sys)) return true;
+	ShufflLog(TEXT("XMPP protocol %i"), GetProtocol());
+	TravelHost(sys->GetWorldContext(), Color);
+	State = EXMPPState::PlayingGame;
+	sys->OnXMPPStateChange.Broadcast(EXMPPState::PlayingGame);
+	return true;
 }
 
 void FShufflXMPPService::SendChat(const FString& msg)
@@ -266,3 +386,62 @@ void FShufflXMPPService::SendChat(const FString& msg)
 
 	Connection->MultiUserChat()->SendChat(RoomId, msg, FString());
 }
+
+void FShufflXMPPService::SendMessage(const FXMPPMessage& msg)
+{
+	SendQueue.Push(msg, GetProtocol());
+}
+
+bool FShufflXMPPService::Tick(float)
+{
+	if (!Connection.IsValid() || RoomId.IsEmpty()) return true;
+
+	const double now = FPlatformTime::Seconds();
+	const uint8 protocol = GetProtocol();
+	const bool reliable = protocol >= XMPPWire::Reliable;
+
+	// nothing new for a peer that stopped acknowledging, it piles up (coalesced) in the queue
+	const bool stalled = reliable && Channel.IsStalled();
+	if (stalled != bPeerStalled) {
+		bPeerStalled = stalled;
+		if (stalled) {
+			ShufflErr(TEXT("XMPP peer stopped acknowledging, holding messages back"));
+		} else {
+			ShufflLog(TEXT("XMPP peer is back"));
+		}
+	}
+
+	const int depth = SendQueue.Num();
+	const int chats = stalled ? 0 : SendQueue.Flush(now, CVarSendInterval.GetValueOnGameThread(), protocol,
+		[this, now, protocol, reliable](const FString& body) { SendChat(reliable ? Channel.Wrap(body, now, protocol) : body); });
+	if (chats) {
+		UE_LOG(LogShuffl, Verbose, TEXT("XMPP sent %i messages in %i chats"), depth, chats);
+	}
+
+	if (reliable) {
+		Channel.Tick(now, protocol, [this](const FString& body) { SendChat(body); });
+	}
+	return true;
+}
+
+#if !UE_BUILD_SHIPPING
+
+static FAutoConsoleCommand XMPPQueueCommand(
+	TEXT("Shuffl.XMPPQueue"),
+	TEXT("Outgoing XMPP queue: current depth and totals since login"),
+	FConsoleCommandDelegate::CreateLambda([] {
+		auto sys = UGameSubSys::Get(UGameSubSys::GetWorldContext());
+		if (!sys) return;
+		const auto& queue = sys->XMPP.SendQueue;
+		const auto& stats = queue.GetStats();
+		ShufflLog(TEXT("XMPP queue depth %i (max %i), %i messages: %i coalesced, %i chats sent"),
+			queue.Num(), stats.MaxDepth, stats.Pushed, stats.Coalesced, stats.Chats);
+
+		const auto& channel = sys->XMPP.Channel;
+		const auto& frames = channel.GetStats();
+		ShufflLog(TEXT("XMPP %i frames, %i unacknowledged, %i retransmits, round trip %.0f ms | received %i duplicates, %i out of order"),
+			frames.Frames, channel.NumUnacked(), frames.Retransmits, frames.RoundTrip * 1000.f,
+			frames.Duplicates, frames.HeldBack);
+	}));
+
+#endif // !UE_BUILD_SHIPPING
@@ -20,6 +20,9 @@
 #include "Online/XMPP/Public/XmppChat.h"
 
 #include "Def.h"
+#include "XMPPMessage.h"
+#include "XMPPSendQueue.h"
+#include "XMPPReliable.h"
 
 #include "XMPP.generated.h"
 
@@ -33,6 +36,15 @@ enum class EXMPPState : uint8
 	PlayingGame
 };
 
+// decoded game commands, `turnId` is INDEX_NONE if the sender's protocol doesn't carry it
+DECLARE_MULTICAST_DELEGATE_OneParam(FEvent_XMPPCommand, int /*turnId*/);
+DECLARE_MULTICAST_DELEGATE_TwoParams(FEvent_XMPPMove, int /*turnId*/, const FXMPPMove&);
+DECLARE_MULTICAST_DELEGATE_TwoParams(FEvent_XMPPThrow, int /*turnId*/, const FXMPPThrow&);
+DECLARE_MULTICAST_DELEGATE_TwoParams(FEvent_XMPPSync, int /*turnId*/, const FXMPPSync&);
+DECLARE_MULTICAST_DELEGATE_TwoParams(FEvent_XMPPScoreSync, int /*turnId*/, const FXMPPScoreSync&);
+DECLARE_MULTICAST_DELEGATE_TwoParams(FEvent_XMPPSyncDelta, int /*turnId*/, const FXMPPSyncDelta&);
+DECLARE_MULTICAST_DELEGATE_TwoParams(FEvent_XMPPSyncAck, int /*turnId*/, const FXMPPSyncAck&);
+
 USTRUCT()
 struct FShufflXMPPService
 {
@@ -47,7 +59,32 @@ struct FShufflXMPPService
 	void OnChat(const TSharedRef<IXmppConnection>&,
 		const FXmppUserJid&,
 		const TSharedRef<FXmppChatMessage>&);
+	void ReceiveChat(const FString&); // the body of a chat from the other side, see `OnChat`
 	void SendChat(const FString&);
+	void SendMessage(const FXMPPMessage&); // queued, see `FXMPPSendQueue`
+	bool Tick(float);
+
+	/** agreed during the travel handshake, see `XMPPWire` */
+	uint8 GetProtocol() const { return FMath::Min(PeerProtocol, XMPPWire::Latest); }
+
+	// every message is decoded once in `OnChat` and handed out by type
+	FEvent_XMPPCommand OnNextTurn;
+	FEvent_XMPPMove OnMove;
+	FEvent_XMPPThrow OnThrow;
+	FEvent_XMPPCommand OnBowl;
+	FEvent_XMPPSync OnSync;
+	FEvent_XMPPScoreSync OnScoreSync;
+	FEvent_XMPPSyncDelta OnSyncDelta;
+	FEvent_XMPPSyncAck OnSyncAck;
+
+	// handshake, see `OnChat`
+	bool OnProtocol(const FChatTokens&);
+	bool OnTravelSyn(const FChatTokens&);
+	bool OnTravelSynAck(const FChatTokens&);
+	bool OnTravelAck(const FChatTokens&);
+	bool OnTravel(const FChatTokens&);
+	void DeliverBatch(const TCHAR* body, int32 len);
+	void Deliver(const FXMPPMessage&);
 
 	TSharedPtr<class IXmppConnection> Connection;
 	EPuckColor Color = EPuckColor::Red;
@@ -57,6 +94,11 @@ struct FShufflXMPPService
 	FDateTime LoginTimestamp = FDateTime(0);
 	int32 HandshakeSyn = 0;
 	int32 HandshakeAck = 0;
+	uint8 PeerProtocol = XMPPWire::Text;
+	FXMPPSendQueue SendQueue;
+	FXMPPReliableChannel Channel;
+	bool bPeerStalled = false;
+	FDelegateHandle TickHandle;
 };
 
 namespace XMPPGameMode //TODO: move these to .ini config
@@ -0,0 +1,458 @@
+// Copyright (C) 2020 Valentin Galea
+//
+// This program is free software : you can redistribute it and /or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#include "XMPPMessage.h"
+#include "Misc/Base64.h"
+#include <cstring>
+
+#include "Shuffl.h"
+#include "Puck.h"
+
+static_assert(PLATFORM_LITTLE_ENDIAN, "the binary protocol is written as in memory");
+static_assert(FChatTokens::MaxTokens >= 2 + FXMPPSync::MaxPucks * 4, "a text /sync must fit");
+
+//
+// https://twitter.com/valentin_galea/status/1245054381583728641
+//
+template<class To, class From>
+inline To bit_cast_generic(From src) noexcept
+{
+	static_assert(sizeof(To) == sizeof(From), "invalid bit cast");
+	To dst;
+	std::memcpy(&dst, &src, sizeof(To));
+	return dst;
+}
+
+inline int32 bit_cast(float f) noexcept
+{
+	return bit_cast_generic<int32>(f);
+}
+
+inline float bit_cast(int32 i) noexcept
+{
+	return bit_cast_generic<float>(i);
+}
+
+// header + the largest message: a full table delta, each varint at most 5 bytes
+static constexpr int MaxBinarySize = 4 + 5 + FXMPPSyncDelta::MaxEntries * 3 * 5;
+static_assert(MaxBinarySize >= 4 + 1 + FXMPPSync::MaxPucks * (2 + 3 * 4), "full sync must fit");
+static_assert(uint8(EXMPPMsg::Frame) < 0x10 && XMPPWire::Compact < 0x10, "protocol 6 header packs both in a byte");
+
+static int16 ToFixed(float value, float step)
+{
+	return int16(FMath::Clamp(FMath::RoundToInt(value / step), int32(MIN_int16), int32(MAX_int16)));
+}
+
+struct FWireWriter
+{
+	uint8 Data[MaxBinarySize];
+	int Num = 0;
+
+	template<class T>
+	void Put(T value)
+	{
+		check(Num + int(sizeof(T)) <= MaxBinarySize);
+		std::memcpy(Data + Num, &value, sizeof(T));
+		Num += sizeof(T);
+	}
+	void Put(const FVector& v) { Put(v.X); Put(v.Y); Put(v.Z); }
+	void Put(const FVector2D& v) { Put(v.X); Put(v.Y); }
+
+	void PutVarint(uint32 value)
+	{
+		while (value >= 0x80) {
+			Put(uint8(value | 0x80));
+			value >>= 7;
+		}
+		Put(uint8(value));
+	}
+	void PutZigZag(int32 value) { PutVarint((uint32(value) << 1) ^ uint32(value >> 31)); }
+};
+
+struct FWireReader
+{
+	const uint8* Data;
+	int Num;
+	int Pos = 0;
+
+	template<class T>
+	bool Get(T& out)
+	{
+		if (Pos + int(sizeof(T)) > Num) return false;
+		std::memcpy(&out, Data + Pos, sizeof(T));
+		Pos += sizeof(T);
+		return true;
+	}
+	bool Get(FVector& v) { return Get(v.X) && Get(v.Y) && Get(v.Z); }
+	bool Get(FVector2D& v) { return Get(v.X) && Get(v.Y); }
+
+	bool GetVarint(uint32& out)
+	{
+		out = 0;
+		for (int shift = 0; shift < 35; shift += 7) {
+			uint8 byte;
+			if (!Get(byte)) return false;
+			out |= uint32(byte & 0x7f) << shift;
+			if (!(byte & 0x80)) return true;
+		}
+		return false; // too long
+	}
+	bool GetZigZag(int32& out)
+	{
+		uint32 value;
+		if (!GetVarint(value)) return false;
+		out = int32(value >> 1) ^ -int32(value & 1);
+		return true;
+	}
+};
+
+const TCHAR* FXMPPMessage::GetName(EXMPPMsg type)
+{
+	switch (type) {
+	case EXMPPMsg::NextTurn: return ChatCmd::NextTurn;
+	case EXMPPMsg::Move: return ChatCmd::Move;
+	case EXMPPMsg::Throw: return ChatCmd::Throw;
+	case EXMPPMsg::Bowl: return ChatCmd::Bowl;
+	case EXMPPMsg::Sync: return ChatCmd::Sync;
+	case EXMPPMsg::ScoreSync: return ChatCmd::ScoreSync;
+	case EXMPPMsg::SyncDelta: return TEXT("sync delta");
+	case EXMPPMsg::SyncAck: return TEXT("sync ack");
+	case EXMPPMsg::Frame: return TEXT("frame");
+	default: return TEXT("none");
+	}
+}
+
+FString FXMPPMessage::Encode(uint8 protocol) const
+{
+	return protocol >= XMPPWire::Binary ? EncodeBinary(protocol) : EncodeText();
+}
+
+bool FXMPPMessage::IsBinary(const FString& body)
+{
+	return body.StartsWith(XMPPWire::Prefix, ESearchCase::CaseSensitive);
+}
+
+bool FXMPPMessage::Decode(const FString& body)
+{
+	return IsBinary(body) ? DecodeBinary(body) : DecodeText(FChatTokens(body)) == EChatDispatch::Handled;
+}
+
+FString FXMPPMessage::EncodeText() const
+{
+	switch (Type) {
+	case EXMPPMsg::NextTurn:
+		return FString::Printf(TEXT("%s %i"), ChatCmd::NextTurn, TurnId);
+	case EXMPPMsg::Move:
+		return FString::Printf(TEXT("%s %i %i %i"), ChatCmd::Move,
+			bit_cast(Move.Location.X), bit_cast(Move.Location.Y), bit_cast(Move.Location.Z));
+	case EXMPPMsg::Throw:
+		return FString::Printf(TEXT("%s %i %i"), ChatCmd::Throw, bit_cast(Throw.Force.X), bit_cast(Throw.Force.Y));
+	case EXMPPMsg::Bowl:
+		return ChatCmd::Bowl;
+	case EXMPPMsg::Sync: {
+		FString out = FString::Printf(TEXT("%s %i"), ChatCmd::Sync, Sync.Pucks.Num());
+		for (const FXMPPSyncPuck& i : Sync.Pucks) {
+			out += FString::Printf(TEXT(" %i %i %i %i"), i.TurnId,
+				bit_cast(i.Location.X), bit_cast(i.Location.Y), bit_cast(i.Location.Z));
+		}
+		return out;
+	}
+	case EXMPPMsg::ScoreSync:
+		return FString::Printf(TEXT("%s %s %i"), ChatCmd::ScoreSync,
+			PuckColorToString(ScoreSync.Winner), ScoreSync.Points);
+	default:
+		ensure(false);
+		return FString();
+	}
+}
+
+FString FXMPPMessage::EncodeBinary(uint8 protocol) const
+{
+	const bool compact = protocol >= XMPPWire::Compact;
+	FWireWriter out;
+	if (compact) {
+		out.Put(uint8(XMPPWire::Compact | uint8(Type) << 4));
+		out.PutVarint(uint16(TurnId));
+	} else {
+		out.Put(XMPPWire::Binary);
+		out.Put(uint8(Type));
+		out.Put(uint16(TurnId));
+	}
+
+	switch (Type) {
+	case EXMPPMsg::Move:
+		if (compact) {
+			ensureMsgf(FMath::Abs(Move.Position.X) <= MAX_int16 && FMath::Abs(Move.Position.Y) <= MAX_int16,
+				TEXT("move too far from the starting point"));
+			out.Put(int16(Move.Position.X));
+			out.Put(int16(Move.Position.Y));
+		} else {
+			out.Put(Move.Location);
+		}
+		break;
+	case EXMPPMsg::Throw:
+		if (compact) {
+			out.Put(ToFixed(Throw.Force.X, XMPPWire::ForceStep));
+			out.Put(ToFixed(Throw.Force.Y, XMPPWire::ForceStep));
+		} else {
+			out.Put(Throw.Force);
+		}
+		break;
+	case EXMPPMsg::Sync: {
+		const auto& pucks = Sync.Pucks;
+		const int num = FMath::Min(pucks.Num(), FXMPPSync::MaxPucks);
+		ensureMsgf(num == pucks.Num(), TEXT("too many pucks to sync"));
+		out.Put(uint8(num));
+		for (int i = 0; i < num; ++i) {
+			out.Put(uint16(pucks[i].TurnId));
+			out.Put(pucks[i].Location);
+		}
+		break;
+	}
+	case EXMPPMsg::ScoreSync:
+		out.Put(uint8(ScoreSync.Winner));
+		out.Put(uint8(ScoreSync.Points));
+		break;
+	case EXMPPMsg::SyncDelta: {
+		static_assert(FXMPPSyncDelta::MaxEntries < 0x80, "the top bit of the count is the full table flag");
+		const auto& entries = SyncDelta.Entries;
+		const int num = FMath::Min(entries.Num(), FXMPPSyncDelta::MaxEntries);
+		ensureMsgf(num == entries.Num(), TEXT("too many pucks to sync"));
+		out.Put(SyncDelta.Sequence);
+		out.Put(SyncDelta.Base);
+		out.Put(uint8(num | (SyncDelta.bFullTable ? 0x80 : 0)));
+		int prevTurn = 0;
+		for (int i = 0; i < num; ++i) {
+			const auto& e = entries[i];
+			out.PutVarint(uint32(e.TurnId - prevTurn) << 1 | (e.bRemoved ? 1 : 0));
+			prevTurn = e.TurnId;
+			if (!e.bRemoved) {
+				out.PutZigZag(e.Delta.X);
+				out.PutZigZag(e.Delta.Y);
+			}
+		}
+		break;
+	}
+	case EXMPPMsg::SyncAck:
+		out.Put(SyncAck.Sequence);
+		break;
+	case EXMPPMsg::Frame:
+		out.Put(Frame.Sequence);
+		out.Put(Frame.Ack);
+		break;
+	default:
+		break;
+	}
+
+	return XMPPWire::Prefix + FBase64::Encode(out.Data, out.Num);
+}
+
+EChatDispatch FXMPPMessage::DecodeText(const FChatTokens& args)
+{
+	static const TChatCommand<FXMPPMessage> Commands[] = {
+		{ ChatCmd::NextTurn, 1, 1, &FXMPPMessage::ParseNextTurn },
+		{ ChatCmd::Move, 3, 3, &FXMPPMessage::ParseMove },
+		{ ChatCmd::Throw, 2, 2, &FXMPPMessage::ParseThrow },
+		{ ChatCmd::Bowl, 0, 0, &FXMPPMessage::ParseBowl },
+		{ ChatCmd::Sync, 1, 1 + FXMPPSync::MaxPucks * 4, &FXMPPMessage::ParseSync },
+		{ ChatCmd::ScoreSync, 2, 2, &FXMPPMessage::ParseScoreSync },
+	};
+
+	*this = FXMPPMessage();
+	return DispatchChat(*this, Commands, args);
+}
+
+static bool ParseFloat(const FChatTokens& args, int i, float& out)
+{
+	int32 bits;
+	if (!args.Int(i, bits)) return false;
+	out = bit_cast(bits);
+	return true;
+}
+
+static bool ParseVector(const FChatTokens& args, int i, FVector& out)
+{
+	return ParseFloat(args, i, out.X) && ParseFloat(args, i + 1, out.Y) && ParseFloat(args, i + 2, out.Z);
+}
+
+bool FXMPPMessage::ParseNextTurn(const FChatTokens& args)
+{
+	Type = EXMPPMsg::NextTurn;
+	return args.Int(1, TurnId);
+}
+
+bool FXMPPMessage::ParseMove(const FChatTokens& args)
+{
+	Type = EXMPPMsg::Move;
+	return ParseVector(args, 1, Move.Location);
+}
+
+bool FXMPPMessage::ParseThrow(const FChatTokens& args)
+{
+	Type = EXMPPMsg::Throw;
+	return ParseFloat(args, 1, Throw.Force.X) && ParseFloat(args, 2, Throw.Force.Y);
+}
+
+bool FXMPPMessage::ParseBowl(const FChatTokens&)
+{
+	Type = EXMPPMsg::Bowl;
+	return true;
+}
+
+bool FXMPPMessage::ParseSync(const FChatTokens& args)
+{
+	Type = EXMPPMsg::Sync;
+	int32 num;
+	// the count has to match what's actually there
+	if (!args.Int(1, num) || num < 0 || num > FXMPPSync::MaxPucks || args.Num() != 2 + num * 4) return false;
+
+	for (int i = 2; i < args.Num(); i += 4) {
+		FXMPPSyncPuck& puck = Sync.Pucks.AddDefaulted_GetRef();
+		if (!args.Int(i, puck.TurnId) || !ParseVector(args, i + 1, puck.Location)) return false;
+	}
+	return true;
+}
+
+bool FXMPPMessage::ParseScoreSync(const FChatTokens& args)
+{
+	Type = EXMPPMsg::ScoreSync;
+	if (args[1].Equals(PuckColorToString(EPuckColor::Red))) {
+		ScoreSync.Winner = EPuckColor::Red;
+	} else if (args[1].Equals(PuckColorToString(EPuckColor::Blue))) {
+		ScoreSync.Winner = EPuckColor::Blue;
+	} else {
+		return false;
+	}
+	return args.Int(2, ScoreSync.Points) && ScoreSync.Points >= 0;
+}
+
+int32 FXMPPMessage::GetBinaryLen(const TCHAR* body, int32 len)
+{
+	const int prefixLen = FCString::Strlen(XMPPWire::Prefix);
+	for (int32 i = prefixLen; i < len; ++i) {
+		if (!FCString::Strncmp(body + i, XMPPWire::Prefix, prefixLen)) return i;
+	}
+	return len;
+}
+
+bool FXMPPMessage::DecodeBinary(const FString& body)
+{
+	return DecodeBinary(*body, body.Len());
+}
+
+bool FXMPPMessage::DecodeBinary(const TCHAR* body, int32 len)
+{
+	*this = FXMPPMessage();
+	auto malformed = [this] {
+		Type = EXMPPMsg::None;
+		return false;
+	};
+
+	const int prefixLen = FCString::Strlen(XMPPWire::Prefix);
+	if (len < prefixLen || FCString::Strncmp(body, XMPPWire::Prefix, prefixLen)) return malformed();
+	const TCHAR* src = body + prefixLen;
+	const uint32 srcLen = len - prefixLen;
+
+	uint8 data[MaxBinarySize];
+	const uint32 size = FBase64::GetDecodedDataSize(src, srcLen);
+	if (size > sizeof(data) || !FBase64::Decode(src, srcLen, data)) return malformed();
+	FWireReader in { data, int(size) };
+
+	uint8 head;
+	if (!in.Get(head)) return malformed();
+	const bool compact = (head & 0xf) == XMPPWire::Compact;
+	if (compact) {
+		uint32 turnId;
+		if (!in.GetVarint(turnId) || turnId > MAX_uint16) return malformed();
+		Type = EXMPPMsg(head >> 4);
+		TurnId = turnId;
+	} else {
+		uint8 type;
+		uint16 turnId;
+		if (head != XMPPWire::Binary || !in.Get(type) || !in.Get(turnId)) return malformed();
+		Type = EXMPPMsg(type);
+		TurnId = turnId;
+	}
+
+	switch (Type) {
+	case EXMPPMsg::NextTurn:
+	case EXMPPMsg::Bowl:
+		break;
+	case EXMPPMsg::Move:
+		if (compact) {
+			int16 x, y;
+			if (!in.Get(x) || !in.Get(y)) return malformed();
+			Move.Position = FIntPoint(x, y);
+			Move.bTableLocal = true;
+		} else if (!in.Get(Move.Location)) {
+			return malformed();
+		}
+		break;
+	case EXMPPMsg::Throw:
+		if (compact) {
+			int16 x, y;
+			if (!in.Get(x) || !in.Get(y)) return malformed();
+			Throw.Force = FVector2D(x, y) * XMPPWire::ForceStep;
+		} else if (!in.Get(Throw.Force)) {
+			return malformed();
+		}
+		break;
+	case EXMPPMsg::Sync: {
+		uint8 num;
+		if (!in.Get(num) || num > FXMPPSync::MaxPucks) return malformed();
+		for (int i = 0; i < num; ++i) {
+			uint16 puckTurn;
+			FXMPPSyncPuck& puck = Sync.Pucks.AddDefaulted_GetRef();
+			if (!in.Get(puckTurn) || !in.Get(puck.Location)) return malformed();
+			puck.TurnId = puckTurn;
+		}
+		break;
+	}
+	case EXMPPMsg::ScoreSync: {
+		uint8 winner, points;
+		if (!in.Get(winner) || !in.Get(points) || winner > uint8(EPuckColor::Blue)) return malformed();
+		ScoreSync.Winner = EPuckColor(winner);
+		ScoreSync.Points = points;
+		break;
+	}
+	case EXMPPMsg::SyncDelta: {
+		uint8 num;
+		if (!in.Get(SyncDelta.Sequence) || !in.Get(SyncDelta.Base) || !in.Get(num)) return malformed();
+		SyncDelta.bFullTable = num & 0x80;
+		num &= 0x7f;
+		if (num > FXMPPSyncDelta::MaxEntries) return malformed();
+		int turnId = 0;
+		for (int i = 0; i < num; ++i) {
+			uint32 head;
+			if (!in.GetVarint(head) || (head >> 1) > uint32(MAX_uint16)) return malformed();
+			auto& e = SyncDelta.Entries.AddDefaulted_GetRef();
+			e.TurnId = turnId += head >> 1;
+			e.bRemoved = head & 1;
+			if (!e.bRemoved && (!in.GetZigZag(e.Delta.X) || !in.GetZigZag(e.Delta.Y))) return malformed();
+		}
+		break;
+	}
+	case EXMPPMsg::SyncAck:
+		if (!in.Get(SyncAck.Sequence)) return malformed();
+		break;
+	case EXMPPMsg::Frame:
+		if (!in.Get(Frame.Sequence) || !in.Get(Frame.Ack)) return malformed();
+		break;
+	default:
+		return malformed();
+	}
+
+	return in.Pos == in.Num || malformed();
+}
@@ -0,0 +1,211 @@
+// Copyright (C) 2020 Valentin Galea
+//
+// This program is free software : you can redistribute it and /or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "Def.h"
+#include "ChatCommand.h"
+
+//
+// Game commands exchanged over the XMPP room chat
+//
+// Protocol 1 is plain text, e.g. "/move 1123418931 -1063256064 1101004800" with the floats
+// bit_cast to ints and printed in decimal. Protocol 2 packs the same commands little endian
+// in a fixed layout, sent base64 encoded behind `XMPPWire::Prefix`:
+//   version:u8 type:u8 turn:u16 | fields
+//     NextTurn  -
+//     Move      x:f32 y:f32 z:f32
+//     Throw     x:f32 y:f32
+//     Bowl      -
+//     Sync      count:u8 (turn:u16 x:f32 y:f32 z:f32) * count
+//     ScoreSync winner:u8 points:u8
+// Protocol 3 adds the quantized puck sync, see `PuckSync` (binary only):
+//     SyncDelta sequence:u16 base:u16 full:1|count:7
+//               (varint(turn delta << 1 | removed) [zigzag varint dx, dy]) * count
+//     SyncAck   sequence:u16
+// turn delta is from the previous entry's turn id (0 for the first), dx dy from the
+// puck's position in the base or absolute if it's not in there. A knock that moves 3
+// pucks comes to ~24 bytes (33 characters).
+// `turn` is the sender's global turn counter; floats travel bit exact, same as the text.
+// A `/move` goes from ~40 characters to 25 and a full `/sync` from ~330 to 157.
+//
+// Both sides announce their highest protocol with `/proto <n>` ahead of their
+// `/travel-syn` handshake message and then use the lower of the two. Clients from before
+// never send it and drop it as an unknown command, so they keep talking text.
+//
+// Protocol 4 sends several binary messages as one chat body, simply back to back: each
+// starts with the prefix which base64 never contains (see `FXMPPSendQueue`).
+// Protocol 5 puts a header first in every chat for the delivery guarantees, see
+// `FXMPPReliableChannel`:
+//     Frame     sequence:u16 ack:u16
+//
+// Protocol 6 shrinks the header and the two messages of every turn:
+//   version:4|type:4 varint(turn) | fields
+//     Move      x:i16 y:i16     from the starting point in `PuckSync::Step`s, Z is the receiver's
+//     Throw     x:i16 y:i16     in `XMPPWire::ForceStep`s
+// the other messages as before. The low nibble of the first byte tells the headers apart
+// (protocol 2 writes the version, with a zero high nibble). A `/move` or `/throw` is 6
+// bytes, 9 characters, against ~40 and ~29 of the text and 25 and 17 of protocol 2.
+// The throw is rounded to 1/128 of a force unit on the receiving side only, the
+// following sync evens that out.
+//
+
+namespace XMPPWire
+{
+	static constexpr uint8 Text = 1;
+	static constexpr uint8 Binary = 2;
+	static constexpr uint8 Delta = 3;
+	static constexpr uint8 Batch = 4;
+	static constexpr uint8 Reliable = 5;
+	static constexpr uint8 Compact = 6;
+	static constexpr uint8 Latest = Compact;
+
+	static constexpr float ForceStep = 1.f / 128.f; // protocol 6 throws, `ThrowForceMax` is well in 16 bits
+
+	static constexpr auto Prefix = TEXT("~"); // neither base64 nor a command
+}
+
+namespace ChatCmd
+{
+	static constexpr auto Protocol = TEXT("/proto");
+	static constexpr auto NextTurn = TEXT("/turn");
+	static constexpr auto Throw = TEXT("/throw");
+	static constexpr auto Move = TEXT("/move");
+	static constexpr auto Sync = TEXT("/sync");
+	static constexpr auto Bowl = TEXT("/bowl");
+	static constexpr auto ScoreSync = TEXT("/score-sync");
+}
+
+enum class EXMPPMsg : uint8
+{
+	None,
+	NextTurn,
+	Move,
+	Throw,
+	Bowl,
+	Sync,
+	ScoreSync,
+	SyncDelta,
+	SyncAck,
+	Frame
+};
+
+struct FXMPPSyncPuck
+{
+	int TurnId = 0;
+	FVector Location = FVector::ZeroVector;
+};
+
+struct FXMPPMove
+{
+	FVector Location = FVector::ZeroVector;
+
+	/** same spot from the starting point, see `PuckSync::Quantize`: what protocol 6 sends */
+	FIntPoint Position = FIntPoint::ZeroValue;
+	bool bTableLocal = false; // received as `Position` only
+};
+
+struct FXMPPThrow
+{
+	FVector2D Force = FVector2D::ZeroVector;
+};
+
+struct FXMPPSync
+{
+	static constexpr int MaxPucks = ERound::TotalThrows;
+
+	TArray<FXMPPSyncPuck, TInlineAllocator<MaxPucks>> Pucks;
+};
+
+struct FXMPPScoreSync
+{
+	EPuckColor Winner = EPuckColor::Red;
+	int Points = 0;
+};
+
+struct FXMPPSyncDelta
+{
+	static constexpr int MaxEntries = FXMPPSync::MaxPucks * 2; // a whole table replaced
+
+	struct FEntry
+	{
+		int TurnId = 0;
+		bool bRemoved = false;
+		FIntPoint Delta = FIntPoint::ZeroValue; // quantized, absolute if not in the base
+	};
+
+	uint16 Sequence = 0;
+	uint16 Base = 0; // acknowledged sequence the deltas are from, 0 is the empty table
+	bool bFullTable = false; // all the pucks were looked at, otherwise only the ones in `Entries`
+	TArray<FEntry, TInlineAllocator<MaxEntries>> Entries; // sorted by turn id
+};
+
+struct FXMPPSyncAck
+{
+	uint16 Sequence = 0;
+};
+
+struct FXMPPFrame
+{
+	uint16 Sequence = 0; // 0 only acknowledges, nothing follows
+	uint16 Ack = 0; // last sequence received in order, 0 for none
+};
+
+/** any of the commands, only the payload of `Type` is used */
+struct FXMPPMessage
+{
+	EXMPPMsg Type = EXMPPMsg::None;
+	int TurnId = INDEX_NONE; // not carried by the text `/move` `/throw` `/bowl` `/score-sync`
+	FXMPPMove Move;
+	FXMPPThrow Throw;
+	FXMPPSync Sync;
+	FXMPPScoreSync ScoreSync;
+	FXMPPSyncDelta SyncDelta;
+	FXMPPSyncAck SyncAck;
+	FXMPPFrame Frame;
+
+	/** chat body for the given protocol */
+	FString Encode(uint8 protocol) const;
+
+	/** either protocol, false if the body is not a game command or is malformed */
+	bool Decode(const FString& body);
+
+	/** a body starting with `XMPPWire::Prefix`, false if malformed */
+	bool DecodeBinary(const FString& body);
+	bool DecodeBinary(const TCHAR* body, int32 len);
+
+	/** length of the first binary message in a batch starting at `body` */
+	static int32 GetBinaryLen(const TCHAR* body, int32 len);
+
+	/** a text command already split up, `Unknown` if it's not a game command */
+	EChatDispatch DecodeText(const FChatTokens&);
+
+	static bool IsBinary(const FString& body);
+	static const TCHAR* GetName(EXMPPMsg);
+
+private:
+	FString EncodeText() const;
+	FString EncodeBinary(uint8 protocol) const;
+
+	// text commands, see `TChatCommand`
+	bool ParseNextTurn(const FChatTokens&);
+	bool ParseMove(const FChatTokens&);
+	bool ParseThrow(const FChatTokens&);
+	bool ParseBowl(const FChatTokens&);
+	bool ParseSync(const FChatTokens&);
+	bool ParseScoreSync(const FChatTokens&);
+};
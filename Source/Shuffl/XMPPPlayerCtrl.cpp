@@ -14,55 +14,29 @@
 // along with this program. If not, see <https://www.gnu.org/licenses/>.
 
 #include "PlayerCtrl.h"
-#include "EngineUtils.h"
 #include "Components/InputComponent.h"
-#include "Math/UnrealMathUtility.h"
-#include <cstring>
 
 #include "Shuffl.h"
 #include "GameSubSys.h"
 #include "GameModes.h"
 #include "XMPP.h"
+#include "PuckManager.h"
 
-//
-// https://twitter.com/valentin_galea/status/1245054381583728641
-//
-template<class To, class From>
-inline To bit_cast_generic(From src) noexcept
-{
-	static_assert(sizeof(To) == sizeof(From), "invalid bit cast");
-	To dst;
-	std::memcpy(&dst, &src, sizeof(To));
-	return dst;
-}
-
-inline int32 bit_cast(float f) noexcept
-{
-	return bit_cast_generic<int32>(f);
-}
-
-inline float bit_cast(int32 i) noexcept
-{
-	return bit_cast_generic<float>(i);
-}
+//#define VERBOSE
 
-namespace ChatCmd
+static int GetTurnCounter(const AActor* context)
 {
-	static constexpr auto NextTurn = TEXT("/turn");
-	static constexpr auto Throw = TEXT("/throw");
-	static constexpr auto Move = TEXT("/move");
-	static constexpr auto Sync = TEXT("/sync");
-	static constexpr auto Bowl = TEXT("/bowl");
+	auto* gameState = Cast<AShufflGameState>(context->GetWorld()->GetGameState());
+	return gameState->GlobalTurnCounter;
 }
 
-//#define VERBOSE
-
 void AXMPPPlayerCtrl::BeginPlay()
 {
 	Super::BeginPlay();
 
 	if (auto sys = UGameSubSys::Get(this)) {
 		XMPP = &sys->XMPP;
+		XMPP->OnSyncAck.AddUObject(this, &AXMPPPlayerCtrl::ReceiveSyncAck);
 	}
 }
 
@@ -70,9 +44,10 @@ void AXMPPPlayerCtrl::RequestNewThrow()
 {
 	if (PlayMode == EPlayerCtrlMode::Setup) return;
 
-	auto* gameState = Cast<AShufflGameState>(GetWorld()->GetGameState());
-	XMPP->SendChat(FString::Printf(TEXT("%s %i"),
-		ChatCmd::NextTurn, gameState->GlobalTurnCounter));
+	FXMPPMessage msg;
+	msg.Type = EXMPPMsg::NextTurn;
+	msg.TurnId = GetTurnCounter(this);
+	XMPP->SendMessage(msg);
 
 	GetWorld()->GetAuthGameMode<AShufflCommonGameMode>()->NextTurn();
 }
@@ -81,8 +56,13 @@ FVector AXMPPPlayerCtrl::MovePuckOnTouchPosition(FVector2D touchLocation)
 {
 	auto location = Super::MovePuckOnTouchPosition(touchLocation);
 
-	XMPP->SendChat(FString::Printf(TEXT("%s %i %i %i"),
-		ChatCmd::Move, bit_cast(location.X), bit_cast(location.Y), bit_cast(location.Z)));
+	FXMPPMessage msg;
+	msg.Type = EXMPPMsg::Move;
+	msg.TurnId = GetTurnCounter(this);
+	msg.Move.Location = location;
+	const FVector2D offset = (FVector2D(location) - FVector2D(StartingPoint)) / PuckSync::Step;
+	msg.Move.Position = FIntPoint(FMath::RoundToInt(offset.X), FMath::RoundToInt(offset.Y));
+	XMPP->SendMessage(msg);
 
 	return location;
 }
@@ -91,8 +71,7 @@ FVector2D AXMPPPlayerCtrl::ThrowPuck(FVector2D gestureVector, float velocity)
 {
 	auto force = Super::ThrowPuck(gestureVector, velocity);
 
-	XMPP->SendChat(FString::Printf(TEXT("%s %i %i"),
-		ChatCmd::Throw, bit_cast(force.X), bit_cast(force.Y)));
+	SendThrow(force);
 
 	return force;
 }
@@ -101,8 +80,7 @@ FVector2D AXMPPPlayerCtrl::DoSlingshot()
 {
 	auto force = Super::DoSlingshot();
 
-	XMPP->SendChat(FString::Printf(TEXT("%s %i %i"),
-		ChatCmd::Throw, bit_cast(force.X), bit_cast(force.Y)));
+	SendThrow(force);
 
 	return force;
 }
@@ -111,35 +89,73 @@ void AXMPPPlayerCtrl::SetupBowling()
 {
 	Super::SetupBowling();
 
-	XMPP->SendChat(FString::Printf(TEXT("%s"), ChatCmd::Bowl));
+	FXMPPMessage msg;
+	msg.Type = EXMPPMsg::Bowl;
+	msg.TurnId = GetTurnCounter(this);
+	XMPP->SendMessage(msg);
+}
+
+void AXMPPPlayerCtrl::SendThrow(FVector2D force)
+{
+	FXMPPMessage msg;
+	msg.Type = EXMPPMsg::Throw;
+	msg.TurnId = GetTurnCounter(this);
+	msg.Throw.Force = force;
+	XMPP->SendMessage(msg);
 }
 
 void AXMPPPlayerCtrl::SendSync(int turnId)
 {
-	FString out;
-	int num = 0;
-	for (auto i = TActorIterator<APuck>(GetWorld()); i; ++i) {
+	if (XMPP->GetProtocol() >= XMPPWire::Delta) {
+		auto* manager = APuckManager::Get(this);
+		const FVector2D origin = PuckSync::GetOrigin(manager->GetLayout());
+
+		FPuckSyncSnapshot current;
+		for (APuck* i : manager->GetPucks()) {
+			current.Set(i->TurnId, PuckSync::Quantize(FVector2D(i->GetActorLocation()), origin));
+		}
+
+		FXMPPMessage msg;
+		msg.Type = EXMPPMsg::SyncDelta;
+		msg.TurnId = GetTurnCounter(this);
+		if (SyncSender.Build(current, turnId, msg.SyncDelta)) {
+			XMPP->SendMessage(msg);
+		}
+		return;
+	}
+
+	FXMPPMessage msg;
+	msg.Type = EXMPPMsg::Sync;
+	msg.TurnId = GetTurnCounter(this);
+	for (APuck* i : APuckManager::Get(this)->GetPucks()) {
 		// if turnId negative we just send all of them
-		if (turnId >= 0 && (*i)->TurnId != turnId) continue;
+		if (turnId >= 0 && i->TurnId != turnId) continue;
 
-		FVector p = i->GetActorLocation();
-		out += FString::Printf(TEXT(" %i %i %i %i"),
-			i->TurnId, bit_cast(p.X), bit_cast(p.Y), bit_cast(p.Z));
-		num++;
+		msg.Sync.Pucks.Add({ i->TurnId, i->GetActorLocation() });
 	}
 
-	if (num) {
-		XMPP->SendChat(FString::Printf(TEXT("%s %i %s"), ChatCmd::Sync, num, *out));
+	if (msg.Sync.Pucks.Num()) {
+		XMPP->SendMessage(msg);
 	}
 }
 
+void AXMPPPlayerCtrl::ReceiveSyncAck(int /*turnId*/, const FXMPPSyncAck& ack)
+{
+	SyncSender.OnAck(ack.Sequence);
+}
+
 void AXMPPPlayerSpectator::BeginPlay()
 {
 	Super::BeginPlay();
 
 	if (auto sys = UGameSubSys::Get(this)) {
 		XMPP = &sys->XMPP;
-		sys->OnXMPPChatReceived.AddUObject(this, &AXMPPPlayerSpectator::OnReceiveChat);
+		XMPP->OnNextTurn.AddUObject(this, &AXMPPPlayerSpectator::ReceiveNextTurn);
+		XMPP->OnMove.AddUObject(this, &AXMPPPlayerSpectator::ReceiveMove);
+		XMPP->OnThrow.AddUObject(this, &AXMPPPlayerSpectator::ReceiveThrow);
+		XMPP->OnBowl.AddUObject(this, &AXMPPPlayerSpectator::ReceiveBowl);
+		XMPP->OnSync.AddUObject(this, &AXMPPPlayerSpectator::ReceiveSync);
+		XMPP->OnSyncDelta.AddUObject(this, &AXMPPPlayerSpectator::ReceiveSyncDelta);
 	}
 }
 
@@ -155,122 +171,151 @@ void AXMPPPlayerSpectator::RequestNewThrow()
 {
 	if (PlayMode == EPlayerCtrlMode::Setup) return;
 
-	auto* gameState = Cast<AShufflGameState>(GetWorld()->GetGameState());
-	XMPP->SendChat(FString::Printf(TEXT("%s %i"),
-		ChatCmd::NextTurn, gameState->GlobalTurnCounter));
+	FXMPPMessage msg;
+	msg.Type = EXMPPMsg::NextTurn;
+	msg.TurnId = GetTurnCounter(this);
+	XMPP->SendMessage(msg);
 
 	GetWorld()->GetAuthGameMode<AShufflCommonGameMode>()->NextTurn();
 }
 
-void AXMPPPlayerSpectator::OnReceiveChat(FString msg)
+bool AXMPPPlayerSpectator::IsCurrentTurn(EXMPPMsg type, int turnId) const
 {
-	TArray<FString> args;
-	msg.ParseIntoArrayWS(args);
-	make_sure(args.Num() >= 1); //TODO: should do more safety checks
-	const FString &cmd = args[0];
-
-	if (cmd == ChatCmd::NextTurn) {
-		auto* gameState = Cast<AShufflGameState>(GetWorld()->GetGameState());
-		int turnId = FCString::Atoi(*args[1]);
-#ifdef VERBOSE
-		ShufflLog(TEXT("%s %i"), *cmd, turnId);
-#endif
+	// the text protocol doesn't carry the turn for most commands
+	if (turnId == INDEX_NONE || turnId == GetTurnCounter(this)) return true;
 
-		if (turnId == gameState->GlobalTurnCounter) {
-			GetWorld()->GetAuthGameMode<AShufflCommonGameMode>()->NextTurn();
-		} else {
-			ShufflErr(TEXT("Received bad turn %i vs %i"),
-				turnId, gameState->GlobalTurnCounter);
-		}
+	ShufflErr(TEXT("received %s for turn %i during %i"),
+		FXMPPMessage::GetName(type), turnId, GetTurnCounter(this));
+	return false;
+}
 
-		return;
+void AXMPPPlayerSpectator::ReceiveNextTurn(int turnId)
+{
+	if (turnId == GetTurnCounter(this)) {
+		GetWorld()->GetAuthGameMode<AShufflCommonGameMode>()->NextTurn();
+	} else {
+		ShufflErr(TEXT("Received bad turn %i vs %i"), turnId, GetTurnCounter(this));
 	}
+}
 
-	if (cmd == ChatCmd::Move) {
-		float X = bit_cast(FCString::Atoi(*args[1]));
-		float Y = bit_cast(FCString::Atoi(*args[2]));
-		float Z = bit_cast(FCString::Atoi(*args[3]));
+void AXMPPPlayerSpectator::ReceiveMove(int turnId, const FXMPPMove& move)
+{
+	FVector location = move.Location;
+	if (move.bTableLocal && GetPuck()) {
+		const FVector2D xy = FVector2D(StartingPoint) + FVector2D(move.Position) * PuckSync::Step;
+		location = FVector(xy, GetPuck()->GetActorLocation().Z);
+	}
 #ifdef VERBOSE
-		ShufflLog(TEXT("%s (%f) (%f) (%f)"), *cmd, X, Y, Z);
+	ShufflLog(TEXT("%s (%f) (%f) (%f)"), ChatCmd::Move, location.X, location.Y, location.Z);
 #endif
+	if (!IsCurrentTurn(EXMPPMsg::Move, turnId)) return;
 
-		if (GetPuck()) {
-			GetPuck()->MoveTo(FVector(X, Y, Z));
-			PlayMode = EPlayerCtrlMode::Setup;
-		} else {
-			ShufflErr(TEXT("received Move cmd when puck not spawned!"));
-		}
-
-		return;
+	if (GetPuck()) {
+		GetPuck()->MoveTo(location);
+		PlayMode = EPlayerCtrlMode::Setup;
+	} else {
+		ShufflErr(TEXT("received Move cmd when puck not spawned!"));
 	}
+}
 
-	if (cmd == ChatCmd::Throw) {
-		float X = bit_cast(FCString::Atoi(*args[1]));
-		float Y = bit_cast(FCString::Atoi(*args[2]));
+void AXMPPPlayerSpectator::ReceiveThrow(int turnId, const FXMPPThrow& t)
+{
+	const FVector2D& force = t.Force;
 #ifdef VERBOSE
-		ShufflLog(TEXT("%s (%f) (%f)"), *cmd, X, Y);
+	ShufflLog(TEXT("%s (%f) (%f)"), ChatCmd::Throw, force.X, force.Y);
 #endif
+	if (!IsCurrentTurn(EXMPPMsg::Throw, turnId)) return;
 
-		if (X > ThrowForceMax || Y > ThrowForceMax) {
-			ShufflLog(TEXT("received invalid force!"));
-			return;
-		}
+	if (force.X > ThrowForceMax || force.Y > ThrowForceMax) {
+		ShufflLog(TEXT("received invalid force!"));
+		return;
+	}
+
+	if (GetPuck()) {
+		GetPuck()->ApplyThrow(force);
+		PlayMode = EPlayerCtrlMode::Observe;
+	} else {
+		ShufflErr(TEXT("received Throw cmd when puck not spawned!"));
+	}
+}
+
+void AXMPPPlayerSpectator::ReceiveBowl(int /*turnId*/)
+{
+	ShufflLog(TEXT("%s"), ChatCmd::Bowl);
+	SetupBowling();
+}
 
-		if (GetPuck()) {
-			GetPuck()->ApplyThrow(FVector2D(X, Y));
-			PlayMode = EPlayerCtrlMode::Observe;
-		} else {
-			ShufflErr(TEXT("received Throw cmd when puck not spawned!"));
+void AXMPPPlayerSpectator::ReceiveSync(int /*turnId*/, const FXMPPSync& sync)
+{
+	ShufflLog(TEXT("%s %i pucks"), ChatCmd::Sync, sync.Pucks.Num());
+	if (!sync.Pucks.Num()) return;
+	TMap<int, FVector> other_pos;
+	for (const FXMPPSyncPuck& i : sync.Pucks) {
+		other_pos.Add(i.TurnId, i.Location);
+	}
+
+	for (APuck* i : APuckManager::Get(this)->GetPucks()) {
+		if (!other_pos.Contains(i->TurnId)) {
+#ifdef VERBOSE
+			ShufflLog(TEXT("found bad puck during sync: %i <- %i"),
+				GetTurnCounter(this), i->TurnId);
+#endif
+			continue;
 		}
 
-		return;
+		SnapPuck(i, *other_pos.Find(i->TurnId));
 	}
+}
 
-	if (cmd == ChatCmd::Bowl) {
-		ShufflLog(TEXT("%s"), *cmd);
-		SetupBowling();
+void AXMPPPlayerSpectator::ReceiveSyncDelta(int /*turnId*/, const FXMPPSyncDelta& delta)
+{
+	ShufflLog(TEXT("sync delta %i from %i, %i pucks"), delta.Sequence, delta.Base, delta.Entries.Num());
 
+	FPuckSyncSnapshot table;
+	if (!SyncReceiver.Apply(delta, table)) {
+		// no ack, the host starts over from a base we have
+		ShufflLog(TEXT("sync delta %i from unknown %i"), delta.Sequence, delta.Base);
 		return;
 	}
 
-	if (cmd == ChatCmd::Sync) {
-		ShufflLog(TEXT("%s"), *msg);
-		int num = FCString::Atoi(*args[1]);
-		if (num <= 0) return;
-		TMap<int, FVector> other_pos;
-
-		for (int i = 2; i < 2 + num * 4;) {
-			int turnId = FCString::Atoi(*args[i++]);
-			float x = bit_cast(FCString::Atoi(*args[i++]));
-			float y = bit_cast(FCString::Atoi(*args[i++]));
-			float z = bit_cast(FCString::Atoi(*args[i++]));
-			other_pos.Add(turnId, FVector(x, y, z));
-		}
-
-		static uint64 id = 0;
-		for (auto i = TActorIterator<APuck>(GetWorld()); i; ++i) {
-			if (!other_pos.Contains(i->TurnId)) {
-				auto* gameState = Cast<AShufflGameState>(GetWorld()->GetGameState());
+	FXMPPMessage ack;
+	ack.Type = EXMPPMsg::SyncAck;
+	ack.TurnId = GetTurnCounter(this);
+	ack.SyncAck.Sequence = delta.Sequence;
+	XMPP->SendMessage(ack);
+
+	auto* manager = APuckManager::Get(this);
+	const FVector2D origin = PuckSync::GetOrigin(manager->GetLayout());
+	for (APuck* i : manager->GetPucks()) {
+		// pucks not in a partial sync can still be moving, see `PuckSync`
+		if (!delta.bFullTable && !delta.Entries.ContainsByPredicate(
+			[i](const FXMPPSyncDelta::FEntry& e) { return e.TurnId == i->TurnId && !e.bRemoved; })) continue;
+
+		const FIntPoint* q = table.Find(i->TurnId);
+		if (!q) {
 #ifdef VERBOSE
-				ShufflLog(TEXT("found bad puck during sync: %i <- %i"), 
-					gameState->GlobalTurnCounter, i->TurnId);
+			ShufflLog(TEXT("found bad puck during sync: %i <- %i"),
+				GetTurnCounter(this), i->TurnId);
 #endif
-				continue;
-			}
-
-			const FVector p = i->GetActorLocation();
-			const FVector other_p = *other_pos.Find(i->TurnId);
-			const FVector d = p - other_p;
-			if (d.Size() > .05f) {
-				ShufflLog(TEXT("found puck diff by %3.2f"), d.Size());
-			}
-
-			i->SetActorLocation(other_p, false, nullptr, ETeleportType::ResetPhysics);
-			//TODO: set rotation as well and reset?
+			continue;
 		}
 
-		return;
+		// Z isn't sent, resting pucks are all at the same height anyway
+		const FVector2D xy = PuckSync::Dequantize(*q, origin);
+		SnapPuck(i, FVector(xy, i->GetActorLocation().Z));
+	}
+}
+
+void AXMPPPlayerSpectator::SnapPuck(APuck* puck, FVector location)
+{
+	const FVector d = puck->GetActorLocation() - location;
+	if (d.Size() > .05f) {
+		ShufflLog(TEXT("found puck diff by %3.2f"), d.Size());
 	}
+
+	puck->SetActorLocation(location, false, nullptr, ETeleportType::ResetPhysics);
+	APuckManager::Get(this)->OnPuckMoved(puck);
+	//TODO: set rotation as well and reset?
 }
 
 void AXMPPPlayerSpectator::HandleTutorial(bool)
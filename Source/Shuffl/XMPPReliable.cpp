@@ -0,0 +1,149 @@
+// Copyright (C) 2020 Valentin Galea
+//
+// This program is free software : you can redistribute it and /or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#include "XMPPReliable.h"
+
+#include "Shuffl.h"
+
+static uint16 Advance(uint16 sequence)
+{
+	return sequence == MAX_uint16 ? 1 : sequence + 1;
+}
+
+/** modulo 2^16, good for anything less than half the range apart */
+static bool IsAfter(uint16 a, uint16 b)
+{
+	return int16(uint16(a - b)) > 0;
+}
+
+FString FXMPPReliableChannel::Header(uint16 sequence, uint8 protocol)
+{
+	FXMPPMessage msg;
+	msg.Type = EXMPPMsg::Frame;
+	msg.TurnId = 0; // unused, the smallest there is
+	msg.Frame.Sequence = sequence;
+	msg.Frame.Ack = Received;
+	AckDue = 0.; // goes with this one
+	return msg.Encode(FMath::Max(protocol, XMPPWire::Reliable));
+}
+
+FString FXMPPReliableChannel::Wrap(const FString& body, double now, uint8 protocol)
+{
+	const uint16 sequence = NextSequence;
+	NextSequence = Advance(NextSequence);
+
+	Unacked.Add({ sequence, body, now, 0 });
+	Stats.Frames++;
+	return Header(sequence, protocol) + body;
+}
+
+void FXMPPReliableChannel::OnAck(uint16 ack, double now)
+{
+	if (!ack) return;
+
+	int acked = 0;
+	for (; acked < Unacked.Num() && !IsAfter(Unacked[acked].Sequence, ack); ++acked) {
+		const FSent& i = Unacked[acked];
+		if (i.Retries) continue; // can't tell which one the ack was for
+
+		const float sample = float(now - i.SentAt);
+		Stats.RoundTrip = Stats.RoundTrip > 0.f ? Stats.RoundTrip * .875f + sample * .125f : sample;
+	}
+	if (!acked) return;
+
+	Unacked.RemoveAt(0, acked);
+	Timeout = Stats.RoundTrip > 0.f ? FMath::Clamp(2.f * Stats.RoundTrip, MinTimeout, MaxTimeout) : InitialTimeout;
+}
+
+void FXMPPReliableChannel::Receive(const FXMPPFrame& frame, const TCHAR* body, int32 len, double now, TFunctionRef<void(const TCHAR*, int32)> deliver)
+{
+	OnAck(frame.Ack, now);
+
+	// the other side sent this well after our oldest frame should have got there
+	if (Unacked.Num() && Stats.RoundTrip > 0.f && now - Unacked[0].SentAt > 1.5f * Stats.RoundTrip) {
+		bResendOldest = true;
+	}
+
+	if (!frame.Sequence) return;
+
+	if (!IsAfter(frame.Sequence, Received)) {
+		// our ack got lost
+		Stats.Duplicates++;
+		AckDue = now;
+		return;
+	}
+
+	if (frame.Sequence != Advance(Received)) {
+		// one before is missing, let the sender know right away
+		AckDue = now;
+		int i = 0;
+		while (i < HeldBack.Num() && IsAfter(frame.Sequence, HeldBack[i].Sequence)) i++;
+		if (i < HeldBack.Num() && HeldBack[i].Sequence == frame.Sequence) {
+			Stats.Duplicates++;
+		} else if (HeldBack.Num() < MaxHeldBack) {
+			HeldBack.Insert(FHeld{ frame.Sequence, FString(len, body) }, i);
+			Stats.HeldBack++;
+		}
+		return;
+	}
+
+	const double due = now + AckDelay;
+	AckDue = AckDue > 0. ? FMath::Min(AckDue, due) : due;
+
+	Received = frame.Sequence;
+	deliver(body, len);
+	while (HeldBack.Num() && HeldBack[0].Sequence == Advance(Received)) {
+		// off the list first, delivering can send and come back in here
+		const FHeld held = MoveTemp(HeldBack[0]);
+		HeldBack.RemoveAt(0, 1, false);
+		Received = held.Sequence;
+		deliver(*held.Body, held.Body.Len());
+	}
+}
+
+void FXMPPReliableChannel::Resend(FSent& frame, double now, uint8 protocol, TFunctionRef<void(const FString&)> send)
+{
+	frame.SentAt = now;
+	frame.Retries++;
+	Stats.Retransmits++;
+	send(Header(frame.Sequence, protocol) + frame.Body);
+}
+
+void FXMPPReliableChannel::Tick(double now, uint8 protocol, TFunctionRef<void(const FString&)> send)
+{
+	// only the oldest ones time out, the ones after get their turn once those are acknowledged
+	const bool timedOut = Unacked.Num() && now - Unacked[0].SentAt >= Timeout;
+	if (timedOut || bResendOldest) {
+		const int num = timedOut ? FMath::Min(Unacked.Num(), RetransmitWindow) : 1;
+		for (int i = 0; i < num; ++i) {
+			Resend(Unacked[i], now, protocol, send);
+		}
+	}
+	bResendOldest = false;
+
+	if (timedOut) {
+		Timeout = FMath::Min(Timeout * 2.f, MaxTimeout);
+		UE_LOG(LogShuffl, Verbose, TEXT("XMPP retransmit, %i frames unacknowledged"), Unacked.Num());
+	}
+
+	if (AckDue > 0. && now >= AckDue) {
+		send(Header(0, protocol));
+	}
+}
+
+void FXMPPReliableChannel::Reset()
+{
+	*this = FXMPPReliableChannel();
+}
@@ -0,0 +1,107 @@
+// Copyright (C) 2020 Valentin Galea
+//
+// This program is free software : you can redistribute it and /or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "XMPPMessage.h"
+
+//
+// Exactly once, in order delivery of chat bodies over the MUC room (protocol 5 and up)
+//
+// The game assumes every message arrives once and in turn order, which mobile links
+// don't keep. Every chat the send queue flushes becomes a frame with a sequence number
+// and the cumulative ack of what arrived from the other side, in a `FXMPPFrame` header:
+// - frames are kept until acknowledged; when the oldest isn't after a timeout of about 2
+//   round trips (measured on frames that got through first time, doubling while nothing
+//   does) it and the next `RetransmitWindow - 1` are sent again, never more in one go so
+//   a peer that dropped off doesn't get the room flooded
+// - a frame past a gap is held back until the gap fills and answered with an immediate
+//   ack; a frame whose ack still misses one sent more than a round trip before it means
+//   that one was lost, it's sent again right away instead of waiting for the timeout
+// - frames already delivered are dropped and acknowledged again, their ack was lost
+// - with nothing to piggyback on, an ack goes out on its own after `AckDelay`
+// - past `MaxUnacked` frames the other side is taken as gone (`IsStalled`), new messages
+//   wait in the send queue until acks come back, only the retransmits keep going
+// Sequence numbers wrap and skip 0 (the ack only frame), so they compare modulo 2^16.
+//
+
+class FXMPPReliableChannel
+{
+public:
+	static constexpr float AckDelay = .1f; // sec
+	static constexpr float InitialTimeout = 1.f;
+	static constexpr float MinTimeout = .25f;
+	static constexpr float MaxTimeout = 4.f;
+	static constexpr int MaxHeldBack = 32; // frames past a gap, the rest are left to retransmit
+	static constexpr int RetransmitWindow = 2; // oldest frames resent per timeout
+	static constexpr int MaxUnacked = 64;
+
+	/** header (encoded for `protocol`) + `body`, kept until acknowledged */
+	FString Wrap(const FString& body, double now, uint8 protocol);
+
+	/**
+	 * takes in a frame, `body` is the chat after the header; calls `deliver` with it and any
+	 * held back ones it frees up, in order, none for duplicates or if a frame before is
+	 * missing (then it's copied to be held back)
+	 */
+	void Receive(const FXMPPFrame&, const TCHAR* body, int32 len, double now, TFunctionRef<void(const TCHAR*, int32)> deliver);
+
+	/** retransmits and acks that are due */
+	void Tick(double now, uint8 protocol, TFunctionRef<void(const FString&)> send);
+
+	void Reset();
+
+	int NumUnacked() const { return Unacked.Num(); }
+	bool IsStalled() const { return Unacked.Num() >= MaxUnacked; }
+
+	struct FStats
+	{
+		int Frames = 0;
+		int Retransmits = 0;
+		int Duplicates = 0;
+		int HeldBack = 0;
+		float RoundTrip = 0.f; // sec, smoothed
+	};
+	const FStats& GetStats() const { return Stats; }
+
+private:
+	struct FSent
+	{
+		uint16 Sequence;
+		FString Body;
+		double SentAt;
+		int Retries;
+	};
+	struct FHeld
+	{
+		uint16 Sequence;
+		FString Body;
+	};
+
+	FString Header(uint16 sequence, uint8 protocol);
+	void OnAck(uint16 ack, double now);
+	void Resend(FSent&, double now, uint8 protocol, TFunctionRef<void(const FString&)> send);
+
+	TArray<FSent> Unacked; // oldest first
+	TArray<FHeld> HeldBack; // sorted
+	uint16 NextSequence = 1;
+	uint16 Received = 0; // last sequence delivered in order
+	bool bResendOldest = false;
+	double AckDue = 0.; // 0 if no ack is owed
+	float Timeout = InitialTimeout;
+	FStats Stats;
+};
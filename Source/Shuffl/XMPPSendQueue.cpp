@@ -0,0 +1,96 @@
+// Copyright (C) 2020 Valentin Galea
+//
+// This program is free software : you can redistribute it and /or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#include "XMPPSendQueue.h"
+
+#include "Shuffl.h"
+
+bool FXMPPSendQueue::IsCritical(EXMPPMsg type)
+{
+	switch (type) {
+	case EXMPPMsg::NextTurn:
+	case EXMPPMsg::Throw:
+	case EXMPPMsg::Bowl:
+	case EXMPPMsg::ScoreSync:
+		return true;
+	default:
+		return false;
+	}
+}
+
+bool FXMPPSendQueue::IsSuperseding(EXMPPMsg type)
+{
+	// only the latest puck position matters, acks are cumulative
+	return type == EXMPPMsg::Move || type == EXMPPMsg::SyncAck;
+}
+
+void FXMPPSendQueue::Push(const FXMPPMessage& msg, uint8 protocol)
+{
+	Stats.Pushed++;
+
+	if (IsSuperseding(msg.Type)) {
+		for (int i = Queue.Num() - 1; i >= 0 && !IsCritical(Queue[i].Type); --i) {
+			if (Queue[i].Type == msg.Type) {
+				Queue.RemoveAt(i);
+				Stats.Coalesced++;
+				break;
+			}
+		}
+	}
+
+	Queue.Add({ msg.Type, msg.Encode(protocol) });
+	bUrgent |= IsCritical(msg.Type);
+	Stats.MaxDepth = FMath::Max(Stats.MaxDepth, Queue.Num());
+}
+
+int FXMPPSendQueue::Flush(double now, float interval, uint8 protocol, TFunctionRef<void(const FString&)> send)
+{
+	if (!Queue.Num()) return 0;
+	if (!bUrgent && now - LastSend < interval) return 0;
+
+	int chats = 0;
+	if (protocol >= XMPPWire::Batch) {
+		int len = 0;
+		for (const auto& i : Queue) {
+			len += i.Body.Len();
+		}
+		FString batch;
+		batch.Reserve(len);
+		for (const auto& i : Queue) {
+			batch += i.Body;
+		}
+		send(batch);
+		chats = 1;
+	} else {
+		for (const auto& i : Queue) {
+			send(i.Body);
+		}
+		chats = Queue.Num();
+	}
+
+	Queue.Reset();
+	bUrgent = false;
+	LastSend = now;
+	Stats.Chats += chats;
+	return chats;
+}
+
+void FXMPPSendQueue::Reset()
+{
+	Queue.Reset();
+	bUrgent = false;
+	LastSend = 0.;
+	Stats = FStats();
+}
@@ -0,0 +1,68 @@
+// Copyright (C) 2020 Valentin Galea
+//
+// This program is free software : you can redistribute it and /or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program. If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "XMPPMessage.h"
+
+//
+// Outgoing XMPP game messages, coalesced and rate limited
+//
+// MUC servers throttle rooms that chat too fast, so a `/move` for every touch update would
+// hold up the `/throw` after it. Messages wait here and go out from the service's tick:
+// - a message of a superseding type (`Move`, `SyncAck`) drops the queued one of the same
+//   type, as long as no critical message sits after it: a throw keeps the move it starts from
+// - a critical message (NextTurn, Throw, Bowl, ScoreSync) sends the queue on the next frame,
+//   the rest waits for `Shuffl.XMPPSendInterval` since the last send
+// - the order is kept, so all a throw ever waits behind is the one latest move
+// - from protocol 4 (`XMPPWire::Batch`) the whole queue goes out as a single chat message
+//
+
+class FXMPPSendQueue
+{
+public:
+	void Push(const FXMPPMessage&, uint8 protocol);
+
+	/** sends the queue if it's due, returns the number of chat messages */
+	int Flush(double now, float interval, uint8 protocol, TFunctionRef<void(const FString&)> send);
+	void Reset();
+
+	int Num() const { return Queue.Num(); }
+
+	struct FStats
+	{
+		int Pushed = 0;
+		int Coalesced = 0; // dropped for a newer one
+		int Chats = 0;
+		int MaxDepth = 0;
+	};
+	const FStats& GetStats() const { return Stats; }
+
+	static bool IsCritical(EXMPPMsg);
+	static bool IsSuperseding(EXMPPMsg);
+
+private:
+	struct FEntry
+	{
+		EXMPPMsg Type;
+		FString Body;
+	};
+	TArray<FEntry> Queue;
+	bool bUrgent = false;
+	double LastSend = 0.;
+	FStats Stats;
+};